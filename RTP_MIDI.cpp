@@ -72,11 +72,55 @@
 
 16/04/2024
   - added SetCallback method to declare callback and instance outside from constructor
+
+14/10/2026
+  - incoming datagrams are read by batches into preallocated reception slots (recvmmsg on Linux, non blocking recvfrom loop on other platforms)
+  - RTPStreamQueue is now a lock-free multiple producers queue (CRTPMIDIBlockQueue) : SendRTPMIDIBlock can be called from several threads
+  - outgoing blocks are copied with memcpy (two spans at most when the block wraps in the queue)
+  - outgoing payload size is bounded (SetMaxPayloadSize / SetPathMTU), blocks which do not fit are sent in next packet
+  - RunSession split in BeginTick / packet processing / EndTick, so sessions can be driven by CRTP_MIDISessionManager on shared sockets
+  - added CRTP_MIDISessionManager : many sessions on a single pair of control/data sockets, driven by a single RunSession call
+  - CloseSession does nothing when session is already closed (no more BY and 50ms wait in destructor of a closed session)
+  - added SetClockSource : timestamps and timers can follow the OS monotonic clock rather than counting RunSession calls
+  - added CRTP_MIDIEventLoop and GetTimeToNextEvent for event driven hosts
+  - added SendNow (packet sent from caller thread) and SetCoalescingWindow. TimeCounter is now atomic as it is read by SendNow
+  - added recovery journal (EnableJournal, CRTPMIDIJournal) : chapters P, C, W and N are sent after the MIDI list and used to repair MIDI state when packets are lost. RS packets move the journal checkpoint
+  - added session statistics (GetStatistics / ResetStatistics, lock-free) : lost, reordered and duplicated packets, bytes in/out, busy ticks, RFC 3550 jitter. Duplicated packets are discarded, late packets are discarded when journal is enabled
+  - added InjectRTPPacket to decode packets which do not come from the data socket (benchmarks, capture files, other transports)
+  - added SetSpanCallback : decoded events of a packet (or of a tick) are delivered in a single call, as arrays of offsets, lengths and timestamps
+  - added CRTPMIDIEventRing and SetEventRing : decoded events are written in a single producer / single consumer ring, read in place by host
+  - added SetSysExCallback (incoming SYSEX streamed by chunks) and EnableSysExPool / ServiceSysExPool (SYSEX buffer grows on demand)
+  - bug corrected : SYSEX buffer was freed with delete rather than delete[]
+  - added SendSysEx : outgoing SYSEX of any size is split in SYSEX_FRAGMENT_SIZE segments read in place, paced by SetSysExPacing
+  - added transmit lanes (RTP_LANE_REALTIME / RTP_LANE_BULK parameter of SendRTPMIDIBlock) : bulk blocks only use the room left by realtime blocks
+  - added SendScheduled (CRTPMIDIScheduler) : MIDI events sent at a future time of the session clock, with exact delta times
+  - bug corrected in ProcessIncomingRTP : delta times of a MIDI list are now accumulated (each one is relative to the previous command)
+  - added SetCompactEncoding : running status, first delta time omitted when 0, short header for MIDI lists up to 15 bytes
+  - bug corrected in GetDeltaTime : sign extension of delta time bytes, reads were not limited to the MIDI list
+  - incoming MIDI list size is checked against the received datagram size, complete channel messages are decoded by a table driven fast path
+  - partner addresses and packet headers are prebuilt when session parameters change, data socket is connected to the partner when sockets are not shared
+  - added CRTP_MIDISessionManager::SendGroupBlock : MIDI list sent once to all opened sessions (sendmmsg on Linux)
+  - CK timestamps are sent on 64 bits. Clock offset, round trip time and skew are estimated from all CK exchanges (see GetClockInfo, RemoteToLocalTime, SetSyncedEventTime)
+  - added EnableJitterBuffer : incoming events are played at their sender time plus a latency adapted to the measured jitter
+  - added SetSessionPolicy : sync cadence, connection loss detection, invitation backoff and fast reconnect can be configured
+  - added SetSessionEventCallback : application is notified at once of connection loss, session closed by partner or refused invitation
+  - bug corrected : RestartSession did not work after the partner closed the session (partner address was cleared)
+  - added CloseSessionAsync : BY is sent (and optionally repeated) by the realtime thread, without blocking the caller
+  - added CRTP_MIDISessionManager::CloseAll : all sessions are closed at the same time within a given deadline
+  - added optional instrumentation (RTP_MIDI_TRACE) : histograms of tick duration and phases, Chrome trace export, USDT probe
+  - added SetInputFilter / SetInputFilterStatus : incoming messages can be filtered by status and channel in the decoder
+  - added InitiateDualStackSession and CRTP_MIDISessionManager::AddSessionAddress : IPv6 partners with dual-stack sockets (IPv6 addresses are compared through a 32 bits key)
+  - added InitiateLocalSession : sessions between endpoints of the same host use shared memory rings instead of UDP sockets (see WaitLocalData)
+  - added SetCapture (CRTPMIDICapture) and ReplayCapture : sent and received datagrams are recorded in a capture file, received ones can be replayed without sockets
+  - added CRTP_MIDISessionManager::SetCapture : datagrams not dispatched to a session are recorded too
+  - buffer sizes can be defined on the compiler command line (see README), packets are built in session buffers instead of the stack, sessions of a session manager do not allocate reception slots
  */
 
 #include "RTP_MIDI.h"
+#include "RTP_MIDI_EventLoop.h"
 #include <string.h>
 #include <stdlib.h>
+#include <thread>
 #include "SystemSleep.h"
 #ifdef SHOW_RTP_INFO
 #include <stdio.h>
@@ -84,8 +128,24 @@
 #ifdef __TARGET_MAC__
 #include <mach/mach_init.h>
 #include <mach/thread_policy.h>
+#include <mach/mach_time.h>
+#endif
+#ifdef __TARGET_LINUX__
+#include <time.h>
 #endif
 
+// Changes of callbacks and ring waiting to be applied by the realtime thread
+#define RTP_CONFIG_CALLBACK		1
+#define RTP_CONFIG_SPAN			2
+#define RTP_CONFIG_RING			4
+#define RTP_CONFIG_SYSEX		8
+
+// Checks of the sizes which can be defined on the compiler command line
+static_assert(SYSEX_FRAGMENT_SIZE<=MAX_RTP_LOAD, "SYSEX_FRAGMENT_SIZE must not be larger than MAX_RTP_LOAD");
+static_assert(MAX_SESSION_NAME_LEN>=2, "MAX_SESSION_NAME_LEN is too small");
+static_assert(RTP_RECEIVE_SLOTS>0, "RTP_RECEIVE_SLOTS must not be null");
+static_assert(RTP_RECEIVE_SLOT_SIZE>=sizeof(TSessionPacket), "RTP_RECEIVE_SLOT_SIZE must hold a session packet");
+
 CRTP_MIDI::CRTP_MIDI(unsigned int SYXInSize, TRTPMIDIDataCallback CallbackFunc, void* UserInstance)
 {
 	this->RemoteIPToInvite=0;
@@ -94,6 +154,16 @@ CRTP_MIDI::CRTP_MIDI(unsigned int SYXInSize, TRTPMIDIDataCallback CallbackFunc,
 
 	DataSocket=INVALID_SOCKET;
 	ControlSocket=INVALID_SOCKET;
+	SharedSockets=false;
+	DataSocketConnected=false;
+	SocketFamily=AF_INET;
+	memset(&RemoteAddressToInvite, 0, sizeof(TRTPMIDIAddress));
+	memset(&PartnerAddress, 0, sizeof(TRTPMIDIAddress));
+	memset(&PartnerControlAddress, 0, sizeof(TRTPMIDIAddress));
+	memset(&PartnerDataAddress, 0, sizeof(TRTPMIDIAddress));
+	PartnerAddressLength=sizeof(sockaddr_in);
+	PartnerIPv6=false;
+	WakeLoop=0;
 	SessionState=SESSION_CLOSED;
 
     SessionPartnerIP=0;
@@ -105,25 +175,82 @@ CRTP_MIDI::CRTP_MIDI(unsigned int SYXInSize, TRTPMIDIDataCallback CallbackFunc,
 
 	InviteCount=0;
 	TimeCounter=0;
+	TimeCounterHigh=0;
+	SyncedEventTime=false;
+	LocalClock=0;
+	ClockSource=RTP_CLOCK_TICK;
+	LastSystemTime=0;
+	TimerRemainder=0;
 	SyncSequenceCounter=0;
 	MeasuredLatency = 0xFFFFFFFF;		// Mark as latency not known for now
 
 	this->IsInitiatorNode=true;
-	this->TimeOutRemote=4;
+	GetDefaultSessionPolicy(&Policy);
+	InviteDelay=Policy.InviteInterval;
+	FastReconnectPending=false;
+	SessionEventCallback=0;
+	SessionEventInstance=0;
+	CloseRequest.store(-1);
+	ByRepeatCount=0;
+	this->TimeOutRemote=Policy.LossThreshold;
 	this->ConnectionLost = false;
 	this->PeerClosedSession = false;
 	this->ConnectionRefused = false;
 
+	MaxPayloadSize=MAX_RTP_LOAD;
+	TransmitLock.clear();
+	CoalescingWindow=0;
+	LastTransmitTime=0;
+	Journal=0;
+	ReceiveSlots=0;
+	GuardPending=false;
+	SequenceValid=false;
+	ResetStatistics();
+	SysExOutBusy.store(false);
+	SysExOutData.store(0);
+	SysExOutSize=0;
+	SysExOutPos=0;
+	SysExPacing=10;
+	LastSysExFragmentTime=0;
+	ScheduleLookahead=10;
+	CompactEncoding=false;
+	SetInputFilter(0);
+	SysExFiltered=false;
+	SysExEventTime=0;
+
 	InSYSEXBufferSize=SYXInSize;
 	InSYSEXBuffer=new unsigned char [InSYSEXBufferSize];
-
-	RTPStreamQueue.ReadPtr = 0;
-	RTPStreamQueue.WritePtr = 0;
+	SysExCallback=0;
+	SysExInstance=0;
+	SysExPoolMaxSize=0;
+	SysExPoolCurrentSize.store(InSYSEXBufferSize);
+	SysExSpare.store(0);
+	SysExRetired.store(0);
 
 	initRTP_SYSEXBuffer();
 
 	this->RTPCallback=CallbackFunc;
 	this->ClientInstance=UserInstance;
+	this->SpanCallback=0;
+	this->SpanInstance=0;
+	this->SpanMode=RTP_SPAN_PER_PACKET;
+	EventSpan.Count=0;
+	EventSpan.DataSize=0;
+	EventSpan.Data=&SpanData[0];
+	this->EventRing=0;
+	this->Capture=0;
+	this->ConfigLock.clear();
+	this->ConfigPending.store(0);
+	this->JitterRing=0;
+#ifdef RTP_MIDI_TRACE
+	this->Trace=&LocalTrace;
+#endif
+	this->JitterMinDelay=0;
+	this->JitterMaxDelay=0;
+	this->JitterDelay.store(0);
+	this->TransitValid=false;
+	this->TransitPackets=0;
+	this->PacketEventTime=0;
 }  // CRTP_MIDI::CRTP_MIDI
 //---------------------------------------------------------------------------
 
@@ -132,12 +259,27 @@ CRTP_MIDI::~CRTP_MIDI(void)
 	CloseSession();
 	CloseSockets();
 
-	if (InSYSEXBuffer!=0) delete InSYSEXBuffer;
+	if (InSYSEXBuffer!=0) delete[] InSYSEXBuffer;
+	EnableSysExPool(0);		// Release spare and retired buffers
+	if (Journal!=0) delete Journal;
+	if (JitterRing!=0) delete JitterRing;
+	if (ReceiveSlots!=0) delete[] ReceiveSlots;
 }  // CRTP_MIDI::~CRTP_MIDI
 //---------------------------------------------------------------------------
 
 void CRTP_MIDI::CloseSockets(void)
 {
+	// Shared sockets belong to the session manager : just forget them
+	DataSocketConnected=false;
+	LocalTransport.Close();
+	if (SharedSockets)
+	{
+		ControlSocket=INVALID_SOCKET;
+		DataSocket=INVALID_SOCKET;
+		SharedSockets=false;
+		return;
+	}
+
 	// Close the UDP sockets
 	if (ControlSocket!=INVALID_SOCKET)
 		CloseSocket(&ControlSocket);
@@ -163,20 +305,13 @@ int CRTP_MIDI::InitiateSession(unsigned int DestIP,
 {
     int CreateError=0;
 	bool SocketOK;
-
-	this->RemoteIPToInvite=DestIP;
-	this->PartnerControlPort=DestCtrlPort;
-	this->PartnerDataPort=DestDataPort;
-
-	this->InitiatorToken=rand()*0xFFFFFFFF;
-	SSRC=rand()*0xFFFFFFFF;
-	RTPSequence=0;
-	LastRTPCounter=0;
-	LastFeedbackCounter=0;
-	SyncSequenceCounter=0;
+	TRTPMIDIAddress DestAddress;
 
 	// Close the control and data sockets, just in case...
 	CloseSockets();
+	AllocateReceiveSlots();
+	this->SharedSockets=false;
+	this->SocketFamily=AF_INET;
 
 	// Open the two UDP sockets (we let the OS give us the local port number)
 	SocketOK=CreateUDPSocket (&ControlSocket, LocalCtrlPort, false);
@@ -191,32 +326,202 @@ int CRTP_MIDI::InitiateSession(unsigned int DestIP,
 	else
 	{
 		// Sockets are opened, we start the session
-		SYSEX_RTPActif=false;
-		SegmentSYSEXInput=false;
-		ConnectionLost = false;
-		InviteCount=0;
-		TimeOutRemote=16;		// 120 seconds -> Five sync sequences every 1.5 seconds then sync sequence every 10 seconds = 11 + 5
-		IncomingThirdByte=false;
-		this->IsInitiatorNode=IsInitiator;
-		if (IsInitiator==false)
-		{  // Do not invite, wait from remote node to start session
-			SessionState=SESSION_WAIT_INVITE_CTRL;
-		}
-		else
-		{ // Initiate session by inviting remote node
-			SessionState=SESSION_INVITE_CONTROL;
-            SessionPartnerIP=RemoteIPToInvite;
-		}
-		SocketLocked=false;		// Must be last instruction after session initialization
-		PrepareTimerEvent(1000);
+		MakeIPv4Address(DestIP, AF_INET, &DestAddress);
+		StartSession((DestIP!=0)?&DestAddress:0, DestCtrlPort, DestDataPort, IsInitiator);
 	}
 
 	return CreateError;
 }  // CRTP_MIDI::InitiateSession
 //---------------------------------------------------------------------------
 
+int CRTP_MIDI::InitiateDualStackSession(const char* DestAddress,
+										unsigned short DestCtrlPort,
+										unsigned short DestDataPort,
+										unsigned short LocalCtrlPort,
+										unsigned short LocalDataPort,
+										bool IsInitiator)
+{
+    int CreateError=0;
+	bool SocketOK;
+	TRTPMIDIAddress Destination;
+
+	if (DestAddress!=0)
+	{
+		if (ParseAddress(DestAddress, AF_INET6, &Destination)==false) return -3;
+	}
+	else if (IsInitiator) return -3;
+
+	CloseSockets();
+	AllocateReceiveSlots();
+	this->SharedSockets=false;
+	this->SocketFamily=AF_INET6;
+
+	SocketOK=CreateDualStackSocket (&ControlSocket, LocalCtrlPort);
+	if (SocketOK==false) CreateError=-1;
+	SocketOK=CreateDualStackSocket (&DataSocket, LocalDataPort);
+	if (SocketOK==false) CreateError=-2;
+
+    if (CreateError!=0)
+	{
+		CloseSockets();
+	}
+	else
+	{
+		StartSession((DestAddress!=0)?&Destination:0, DestCtrlPort, DestDataPort, IsInitiator);
+	}
+
+	return CreateError;
+}  // CRTP_MIDI::InitiateDualStackSession
+//---------------------------------------------------------------------------
+
+int CRTP_MIDI::InitiateLocalSession(const char* Name, bool IsInitiator)
+{
+	TRTPMIDIAddress LocalHost;
+	bool Opened;
+
+	CloseSockets();
+	AllocateReceiveSlots();
+	this->SharedSockets=false;
+	this->SocketFamily=AF_INET;
+
+	if (IsInitiator) Opened=LocalTransport.Open(Name);
+	else Opened=LocalTransport.Create(Name);
+	if (Opened==false) return -1;
+
+	// Session state machine is unchanged : packets from the transport are seen as sent by the loopback address
+	MakeIPv4Address(0x7F000001, AF_INET, &LocalHost);
+	StartSession(IsInitiator?&LocalHost:0, 0, 0, IsInitiator);
+	return 0;
+}  // CRTP_MIDI::InitiateLocalSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::AllocateReceiveSlots(void)
+{
+	if (ReceiveSlots==0) ReceiveSlots=new TRTPReceiveSlot[RTP_RECEIVE_SLOTS];
+}  // CRTP_MIDI::AllocateReceiveSlots
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::WaitLocalData(unsigned int Timeout)
+{
+	return LocalTransport.Wait(Timeout);
+}  // CRTP_MIDI::WaitLocalData
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::AttachSession(TSOCKTYPE SharedControlSocket,
+							  TSOCKTYPE SharedDataSocket,
+							  int Family,
+							  const TRTPMIDIAddress* DestAddress,
+							  unsigned short DestCtrlPort,
+							  unsigned short DestDataPort,
+							  bool IsInitiator)
+{
+	CloseSockets();
+
+	this->SharedSockets=true;
+	this->ControlSocket=SharedControlSocket;
+	this->DataSocket=SharedDataSocket;
+	this->SocketFamily=Family;
+	StartSession(DestAddress, DestCtrlPort, DestDataPort, IsInitiator);
+}  // CRTP_MIDI::AttachSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::StartSession(const TRTPMIDIAddress* DestAddress,
+							 unsigned short DestCtrlPort,
+							 unsigned short DestDataPort,
+							 bool IsInitiator)
+{
+	TRTPMIDIRingEvent PlayoutEvent;
+	bool IsIPv6;
+	unsigned char Initiator;
+
+	if (DestAddress!=0)
+	{
+		this->RemoteAddressToInvite=*DestAddress;
+		this->RemoteIPToInvite=GetAddressKey(DestAddress, &IsIPv6);
+	}
+	else
+	{
+		memset(&RemoteAddressToInvite, 0, sizeof(TRTPMIDIAddress));
+		this->RemoteIPToInvite=0;
+	}
+	this->PartnerControlPort=DestCtrlPort;
+	this->PartnerDataPort=DestDataPort;
+
+	this->InitiatorToken=rand()*0xFFFFFFFF;
+	SSRC=rand()*0xFFFFFFFF;
+	BuildPacketTemplates();
+	RTPSequence=0;
+	LastRTPCounter=0;
+	LastFeedbackCounter=0;
+	SequenceValid=false;
+	GuardPending=false;
+	if (Journal!=0) Journal->Reset(RTPSequence);
+	ResetStatistics();
+	EndSysExTransfer();
+	Scheduler.Reset();
+	SyncSequenceCounter=0;
+	ClockSync.Reset();
+	TransitValid=false;
+	TransitPackets=0;
+	JitterDelay.store(JitterMinDelay, std::memory_order_relaxed);
+	if (JitterRing!=0)
+	{  // Events of previous session are not played
+		while (JitterRing->Peek(&PlayoutEvent)) JitterRing->Release();
+	}
+
+	SYSEX_RTPActif=false;
+	SegmentSYSEXInput=false;
+	ConnectionLost = false;
+	TickTimerEvent=false;
+	InvitationAcceptedOnCtrl=false;
+	InvitationRejectedOnCtrl=false;
+	InvitationAcceptedOnData=false;
+	InvitationRejectedOnData=false;
+	InviteCount=0;
+	InviteDelay=Policy.InviteInterval;
+	FastReconnectPending=false;
+	CloseRequest.store(-1);
+	ByRepeatCount=0;
+	TimeOutRemote=4*Policy.LossThreshold;		// Grace period at startup (default : 120 seconds)
+	IncomingThirdByte=false;
+	this->IsInitiatorNode=IsInitiator;
+	if (Capture!=0)
+	{  // Replay needs the role of the session
+		Initiator=IsInitiator?1:0;
+		Capture->Record(TimeCounter, RTP_CAPTURE_SESSION, &Initiator, 1);
+	}
+	if (IsInitiator==false)
+	{  // Do not invite, wait from remote node to start session
+		SessionState=SESSION_WAIT_INVITE_CTRL;
+		SetPartner(0);
+	}
+	else
+	{ // Initiate session by inviting remote node
+		SessionState=SESSION_INVITE_CONTROL;
+		SetPartner(&RemoteAddressToInvite);
+	}
+	UpdatePartnerAddresses();
+	// Initiator knows the partner data port from start, listener learns it from the data invitation
+	ConnectDataSocket(IsInitiator);
+	SocketLocked=false;		// Must be last instruction after session initialization
+	PrepareTimerEvent(NextInviteDelay());
+}  // CRTP_MIDI::StartSession
+//---------------------------------------------------------------------------
+
 void CRTP_MIDI::CloseSession (void)
 {
+	this->CloseRequest.store(-1);
+
+	// Nothing to close (session never started, or already closed by us or by the partner)
+	if (this->SessionState == SESSION_CLOSED) return;
+
+	// BY has already been sent by CloseSessionAsync
+	if (this->SessionState == SESSION_CLOSING)
+	{
+		SessionState=SESSION_CLOSED;
+		return;
+	}
+
 	// Do not send BYE message if we are not completely connected when we are session listener
 	if (this->IsInitiatorNode == false)
 	{
@@ -230,72 +535,326 @@ void CRTP_MIDI::CloseSession (void)
 }  // CRTP_MIDI::CloseSession
 //---------------------------------------------------------------------------
 
-bool CRTP_MIDI::ProcessControlSocket(bool* InvitationAccepted, bool* InvitationRejected)
+void CRTP_MIDI::CloseSessionAsync (unsigned int ByRepeat)
 {
-	int RecvSize;
-	unsigned char ReceptionBuffer[1024];
-	sockaddr_in SenderData;
-	TSessionPacket* SessionPacket;
-	unsigned int SenderIP;
-	unsigned short SenderPort;
+	// Session is not run (not started, or sockets being closed)
+	if (this->SocketLocked) return;
+
+	this->CloseRequest.store((int)ByRepeat, std::memory_order_release);
+	if (WakeLoop!=0) WakeLoop->Wake();
+	LocalTransport.WakeSelf();
+}  // CRTP_MIDI::CloseSessionAsync
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::IsClosing (void)
+{
+	if (this->CloseRequest.load(std::memory_order_acquire)>=0) return true;
+	return (this->SessionState==SESSION_CLOSING);
+}  // CRTP_MIDI::IsClosing
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::StartClosing (void)
+{
+	int Repeat;
+	bool SendBY=true;
+
+	Repeat=this->CloseRequest.exchange(-1, std::memory_order_acquire);
+	if ((Repeat<0)||(this->SessionState==SESSION_CLOSING)) return;
+
+	// Same rules than CloseSession for the BY message
+	if (this->SessionState==SESSION_CLOSED) SendBY=false;
+	if ((this->IsInitiatorNode==false)&&(this->SessionState==SESSION_WAIT_INVITE_CTRL)) SendBY=false;
+
+	this->SessionState=SESSION_CLOSING;
+	if (SysExOutData.load(std::memory_order_relaxed)!=0) EndSysExTransfer();
+	this->ByRepeatCount=0;
+	this->TimerRunning=false;
+	if (SendBY)
+	{
+		SendBYCommand();
+		this->ByRepeatCount=(unsigned int)Repeat;
+		if (Repeat>0) PrepareTimerEvent(RTP_BY_REPEAT_INTERVAL);
+	}
+}  // CRTP_MIDI::StartClosing
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::RunClosing (void)
+{
+	if (this->ByRepeatCount>0)
+	{
+		if (TickTimerEvent==false) return;
+		SendBYCommand();
+		this->ByRepeatCount--;
+		if (this->ByRepeatCount>0)
+		{
+			PrepareTimerEvent(RTP_BY_REPEAT_INTERVAL);
+			return;
+		}
+	}
+
+	// Last BY has been sent one tick ago at least : sockets can be released
+	this->SessionState=SESSION_CLOSED;
+	this->SocketLocked=true;
+	ConnectDataSocket(false);
+	if (!this->SharedSockets) CloseSockets();		// Shared sockets are released by the session manager
+	NotifySessionEvent(RTP_EVENT_SESSION_CLOSED);
+}  // CRTP_MIDI::RunClosing
+//---------------------------------------------------------------------------
+
+int CRTP_MIDI::ReceiveBatch (TSOCKTYPE Socket, TRTPReceiveSlot* Slots)
+{
+	int SlotCount = 0;
 
-#if defined (__TARGET_MAC__)
-	socklen_t fromlen;
-#endif
 #if defined (__TARGET_LINUX__)
+	// Read as many datagrams as possible with a single system call
+	mmsghdr Messages[RTP_RECEIVE_SLOTS];
+	iovec Vectors[RTP_RECEIVE_SLOTS];
+	int Slot;
+
+	for (Slot = 0; Slot < RTP_RECEIVE_SLOTS; Slot++)
+	{
+		Vectors[Slot].iov_base = &Slots[Slot].Data[0];
+		Vectors[Slot].iov_len = RTP_RECEIVE_SLOT_SIZE;
+		memset(&Messages[Slot].msg_hdr, 0, sizeof(msghdr));
+		Messages[Slot].msg_hdr.msg_name = &Slots[Slot].SenderAddress;
+		Messages[Slot].msg_hdr.msg_namelen = sizeof(TRTPMIDIAddress);
+		Messages[Slot].msg_hdr.msg_iov = &Vectors[Slot];
+		Messages[Slot].msg_hdr.msg_iovlen = 1;
+	}
+
+	SlotCount = recvmmsg(Socket, &Messages[0], RTP_RECEIVE_SLOTS, MSG_DONTWAIT, 0);
+	if (SlotCount < 0) return 0;		// Nothing pending (EAGAIN) or socket error
+
+	for (Slot = 0; Slot < SlotCount; Slot++)
+	{
+		Slots[Slot].Size = (int)Messages[Slot].msg_len;
+		SetSlotSender(&Slots[Slot]);
+	}
+#else
+	// No batched reception on this platform : drain the socket with one recvfrom per datagram
+#if defined (__TARGET_MAC__)
 	socklen_t fromlen;
 #endif
 #if defined (__TARGET_WIN__)
 	int fromlen;
 #endif
 
-	// Check if something has been received on control socket
-	if (DataAvail(ControlSocket, 0))
+	while (SlotCount < RTP_RECEIVE_SLOTS)
+	{
+#if defined (__TARGET_WIN__)
+		if (!DataAvail(Socket, 0)) break;
+#endif
+		fromlen = sizeof(TRTPMIDIAddress);
+#if defined (__TARGET_MAC__)
+		// MSG_DONTWAIT avoids the select() probe for each datagram
+		Slots[SlotCount].Size = (int)recvfrom(Socket, (char*)&Slots[SlotCount].Data[0], RTP_RECEIVE_SLOT_SIZE, MSG_DONTWAIT, &Slots[SlotCount].SenderAddress.Generic, &fromlen);
+		if (Slots[SlotCount].Size < 0) break;		// Socket is empty
+#else
+		Slots[SlotCount].Size = (int)recvfrom(Socket, (char*)&Slots[SlotCount].Data[0], RTP_RECEIVE_SLOT_SIZE, 0, &Slots[SlotCount].SenderAddress.Generic, &fromlen);
+#endif
+		SetSlotSender(&Slots[SlotCount]);
+		SlotCount++;
+	}
+#endif
+
+	return SlotCount;
+}  // CRTP_MIDI::ReceiveBatch
+//---------------------------------------------------------------------------
+
+int CRTP_MIDI::ReceiveLocal (int Channel, TRTPReceiveSlot* Slots)
+{
+	int SlotCount = 0;
+
+	while (SlotCount < RTP_RECEIVE_SLOTS)
+	{
+		Slots[SlotCount].Size = (int)LocalTransport.Receive(Channel, &Slots[SlotCount].Data[0], RTP_RECEIVE_SLOT_SIZE);
+		if (Slots[SlotCount].Size == 0) break;
+		MakeIPv4Address(0x7F000001, AF_INET, &Slots[SlotCount].SenderAddress);
+		SetSlotSender(&Slots[SlotCount]);
+		SlotCount++;
+	}
+	return SlotCount;
+}  // CRTP_MIDI::ReceiveLocal
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::ProcessControlSocket(bool* InvitationAccepted, bool* InvitationRejected)
+{
+	int SlotCount;
+	int Slot;
+
+	// Read everything pending on control socket, then process the batch
+	RTP_TRACE_STAMP(ReceiveStart);
+	if (LocalTransport.IsOpen()) SlotCount = ReceiveLocal(RTP_LOCAL_CONTROL, &ReceiveSlots[0]);
+	else SlotCount = ReceiveBatch(ControlSocket, &ReceiveSlots[0]);
+	RTP_TRACE_ADD(Trace, RTP_TRACE_RECEIVE, ReceiveStart);
+	RTP_TRACE_PACKETS_ADD(Trace, SlotCount);
+
+	RTP_TRACE_DECODE_START(DecodeStart, CallbackMark, Trace);
+	for (Slot = 0; Slot < SlotCount; Slot++)
 	{
-		fromlen = sizeof(sockaddr_in);
-		RecvSize = (int)recvfrom(ControlSocket, (char*)&ReceptionBuffer, sizeof(ReceptionBuffer), 0, (sockaddr*)&SenderData, &fromlen);
+		ProcessControlPacket(&ReceiveSlots[Slot], InvitationAccepted, InvitationRejected);
+	}
+	RTP_TRACE_DECODE_END(Trace, DecodeStart, CallbackMark);
 
-		if (RecvSize == 0) return false;
+	return (SlotCount == RTP_RECEIVE_SLOTS);
+}  // CRTP_MIDI::ProcessControlSocket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::ProcessControlPacket(TRTPReceiveSlot* Slot, bool* InvitationAccepted, bool* InvitationRejected)
+{
+	unsigned char* ReceptionBuffer;
+	TSessionPacket* SessionPacket;
+	unsigned short SenderPort;
 
-		// Check if this is an Apple session message (ignore every other message received on this socket
-		if ((ReceptionBuffer[0] != 0xFF) || (ReceptionBuffer[1] != 0xFF)) return true;
+	if (Slot->Size <= 0) return;
+	if (Capture != 0) CaptureReceived(Slot, 0);
+	if (this->SessionState == SESSION_CLOSING) return;		// BY has been sent, partner must not reopen the session
+	ReceptionBuffer = &Slot->Data[0];
 
-		SenderIP = htonl(SenderData.sin_addr.s_addr);
-		SenderPort = htons(SenderData.sin_port);
-		SessionPacket = (TSessionPacket*)&ReceptionBuffer[0];
+	// Check if this is an Apple session message (ignore every other message received on this socket
+	if ((ReceptionBuffer[0] != 0xFF) || (ReceptionBuffer[1] != 0xFF)) return;
 
-		if ((ReceptionBuffer[2] == 'I') && (ReceptionBuffer[3] == 'N'))
-		{  // We are being invited...
-			// If we are a session listener, start the invitation acceptance process
-			// TODO : if we don't get invitation on data after 5 seconds, return to SESSION_WAIT_INVITE_CTRL state
-			if (this->IsInitiatorNode == false)
+	SenderPort = Slot->SenderPort;
+	SessionPacket = (TSessionPacket*)&ReceptionBuffer[0];
+
+	if ((ReceptionBuffer[2] == 'I') && (ReceptionBuffer[3] == 'N'))
+	{  // We are being invited...
+		// If we are a session listener, start the invitation acceptance process
+		// TODO : if we don't get invitation on data after 5 seconds, return to SESSION_WAIT_INVITE_CTRL state
+		if (this->IsInitiatorNode == false)
+		{
+			if (this->SessionState == SESSION_WAIT_INVITE_CTRL)
 			{
-				if (this->SessionState == SESSION_WAIT_INVITE_CTRL)
-				{
-					this->InitiatorToken = htonl(SessionPacket->InitiatorToken);
-					this->SessionState = SESSION_WAIT_INVITE_DATA;
+				this->InitiatorToken = htonl(SessionPacket->InitiatorToken);
+				BuildPacketTemplates();
+				this->SessionState = SESSION_WAIT_INVITE_DATA;
+				PrepareTimerEvent(5000);
+				this->SendInvitationReply(true, true, &Slot->SenderAddress);
+				SetPartner(&Slot->SenderAddress);
+				this->PartnerControlPort = SenderPort;
+				UpdatePartnerAddresses();
+				ConnectDataSocket(false);		// Data socket may still be connected to the previous partner (fast reconnect)
+			}
+			else
+			{  // We are already in the process of being invited, but this may be a repetition from the same source
+				if ((IsPartner(Slot)) && (SenderPort == this->PartnerControlPort))
+				{  // This is a repetition of the invitation we already got : accept it
 					PrepareTimerEvent(5000);
-					this->SendInvitationReply(true, true, SenderIP, SenderPort);
-					this->SessionPartnerIP = SenderIP;
-					this->PartnerControlPort = SenderPort;
+					this->SendInvitationReply(true, true, &Slot->SenderAddress);
 				}
 				else
-				{  // We are already in the process of being invited, but this may be a repetition from the same source
-					if ((SenderIP == this->SessionPartnerIP) && (SenderPort == this->PartnerControlPort))
-					{  // This is a repetition of the invitation we already got : accept it
-						PrepareTimerEvent(5000);
-						this->SendInvitationReply(true, true, SenderIP, SenderPort);
-					}
-					else
-					{  // Reject invitation from other source
-						this->SendInvitationReply(true, false, SenderIP, SenderPort);
-					}
+				{  // Reject invitation from other source
+					this->SendInvitationReply(true, false, &Slot->SenderAddress);
 				}
 			}
-			else
+		}
+		else
+		{
+			// TODO... (why should be receive an invitation if we are a session initiator) ?
+		}
+	}
+	else if ((ReceptionBuffer[2] == 'O') && (ReceptionBuffer[3] == 'K'))
+	{  // Remote device accepted our invitation
+		*InvitationAccepted = true;
+	}
+	else if ((ReceptionBuffer[2] == 'N') && (ReceptionBuffer[3] == 'O'))
+	{  // Remote device rejected our invitation
+		*InvitationRejected = true;
+	}
+	else if ((ReceptionBuffer[2] == 'R') && (ReceptionBuffer[3] == 'S'))
+	{  // Remote device has received our packets up to the given sequence number : recovery journal history can be trimmed
+		if ((Journal != 0) && (IsPartner(Slot)) && (Slot->Size >= (int)sizeof(TFeedbackPacket)))
+		{
+			Journal->Acknowledge(htons(((TFeedbackPacket*)&ReceptionBuffer[0])->SequenceNumber));
+		}
+	}
+	else if ((ReceptionBuffer[2] == 'B') && (ReceptionBuffer[3] == 'Y'))
+	{  // Remote device closes the session
+		if (IsPartner(Slot))  // Only accept BY message from the connected partner
+		{
+			this->PartnerCloseSession();
+			NotifySessionEvent(RTP_EVENT_PEER_CLOSED);
+		}
+	}
+}  // CRTP_MIDI::ProcessControlPacket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::ProcessDataPacket(TRTPReceiveSlot* Slot, bool* InvitationAccepted, bool* InvitationRejected)
+{
+	unsigned char* ReceptionBuffer;
+	TSyncPacket* SyncPacket;
+	unsigned long long Now;
+
+	if (Slot->Size <= 0) return;
+	if (Capture != 0) CaptureReceived(Slot, RTP_CAPTURE_DATA);
+	if (!IsPartner(Slot)) return;		// Only process packets sent from remote partner
+	if (this->SessionState == SESSION_CLOSING) return;
+	ReceptionBuffer = &Slot->Data[0];
+
+	// Process incoming RTP-MIDI packet
+	if ((ReceptionBuffer[0] == 0x80) && (ReceptionBuffer[1] == 0x61))  // Check Apple RTP-MIDI packet signature
+	{
+		if (this->SessionState == SESSION_OPENED)
+		{
+			StatBytesReceived.fetch_add(Slot->Size, std::memory_order_relaxed);
+			ProcessIncomingRTP(&ReceptionBuffer[0], Slot->Size);
+		}
+	}
+
+	else if ((ReceptionBuffer[0] == 0xFF) && (ReceptionBuffer[1] == 0xFF))
+	{
+		if ((ReceptionBuffer[2] == 'C') && (ReceptionBuffer[3] == 'K'))
+		{  // Process clock message first as they come more often than other session messages
+			SyncPacket = (TSyncPacket*)&ReceptionBuffer[0];
+
+			if (SyncPacket->Count == 0)
+			{
+				this->TS1H = htonl(SyncPacket->TS1H);
+				this->TS1L = htonl(SyncPacket->TS1L);
+				Now = GetTime64();
+				SendSyncPacket(1, this->TS1H, this->TS1L, (unsigned int)(Now >> 32), (unsigned int)Now, 0, 0);
+			}
+			else if (SyncPacket->Count == 1)
+			{
+				this->TS1H = htonl(SyncPacket->TS1H);
+				this->TS1L = htonl(SyncPacket->TS1L);
+				this->TS2H = htonl(SyncPacket->TS2H);
+				this->TS2L = htonl(SyncPacket->TS2L);
+				this->MeasuredLatency = TimeCounter - TS1L;
+
+				this->TimeOutRemote = Policy.LossThreshold;
+				Now = GetTime64();
+				this->SendSyncPacket(2, TS1H, TS1L, TS2H, TS2L, (unsigned int)(Now >> 32), (unsigned int)Now);
+				// We are the initiator : CK0 and CK2 times come from our clock
+				ClockSync.AddSample(((unsigned long long)TS1H << 32) | TS1L, ((unsigned long long)TS2H << 32) | TS2L, Now, true, Now);
+				if ((this->IsInitiatorNode) && (SessionState == SESSION_CLOCK_SYNC1))
+				{
+					this->TimeOutRemote = Policy.LossThreshold;
+					this->SessionState = SESSION_OPENED;
+				}
+			}
+			else if (SyncPacket->Count == 2)
 			{
-				// TODO... (why should be receive an invitation if we are a session initiator) ?
+				this->TS1H = htonl(SyncPacket->TS1H);
+				this->TS1L = htonl(SyncPacket->TS1L);
+				this->TS2H = htonl(SyncPacket->TS2H);
+				this->TS2L = htonl(SyncPacket->TS2L);
+				this->TS3H = htonl(SyncPacket->TS3H);
+				this->TS3L = htonl(SyncPacket->TS3L);
+				this->MeasuredLatency = TimeCounter - TS2L;
+				ClockSync.AddSample(((unsigned long long)TS1H << 32) | TS1L, ((unsigned long long)TS2H << 32) | TS2L, ((unsigned long long)TS3H << 32) | TS3L, false, GetTime64());
+				this->TimeOutRemote = Policy.LossThreshold;
+				this->SessionState = SESSION_OPENED;
 			}
+		}  // CK message
+		else if ((ReceptionBuffer[2] == 'I') && (ReceptionBuffer[3] == 'N'))
+		{  // Accept invitation
+			this->SessionState = SESSION_WAIT_CLOCK_SYNC;
+			PrepareTimerEvent(2000);
+			this->SendInvitationReply(false, true, &Slot->SenderAddress);
+			this->PartnerDataPort = Slot->SenderPort;
+			UpdatePartnerAddresses();
+			ConnectDataSocket(true);
 		}
 		else if ((ReceptionBuffer[2] == 'O') && (ReceptionBuffer[3] == 'K'))
 		{  // Remote device accepted our invitation
@@ -306,16 +865,12 @@ bool CRTP_MIDI::ProcessControlSocket(bool* InvitationAccepted, bool* InvitationR
 			*InvitationRejected = true;
 		}
 		else if ((ReceptionBuffer[2] == 'B') && (ReceptionBuffer[3] == 'Y'))
-		{  // Remote device closes the session
-			if (SenderIP == this->SessionPartnerIP)  // Only accept BY message from the connected partner
-			{
-				this->PartnerCloseSession();
-			}
+		{
+			this->PartnerCloseSession();
+			NotifySessionEvent(RTP_EVENT_PEER_CLOSED);
 		}
-		return true;
-	}  // Data available on control socket
-	else return false;
-}  // CRTP_MIDI::ProcessControlSocket
+	}
+}  // CRTP_MIDI::ProcessDataPacket
 //---------------------------------------------------------------------------
 
 void CRTP_MIDI::PartnerCloseSession(void)
@@ -330,174 +885,247 @@ void CRTP_MIDI::PartnerCloseSession(void)
 		SessionState = SESSION_CLOSED;
 	}
 	this->PeerClosedSession = true;
-	this->SessionPartnerIP = 0;
+	SetPartner(0);
+	ConnectDataSocket(false);		// Listener must accept invitations from any device again
 }  // CRTP_MIDI::PartnerCloseSession
 //---------------------------------------------------------------------------
 
 void CRTP_MIDI::RunSession(void)
 {
-	bool TimerEvent = false;
-	unsigned int SenderIP;
-	unsigned short SenderPort;
-	int RecvSize;
-	unsigned char ReceptionBuffer[1024];
-	sockaddr_in SenderData;
-	TSyncPacket* SyncPacket;
-	TLongMIDIRTPMsg LRTPMessage;
-	sockaddr_in AdrEmit;
-	int RTPOutSize;
-	bool InvitationAcceptedOnCtrl;
-	bool InvitationRejectedOnCtrl;
-	bool InvitationAcceptedOnData;
-	bool InvitationRejectedOnData;
-	bool PacketReceivedOnControl;
-	bool PacketReceivedOnData;
+	bool ControlBatchFull;
+	int DataSlotCount;
+	int Slot;
 
-#if defined (__TARGET_MAC__)
-	socklen_t fromlen;
-#endif
+	if (!this->BeginTick()) return;
+	RTP_TRACE_TICK_START(Trace);
+
+	// When sockets are shared, incoming packets are dispatched to the session by the session manager
+	if ((!this->SharedSockets)&&(ReceiveSlots!=0))
+	{
+		// We have to loop until control and data sockets are flushed, as this method is called every 1ms
+		// Otherwise we may introduce processing delays if there are bursts of packets to these ports
+		// Each socket is read by batches, so a burst of packets costs only a few system calls
+		do
+		{
+			ControlBatchFull = this->ProcessControlSocket(&InvitationAcceptedOnCtrl, &InvitationRejectedOnCtrl);
+
+			// Process incoming packets on data socket
+			RTP_TRACE_STAMP(ReceiveStart);
+			if (LocalTransport.IsOpen()) DataSlotCount = ReceiveLocal(RTP_LOCAL_DATA, &ReceiveSlots[0]);
+			else DataSlotCount = ReceiveBatch(DataSocket, &ReceiveSlots[0]);
+			RTP_TRACE_ADD(Trace, RTP_TRACE_RECEIVE, ReceiveStart);
+			RTP_TRACE_PACKETS_ADD(Trace, DataSlotCount);
+
+			RTP_TRACE_DECODE_START(DecodeStart, CallbackMark, Trace);
+			for (Slot = 0; Slot < DataSlotCount; Slot++)
+			{
+				ProcessDataPacket(&ReceiveSlots[Slot], &InvitationAcceptedOnData, &InvitationRejectedOnData);
+			}
+			RTP_TRACE_DECODE_END(Trace, DecodeStart, CallbackMark);
+		} while (ControlBatchFull || (DataSlotCount == RTP_RECEIVE_SLOTS));
+	}
+
+	this->EndTick();
+	RTP_TRACE_TICK_END(Trace);
+}  // CRTP_MIDI::RunSession
+//---------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::GetSystemTime (void)
+{
 #if defined (__TARGET_LINUX__)
-	socklen_t fromlen;
+	timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (unsigned int)((unsigned long long)Now.tv_sec*10000+(unsigned long long)(Now.tv_nsec/100000));
 #endif
-#if defined (__TARGET_WIN__)
-	int fromlen;
+#if defined (__TARGET_MAC__)
+	static mach_timebase_info_data_t TimeBase = {0, 0};
+	unsigned long long Now;
+
+	if (TimeBase.denom == 0) mach_timebase_info(&TimeBase);
+	Now = mach_absolute_time();
+	// Convert in 100us units : Now*numer/denom gives nanoseconds
+	return (unsigned int)((Now/100000)*TimeBase.numer/TimeBase.denom+((Now%100000)*TimeBase.numer/TimeBase.denom)/100000);
 #endif
+#if defined (__TARGET_WIN__)
+	static LARGE_INTEGER Frequency = {0};
+	LARGE_INTEGER Now;
 
-	// Computing time using the thread is not perfect, we should use OS time related data
-	// timeGetTime can be used on Windows, but no direct equivalent in Mac or Linux
-	this->TimeCounter += 10;
-	this->LocalClock += 10;
+	if (Frequency.QuadPart == 0) QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&Now);
+	return (unsigned int)((Now.QuadPart/Frequency.QuadPart)*10000+((Now.QuadPart%Frequency.QuadPart)*10000)/Frequency.QuadPart);
+#endif
+}  // CRTP_MIDI::GetSystemTime
+//---------------------------------------------------------------------------
 
-	// Do not process if communication layers are not ready
-	if (this->SocketLocked) return;
+unsigned int CRTP_MIDI::GetTimeToNextEvent (void)
+{
+	unsigned int PendingMillis;		// Time elapsed since last tick, not yet counted by the timer
+	unsigned int TransmitWait=0xFFFFFFFF;	// Time before next SYSEX fragment or scheduled event (ms)
+	unsigned int Elapsed;
+	unsigned int NextTime;
+	unsigned int Now;
+	bool Scheduled;
+	TRTPMIDIRingEvent PlayoutEvent;
+
+	if (this->SocketLocked) return 0xFFFFFFFF;
+
+	// MIDI data waiting to be sent, clock synchronization to start or close requested
+	if (TransmitPending()) return 0;
+	if (this->CloseRequest.load(std::memory_order_relaxed) >= 0) return 0;
+	if (this->SessionState == SESSION_CLOCK_SYNC0) return 0;
+
+	if (SysExOutData.load(std::memory_order_relaxed) != 0)
+	{
+		Elapsed = GetSystemTime()-this->LastSysExFragmentTime;
+		if (Elapsed >= this->SysExPacing) return 0;
+		TransmitWait = (this->SysExPacing-Elapsed+9)/10;
+	}
 
-	// Check if timer elapsed
-	if (this->TimerRunning)
+	// Playout buffer : the realtime thread releases the events
+	if (JitterRing!=0)
 	{
-		if (this->EventTime > 0)
-			this->EventTime--;
-		if (EventTime == 0)
+		if (JitterRing->Peek(&PlayoutEvent))
 		{
-			this->TimerRunning = false;
-			TimerEvent = true;
+			Now = TimeCounter;
+			if (this->ClockSource == RTP_CLOCK_SYSTEM) Now += GetSystemTime()-this->LastSystemTime;
+			if ((int)(PlayoutEvent.Timestamp-Now) <= 0) return 0;
+			Elapsed = (PlayoutEvent.Timestamp-Now+9)/10;
+			if (Elapsed < TransmitWait) TransmitWait = Elapsed;
 		}
 	}
 
-	// If we are being invited but invitation process does not complete in time, return to listener state
-	if ((TimerEvent) && (this->SessionState == SESSION_WAIT_INVITE_DATA))
-	{
-		this->SessionState = SESSION_WAIT_INVITE_CTRL;
-	}
-	if ((TimerEvent) && (this->SessionState == SESSION_WAIT_CLOCK_SYNC))
+	// Scheduled events : the scheduler belongs to the thread holding the transmit lock
+	if (Scheduler.IntakePending()) return 0;
+	if (this->TransmitLock.test_and_set(std::memory_order_acquire)) return 1;		// SendNow is sending : check again in 1ms
+	Scheduled = Scheduler.GetNextTime(&NextTime);
+	this->TransmitLock.clear(std::memory_order_release);
+	if (Scheduled)
 	{
-		this->SessionState = SESSION_WAIT_INVITE_CTRL;
+		Now = TimeCounter;
+		if (this->ClockSource == RTP_CLOCK_SYSTEM) Now += GetSystemTime()-this->LastSystemTime;
+		if ((int)(NextTime-this->ScheduleLookahead-Now) <= 0) return 0;
+		Elapsed = (NextTime-this->ScheduleLookahead-Now+9)/10;
+		if (Elapsed < TransmitWait) TransmitWait = Elapsed;
 	}
 
-	InvitationAcceptedOnCtrl = false;
-	InvitationRejectedOnCtrl = false;
-	InvitationAcceptedOnData = false;
-	InvitationRejectedOnData = false;
-	// We have to loop until control and data sockets are flushed, as this method is called every 1ms
-	// Otherwise we may introduce processing delays if there are bursts of packets to these ports
-	do
-	{
-		PacketReceivedOnControl = this->ProcessControlSocket(&InvitationAcceptedOnCtrl, &InvitationRejectedOnCtrl);
+	if (this->TimerRunning == false) return TransmitWait;
+	if (this->ClockSource != RTP_CLOCK_SYSTEM) return (this->EventTime < TransmitWait) ? this->EventTime : TransmitWait;
 
-		// Process incoming packets on data socket
-		PacketReceivedOnData = false;
-		if (DataAvail(DataSocket, 0))
-		{
-			PacketReceivedOnData = true;
-			fromlen = sizeof(sockaddr_in);
-			RecvSize = (int)recvfrom(DataSocket, (char*)&ReceptionBuffer, sizeof(ReceptionBuffer), 0, (sockaddr*)&SenderData, &fromlen);
+	PendingMillis = (GetSystemTime()-this->LastSystemTime+this->TimerRemainder)/10;
+	if (PendingMillis >= this->EventTime) return 0;
+	return (this->EventTime-PendingMillis < TransmitWait) ? this->EventTime-PendingMillis : TransmitWait;
+}  // CRTP_MIDI::GetTimeToNextEvent
+//---------------------------------------------------------------------------
 
-			if (RecvSize > 0)
-			{
-				SenderIP = htonl(SenderData.sin_addr.s_addr);
-				SenderPort = htons(SenderData.sin_port);
+void CRTP_MIDI::SetClockSource (int Source)
+{
+	// Take the reference before switching, so the first tick does not see a huge elapsed time
+	this->LastSystemTime = GetSystemTime();
+	this->TimerRemainder = 0;
+	this->ClockSource = Source;
+}  // CRTP_MIDI::SetClockSource
+//---------------------------------------------------------------------------
 
-				if (SenderIP == this->SessionPartnerIP)
-				{
-					// Process incoming RTP-MIDI packet
-					if ((ReceptionBuffer[0] == 0x80) && (ReceptionBuffer[1] == 0x61))  // Check Apple RTP-MIDI packet signature
-					{
-						if (this->SessionState == SESSION_OPENED)
-						{
-							ProcessIncomingRTP(&ReceptionBuffer[0]);
-						}
-					}
+bool CRTP_MIDI::BeginTick(void)
+{
+	unsigned int Elapsed;			// Time elapsed since previous tick (100us)
+	unsigned int ElapsedMillis;
+	unsigned int SystemTime;
 
-					else if ((ReceptionBuffer[0] == 0xFF) && (ReceptionBuffer[1] == 0xFF))
-					{
-						if ((ReceptionBuffer[2] == 'C') && (ReceptionBuffer[3] == 'K'))
-						{  // Process clock message first as they come more often than other session messages
-							SyncPacket = (TSyncPacket*)&ReceptionBuffer[0];
-
-							if (SyncPacket->Count == 0)
-							{
-								this->TS1H = htonl(SyncPacket->TS1H);
-								this->TS1L = htonl(SyncPacket->TS1L);
-								SendSyncPacket(1, this->TS1H, this->TS1L, 0, TimeCounter, 0, 0);
-							}
-							else if (SyncPacket->Count == 1)
-							{
-								this->TS1H = htonl(SyncPacket->TS1H);
-								this->TS1L = htonl(SyncPacket->TS1L);
-								this->TS2H = htonl(SyncPacket->TS2H);
-								this->TS2L = htonl(SyncPacket->TS2L);
-								this->MeasuredLatency = TimeCounter - TS1L;
-
-								this->TimeOutRemote = 4;
-								this->SendSyncPacket(2, TS1H, TS1L, TS2H, TS2L, 0, TimeCounter);
-								if ((this->IsInitiatorNode) && (SessionState == SESSION_CLOCK_SYNC1))
-								{
-									this->TimeOutRemote = 4;
-									this->SessionState = SESSION_OPENED;
-								}
-							}
-							else if (SyncPacket->Count == 2)
-							{
-								this->TS1H = htonl(SyncPacket->TS1H);
-								this->TS1L = htonl(SyncPacket->TS1L);
-								this->TS2H = htonl(SyncPacket->TS2H);
-								this->TS2L = htonl(SyncPacket->TS2L);
-								this->TS3H = htonl(SyncPacket->TS3H);
-								this->TS3L = htonl(SyncPacket->TS3L);
-								this->MeasuredLatency = TimeCounter - TS2L;
-								this->TimeOutRemote = 4;
-								this->SessionState = SESSION_OPENED;
-							}
-						}  // CK message
-						else if ((ReceptionBuffer[2] == 'I') && (ReceptionBuffer[3] == 'N'))
-						{  // Accept invitation
-							this->SessionState = SESSION_WAIT_CLOCK_SYNC;
-							PrepareTimerEvent(2000);
-							this->SendInvitationReply(false, true, SenderIP, SenderPort);
-							this->PartnerDataPort = SenderPort;
-						}
-						else if ((ReceptionBuffer[2] == 'O') && (ReceptionBuffer[3] == 'K'))
-						{  // Remote device accepted our invitation
-							InvitationAcceptedOnData = true;
-						}
-						else if ((ReceptionBuffer[2] == 'N') && (ReceptionBuffer[3] == 'O'))
-						{  // Remote device rejected our invitation
-							InvitationRejectedOnData = true;
-						}
-						else if ((ReceptionBuffer[2] == 'B') && (ReceptionBuffer[3] == 'Y'))
-						{
-							this->PartnerCloseSession();
-						}
-					}
-				}  // Packet sent from remote partner
-			}  // Received packet size > 0
-		}  // UDP packet available on data socket
-	} while (PacketReceivedOnControl||PacketReceivedOnData);
+	TickTimerEvent = false;
+
+	if (this->ClockSource == RTP_CLOCK_SYSTEM)
+	{
+		SystemTime = GetSystemTime();
+		Elapsed = SystemTime - this->LastSystemTime;
+		this->LastSystemTime = SystemTime;
+	}
+	else
+	{
+		// Computing time using the thread is not perfect : RunSession is expected to be called every 1ms
+		Elapsed = 10;
+	}
+	if (this->TimeCounter.fetch_add(Elapsed) > 0xFFFFFFFF-Elapsed) this->TimeCounterHigh++;
+	this->LocalClock += Elapsed;
+
+	// Callbacks can change only between two ticks
+	ApplyPendingConfig();
+
+	// Do not process if communication layers are not ready
+	if (this->SocketLocked) return false;
+
+	// Check if timer elapsed (timer counts milliseconds)
+	this->TimerRemainder += Elapsed;
+	ElapsedMillis = this->TimerRemainder/10;
+	this->TimerRemainder -= ElapsedMillis*10;
+	if (this->TimerRunning)
+	{
+		if (this->EventTime > ElapsedMillis)
+			this->EventTime -= ElapsedMillis;
+		else
+			this->EventTime = 0;
+		if (EventTime == 0)
+		{
+			this->TimerRunning = false;
+			TickTimerEvent = true;
+		}
+	}
+
+	// If we are being invited but invitation process does not complete in time, return to listener state
+	if ((TickTimerEvent) && (this->SessionState == SESSION_WAIT_INVITE_DATA))
+	{
+		this->SessionState = SESSION_WAIT_INVITE_CTRL;
+	}
+	if ((TickTimerEvent) && (this->SessionState == SESSION_WAIT_CLOCK_SYNC))
+	{
+		this->SessionState = SESSION_WAIT_INVITE_CTRL;
+	}
+
+	// Invitation answers are collected while incoming packets are processed
+	InvitationAcceptedOnCtrl = false;
+	InvitationRejectedOnCtrl = false;
+	InvitationAcceptedOnData = false;
+	InvitationRejectedOnData = false;
+	return true;
+}  // CRTP_MIDI::BeginTick
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::EndTick(void)
+{
+	int RTPOutSize;
+
+	if (JitterRing!=0) releasePlayoutEvents();
+
+	// All packets of this tick have been decoded
+	if (SpanMode==RTP_SPAN_PER_TICK) flushEventSpan();
+
+	// Close requested by CloseSessionAsync from another thread
+	if (CloseRequest.load(std::memory_order_relaxed) >= 0)
+	{
+		StartClosing();
+		return;
+	}
+	if (SessionState == SESSION_CLOSING)
+	{
+		RunClosing();
+		return;
+	}
+
+	// Partner has forgotten the lost session : invite it again from control port
+	if ((FastReconnectPending) && (InvitationRejectedOnData) && (!InvitationRejectedOnCtrl))
+	{
+		InvitationRejectedOnData = false;
+		InvitationAcceptedOnData = false;
+		RestartSession();
+	}
 
 	// Terminate the session if remote device has rejected our invitation
 	if (InvitationRejectedOnCtrl || InvitationRejectedOnData)
 	{
 		this->PartnerCloseSession();
 		this->ConnectionRefused = true;
+		NotifySessionEvent(RTP_EVENT_REFUSED);
 		// Just in case we got also a session accepted...
 		InvitationAcceptedOnData = false;
 		InvitationAcceptedOnCtrl = false;
@@ -514,16 +1142,17 @@ void CRTP_MIDI::RunSession(void)
 				SessionState = SESSION_INVITE_DATA;
 				this->SendInvitation(false);
 				PrepareTimerEvent(100);
+				InviteDelay = Policy.InviteInterval;		// Partner is reachable : backoff restarts for data port
 				return;
 			}
 			else if (TimerRunning == false)
 			{
-				if (TimerEvent)
+				if (TickTimerEvent)
 				{  // Previous attempt has timed out
 					// Keep inviting until we get an answer
 					{
 						this->SendInvitation(true);
-						PrepareTimerEvent(1000);  // Wait one second before sending a new invitation
+						PrepareTimerEvent(NextInviteDelay());
 						InviteCount++;
 					}
 				}
@@ -535,20 +1164,22 @@ void CRTP_MIDI::RunSession(void)
 			if (InvitationAcceptedOnData)
 			{
 				SessionState = SESSION_CLOCK_SYNC0;
+				FastReconnectPending = false;
+				InviteDelay = Policy.InviteInterval;
 			}
 			else if (TimerRunning == false)
 			{
-				if (TimerEvent)
+				if (TickTimerEvent)
 				{  // Previous attempt has timed out
-					if (InviteCount > 12)
-					{  // No answer received from remote station after 12 attempts : stop invitation and go back to SESSION_INVITE_CONTROL
+					if (InviteCount > Policy.MaxDataInvites)
+					{  // No answer received from remote station : stop invitation and go back to SESSION_INVITE_CONTROL
 						RestartSession();
 						return;
 					}
 					else
 					{
 						this->SendInvitation(false);
-						PrepareTimerEvent(1000);  // Wait one second before sending a new invitation
+						PrepareTimerEvent(NextInviteDelay());
 						InviteCount++;
 						return;
 					}
@@ -558,28 +1189,40 @@ void CRTP_MIDI::RunSession(void)
 
 		else if (SessionState == SESSION_CLOCK_SYNC0)
 		{
-			SendSyncPacket(0, 0, TimeCounter, 0, 0, 0, 0);
+			SendSyncPacket(0, TimeCounterHigh, TimeCounter, 0, 0, 0, 0);
 			SessionState = SESSION_CLOCK_SYNC1;
 		}
 	}
 
+	// SYSEX can not be sent anymore : give the buffer back to the application
+	if ((this->SessionState != SESSION_OPENED) && (SysExOutData.load(std::memory_order_relaxed) != 0))
+		EndSysExTransfer();
+
 	// Process RTP communication and feedback when session is opened
 	if (this->SessionState == SESSION_OPENED)
 	{
-		RTPOutSize = PrepareMessage(&LRTPMessage, TimeCounter);
-		if (RTPOutSize > 0)
+		// Never wait for the transmit lock on the realtime thread : if SendNow is sending, queued data leaves with its packet
+		if (TransmitPending()) StatQueueBusyTicks.fetch_add(1, std::memory_order_relaxed);
+		if (!this->TransmitLock.test_and_set(std::memory_order_acquire))
 		{
-			this->RTPSequence++;  // Increment for next message
-			// Send message on network
-			memset(&AdrEmit, 0, sizeof(sockaddr_in));
-			AdrEmit.sin_family = AF_INET;
-			AdrEmit.sin_addr.s_addr = htonl(this->SessionPartnerIP);
-			AdrEmit.sin_port = htons(this->PartnerDataPort);
-			sendto(DataSocket, (const char*)&LRTPMessage, RTPOutSize, 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+			RTPOutSize = PrepareMessage(&TransmitPacket, TimeCounter);
+			if ((RTPOutSize == 0) && (this->GuardPending) && (GetSystemTime()-this->LastTransmitTime >= RTP_JOURNAL_GUARD_TIME))
+			{  // Nothing sent for a while after the last MIDI data : send the journal alone, so a loss of the last packet is repaired
+				RTPOutSize = PrepareMessage(&TransmitPacket, TimeCounter, true);
+				this->GuardPending = false;
+			}
+			if (RTPOutSize > 0)
+			{
+				this->RTPSequence++;  // Increment for next message
+				RTP_TRACE_STAMP(SendStart);
+				SendRTPPacket(&TransmitPacket, RTPOutSize);
+				RTP_TRACE_ADD(Trace, RTP_TRACE_SEND, SendStart);
+			}
+			this->TransmitLock.clear(std::memory_order_release);
 		}
 
 		// When session is opened, the timer keeps running
-		if (TimerEvent)
+		if (TickTimerEvent)
 		{
 			// Send a RS packet if we have received something meanwhile (do not send the RS if nothing has been received, it crashes the Apple driver)
 			if (this->LastRTPCounter != this->LastFeedbackCounter)
@@ -590,18 +1233,18 @@ void CRTP_MIDI::RunSession(void)
 
 			if (this->IsInitiatorNode == true)
 			{  // Restart a synchronization sequence if we are session initiator
-				this->SendSyncPacket(0, 0, TimeCounter, 0, 0, 0, 0);
+				this->SendSyncPacket(0, TimeCounterHigh, TimeCounter, 0, 0, 0, 0);
 			}
 
-			// We send first a sync sequence 5 times every 1.5 seconds, then one sync sequence every 10 seconds
-			if (this->SyncSequenceCounter <= 5)
+			// We send first StartupSyncCount sync sequences at a fast rate, then sync sequences at SyncInterval
+			if (this->SyncSequenceCounter < Policy.StartupSyncCount)
 			{
-				this->PrepareTimerEvent(1500);
+				this->PrepareTimerEvent(Policy.StartupSyncInterval);
 				this->SyncSequenceCounter += 1;
 			}
 			else
 			{
-				this->PrepareTimerEvent(10000);
+				this->PrepareTimerEvent(Policy.SyncInterval);
 			}
 			if (this->TimeOutRemote > 0)
 				this->TimeOutRemote -= 1;
@@ -611,79 +1254,572 @@ void CRTP_MIDI::RunSession(void)
 		if (this->TimeOutRemote == 0)
 		{
 			this->ConnectionLost = true;
-			if (this->IsInitiatorNode)
+			if ((this->IsInitiatorNode) && (Policy.FastReconnect))
+			{  // Partner may still know the session (e.g short network outage) : invite again on data port with the same token
+				this->TimeOutRemote = 4*Policy.LossThreshold;
+				this->SequenceValid = false;
+				this->FastReconnectPending = true;
+				this->InviteCount = Policy.MaxDataInvites-RTP_FAST_RECONNECT_INVITES+1;
+				this->SessionState = SESSION_INVITE_DATA;
+				this->SendInvitation(false);
+				this->PrepareTimerEvent(Policy.InviteInterval);
+			}
+			else if (this->IsInitiatorNode)
 			{  // Restart invitation sequence
-				this->TimeOutRemote = 4;
+				this->TimeOutRemote = Policy.LossThreshold;
 				this->RestartSession();
 			}
 			else
 			{  // If we are not session initiator, just wait to be invited again
 				this->SessionState = SESSION_WAIT_INVITE_CTRL;
+				// Previous partner can then go back directly to the data port invitation
+				if (Policy.FastReconnect == false) this->ConnectDataSocket(false);
 			}
+			NotifySessionEvent(RTP_EVENT_CONNECTION_LOST);
 		}
 	}  // Session is opened
-}  // CRTP_MIDI::RunSession
+}  // CRTP_MIDI::EndTick
 //---------------------------------------------------------------------------
 
-int CRTP_MIDI::GeneratePayload (unsigned char* MIDIList)
-{
-	unsigned int MIDIBlockEnd;			// Index of last MIDI byte in FIFO to transmit
-	bool FullPayload;					// RTP payload block full of data
-	int CtrBytePayload;					// Counter of RTP payload bytes
-	unsigned int TempPtr;
-
-	CtrBytePayload=0;
-	FullPayload=false;
-
-	// Check if we have data in the RTP stream queue
-    MIDIBlockEnd=RTPStreamQueue.WritePtr;			// Snapshot of current position of last MIDI message
-    if (MIDIBlockEnd!=RTPStreamQueue.ReadPtr)
-    {
-		while ((RTPStreamQueue.ReadPtr!=MIDIBlockEnd)&&(!FullPayload))
-        {
-			// TODO : make sure that there is enough room in the RTP-MIDI message buffer
-            TempPtr=RTPStreamQueue.ReadPtr;
-            MIDIList[CtrBytePayload]=RTPStreamQueue.FIFO[TempPtr];
-            CtrBytePayload+=1;
-
-            TempPtr+=1;
-            if (TempPtr>=MIDI_CHAR_FIFO_SIZE)
-				TempPtr=0;
-            RTPStreamQueue.ReadPtr=TempPtr;		// Update pointer only after checking we did not loopback
-        }
-    }
-
-	return CtrBytePayload;
+bool CRTP_MIDI::TransmitPending (void)
+{
+	return ((RTPStreamQueue.IsEmpty()==false)||(BulkQueue.IsEmpty()==false));
+}  // CRTP_MIDI::TransmitPending
+//--------------------------------------------------------------------------
+
+int CRTP_MIDI::GeneratePayload (unsigned char* MIDIList, unsigned int MaxSize)
+{
+	unsigned int Size=0;
+	unsigned int HeadSize;
+	unsigned int BulkSize;
+
+	// Take as many complete blocks as possible from the RTP stream queue, remaining blocks go in next packet
+	// Pop drops a block which can never fit (larger than MaxPayloadSize), but must not drop a block which fits in next packet
+	HeadSize=RTPStreamQueue.HeadSize();
+	if ((HeadSize<=MaxSize)||(HeadSize>MaxPayloadSize))
+		Size=RTPStreamQueue.Pop(MIDIList, MaxSize);
+
+	// Bulk blocks use the room left. Each block starts with its own delta time, so the list stays valid
+	BulkSize=BulkQueue.HeadSize();
+	if (BulkSize==0) return (int)Size;
+	if ((Size+BulkSize<=MaxSize)||(BulkSize>MaxPayloadSize))
+		Size+=BulkQueue.Pop(&MIDIList[Size], MaxSize-Size);
+	return (int)Size;
 }  // CRTP_MIDI::GeneratePayload
 //--------------------------------------------------------------------------
 
-int CRTP_MIDI::PrepareMessage (TLongMIDIRTPMsg* Buffer, unsigned int TimeStamp)
+int CRTP_MIDI::PrepareMessage (TLongMIDIRTPMsg* Buffer, unsigned int TimeStamp, bool AllowEmpty)
 {
 	unsigned int TailleMIDI;
+	unsigned int JournalSize=0;
+	unsigned int MaxJournalSize;
+	unsigned int HeadSize;
+	unsigned int ControlSize=2;
+	unsigned short Control;
+	unsigned char* RawPayload;
+	unsigned int ListTime;
+	bool FirstDelta;
+
+	if (Journal!=0)
+	{
+		if ((AllowEmpty==false)&&(TransmitPending()==false)&&(SysExFragmentDue()==false)&&(Scheduler.IsDue(TimeStamp+ScheduleLookahead)==false)) return 0;
+		// Journal must leave at least half of the payload to the MIDI list
+		MaxJournalSize=MaxPayloadSize/2;
+		if (MaxJournalSize>RTP_JOURNAL_MAX_SIZE) MaxJournalSize=RTP_JOURNAL_MAX_SIZE;
+		JournalSize=Journal->BuildJournal(&JournalBuffer[0], MaxJournalSize, RTPSequence);
+		// A large block (SYSEX) is sent without journal : next journal still covers this packet as checkpoint does not move
+		HeadSize=RTPStreamQueue.HeadSize();
+		if (HeadSize==0) HeadSize=BulkQueue.HeadSize();
+		if (HeadSize+JournalSize>MaxPayloadSize) JournalSize=0;
+	}
 
-	TailleMIDI=GeneratePayload(&Buffer->Payload.MIDIList[0]);
-	if (TailleMIDI==0) return 0;  // No MIDI data to transmit
+	// Immediate blocks first, so scheduled events never delay them
+	TailleMIDI=GeneratePayload(&Buffer->Payload.MIDIList[0], MaxPayloadSize-JournalSize);
+	TailleMIDI+=GenerateSysExFragment(&Buffer->Payload.MIDIList[TailleMIDI], MaxPayloadSize-JournalSize-TailleMIDI);
 
-	// Write directly value rather than bit coding
-	// Version=2, Padding=0, Extension=0, CSRCCount=0, Marker=1, PayloadType=0x11
-	Buffer->Header.Code1=0x80;
-	Buffer->Header.Code2=0x61;
+	// Delta times add up : scheduled events are relative to the time reached at the end of the immediate blocks
+	if (Scheduler.IsDue(TimeStamp+ScheduleLookahead))
+	{
+		ListTime=TimeStamp;
+		if (TailleMIDI>0) ListTime+=GetListDuration(&Buffer->Payload.MIDIList[0], TailleMIDI);
+		TailleMIDI+=Scheduler.Generate(&Buffer->Payload.MIDIList[TailleMIDI], MaxPayloadSize-JournalSize-TailleMIDI, ListTime, TimeStamp+ScheduleLookahead);
+	}
+	if ((TailleMIDI==0)&&((AllowEmpty==false)||(JournalSize==0))) return 0;  // No MIDI data to transmit
+
+	if (Journal!=0)
+	{
+		// Commands of this packet go in the journal of next packets
+		Journal->RecordSentList(&Buffer->Payload.MIDIList[0], TailleMIDI, RTPSequence);
+		if (TailleMIDI>0) GuardPending=true;
+	}
 
-	// Long MIDI list : B=1
-	// Deltatime before first byte : Z=1
+	FirstDelta=(TailleMIDI>0);
+	if ((CompactEncoding)&&(TailleMIDI>0))
+		TailleMIDI=CompactMIDIList(&Buffer->Payload.MIDIList[0], TailleMIDI, &FirstDelta);
+
+	if (JournalSize>0)
+		memcpy(&Buffer->Payload.MIDIList[TailleMIDI], &JournalBuffer[0], JournalSize);
+
+	if ((CompactEncoding)&&(TailleMIDI<=15))
+	{  // Short MIDI list : B=0, one byte header, MIDI list and journal are moved one byte down
+		RawPayload=(unsigned char*)&Buffer->Payload;
+		RawPayload[0]=(unsigned char)TailleMIDI;
+		if (FirstDelta) RawPayload[0]|=SHORT_Z_BIT;
+		if (JournalSize>0) RawPayload[0]|=SHORT_J_BIT;
+		memmove(&RawPayload[1], &RawPayload[2], TailleMIDI+JournalSize);
+		ControlSize=1;
+	}
+	else
+	{
+		Control=(unsigned short)TailleMIDI|LONG_B_BIT;
+		if (FirstDelta) Control|=LONG_Z_BIT;
+		if (JournalSize>0) Control|=LONG_J_BIT;
+		Buffer->Payload.Control=htons(Control);
+	}
+
+	// Long MIDI list : B=1 (B=0 with compact encoding when possible)
+	// Deltatime before first byte : Z=1 (Z=0 with compact encoding if first delta time is 0)
 	// Phantom = 0 (status byte always included)
-	Buffer->Payload.Control=htons((unsigned short)TailleMIDI|LONG_B_BIT|LONG_Z_BIT);
 
+	// Version, payload type and SSRC come from the template (see BuildPacketTemplates)
+	Buffer->Header=RTPHeaderTemplate;
 	Buffer->Header.SequenceNumber=htons(RTPSequence);
 	Buffer->Header.Timestamp=htonl(TimeStamp);
-	Buffer->Header.SSRC=htonl(SSRC);
-	return TailleMIDI+sizeof(TRTP_Header)+2;  // 2 = size of control word
+	return TailleMIDI+JournalSize+sizeof(TRTP_Header)+ControlSize;
 }  // CRTP_MIDI::PrepareMessage
 //--------------------------------------------------------------------------
 
+bool CRTP_MIDI::BeginGroupPacket (TRTPGroupHeader* Header, unsigned char* MIDIList, unsigned int Size, unsigned int* JournalSize)
+{
+	unsigned int MaxJournalSize;
+	unsigned short Control;
+
+	*JournalSize=0;
+	if (SessionState!=SESSION_OPENED) return false;
+	if ((Size==0)||(Size>MaxPayloadSize)) return false;
+
+	// Never wait for the lock on the realtime thread : data leaves with next packet of the session when SendNow is sending
+	if (this->TransmitLock.test_and_set(std::memory_order_acquire))
+	{
+		if (RTPStreamQueue.Push(Size, MIDIList)==false)
+			StatGroupDropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	if (Journal!=0)
+	{
+		MaxJournalSize=MaxPayloadSize/2;
+		if (MaxJournalSize>RTP_JOURNAL_MAX_SIZE) MaxJournalSize=RTP_JOURNAL_MAX_SIZE;
+		if (Size+MaxJournalSize>MaxPayloadSize) MaxJournalSize=MaxPayloadSize-Size;
+		*JournalSize=Journal->BuildJournal(&JournalBuffer[0], MaxJournalSize, RTPSequence);
+		Journal->RecordSentList(MIDIList, Size, RTPSequence);
+		GuardPending=true;
+	}
+
+	Control=(unsigned short)Size|LONG_B_BIT|LONG_Z_BIT;
+	if (*JournalSize>0) Control|=LONG_J_BIT;
+
+	Header->Header=RTPHeaderTemplate;
+	Header->Header.SequenceNumber=htons(RTPSequence);
+	Header->Header.Timestamp=htonl(TimeCounter);
+	Header->Control=htons(Control);
+
+	this->RTPSequence++;
+	this->LastTransmitTime = GetSystemTime();
+	StatPacketsSent.fetch_add(1, std::memory_order_relaxed);
+	StatBytesSent.fetch_add(sizeof(TRTPGroupHeader)+Size+*JournalSize, std::memory_order_relaxed);
+	return true;
+}  // CRTP_MIDI::BeginGroupPacket
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::EndGroupPacket (void)
+{
+	this->TransmitLock.clear(std::memory_order_release);
+}  // CRTP_MIDI::EndGroupPacket
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::CompactMIDIList (unsigned char* MIDIList, unsigned int Size, bool* FirstDelta)
+{
+	unsigned char* Compact=&CompactBuffer[0];
+	unsigned int In=0;
+	unsigned int Out=0;
+	unsigned int DeltaStart;
+	unsigned int DataBytes;
+	unsigned int Command=0;
+	unsigned char Status;
+	unsigned char SourceStatus=0;		// Running status of the original list
+	unsigned char RunningStatus=0;		// Running status of the compact list
+	bool DeltaRemoved=false;			// First delta time has been removed (FirstDelta is changed only if the compact list is used)
+
+	if (Size>MAX_RTP_LOAD) return Size;
+
+	while (In<Size)
+	{
+		// Delta time (1 to 4 bytes). RFC 6295 allows to omit only the first one
+		DeltaStart=In;
+		while ((In<Size)&&((MIDIList[In]&0x80)!=0)&&(In-DeltaStart<3)) In++;
+		In++;
+		if (In>=Size)
+		{  // Delta time without command at end of list : keep it (allowed by RFC 6295)
+			memcpy(&Compact[Out], &MIDIList[DeltaStart], Size-DeltaStart);
+			Out+=Size-DeltaStart;
+			break;
+		}
+		if ((Command>0)||(In-DeltaStart>1)||(MIDIList[DeltaStart]!=0))
+		{
+			memcpy(&Compact[Out], &MIDIList[DeltaStart], In-DeltaStart);
+			Out+=In-DeltaStart;
+		}
+		else DeltaRemoved=true;
+		Command++;
+
+		Status=MIDIList[In];
+		if (Status>=0xF8)
+		{  // Realtime : does not change running status
+			Compact[Out++]=Status;
+			In++;
+			continue;
+		}
+		if ((Status==0xF0)||(Status==0xF7))
+		{  // SYSEX segment : copied up to its end marker, cancels running status
+			Compact[Out++]=MIDIList[In++];
+			while ((In<Size)&&(MIDIList[In]!=0xF0)&&(MIDIList[In]!=0xF7)&&(MIDIList[In]!=0xF4))
+				Compact[Out++]=MIDIList[In++];
+			if (In<Size) Compact[Out++]=MIDIList[In++];
+			SourceStatus=0;
+			RunningStatus=0;
+			continue;
+		}
+
+		if (Status&0x80)
+		{
+			In++;
+			SourceStatus=(Status<0xF0)?Status:0;
+		}
+		else
+		{
+			Status=SourceStatus;
+			if (Status==0) return Size;		// Data byte without status : list is left as it is
+		}
+
+		if ((Status==0xF2)||(Status<0xC0)||((Status>=0xE0)&&(Status<0xF0))) DataBytes=2;
+		else if ((Status==0xF1)||(Status==0xF3)||(Status<0xE0)) DataBytes=1;
+		else DataBytes=0;
+		if (In+DataBytes>Size) return Size;
+
+		// Channel messages : status byte is omitted when it is the running status
+		if (Status<0xF0)
+		{
+			if (Status!=RunningStatus) Compact[Out++]=Status;
+			RunningStatus=Status;
+		}
+		else
+		{  // System common message cancels running status
+			Compact[Out++]=Status;
+			RunningStatus=0;
+		}
+		memcpy(&Compact[Out], &MIDIList[In], DataBytes);
+		Out+=DataBytes;
+		In+=DataBytes;
+	}
+
+	memcpy(MIDIList, &Compact[0], Out);
+	if (DeltaRemoved) *FirstDelta=false;
+	return Out;
+}  // CRTP_MIDI::CompactMIDIList
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::GetListDuration (unsigned char* MIDIList, unsigned int Size)
+{
+	unsigned int In=0;
+	unsigned int Duration=0;
+	unsigned int Delta;
+	unsigned int DeltaBytes;
+	unsigned int DataBytes;
+	unsigned char Status;
+	unsigned char RunningStatus=0;
+
+	while (In<Size)
+	{
+		// Delta time (1 to 4 bytes, MSB first)
+		Delta=0;
+		DeltaBytes=0;
+		do
+		{
+			Delta=(Delta<<7)|(MIDIList[In]&0x7F);
+			DeltaBytes++;
+		} while ((MIDIList[In++]&0x80)&&(In<Size)&&(DeltaBytes<4));
+		Duration+=Delta;
+		if (In>=Size) break;
+
+		Status=MIDIList[In];
+		if (Status>=0xF8)
+		{  // Realtime : does not change running status
+			In++;
+			continue;
+		}
+		if ((Status==0xF0)||(Status==0xF7))
+		{  // SYSEX segment, up to its end marker
+			In++;
+			while ((In<Size)&&(MIDIList[In]!=0xF0)&&(MIDIList[In]!=0xF7)&&(MIDIList[In]!=0xF4)) In++;
+			In++;
+			RunningStatus=0;
+			continue;
+		}
+
+		if (Status&0x80)
+		{
+			In++;
+			RunningStatus=(Status<0xF0)?Status:0;
+		}
+		else
+		{
+			Status=RunningStatus;
+			if (Status==0) break;		// Data byte without status : remaining delta times are unknown
+		}
+
+		if ((Status==0xF2)||(Status<0xC0)||((Status>=0xE0)&&(Status<0xF0))) DataBytes=2;
+		else if ((Status==0xF1)||(Status==0xF3)||(Status<0xE0)) DataBytes=1;
+		else DataBytes=0;
+		In+=DataBytes;
+	}
+	return Duration;
+}  // CRTP_MIDI::GetListDuration
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SendRTPPacket (TLongMIDIRTPMsg* Buffer, int Size)
+{
+	SendToPartnerData(Buffer, Size);
+	this->LastTransmitTime = GetSystemTime();
+	StatPacketsSent.fetch_add(1, std::memory_order_relaxed);
+	StatBytesSent.fetch_add(Size, std::memory_order_relaxed);
+}  // CRTP_MIDI::SendRTPPacket
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::SendNow (unsigned int BlockSize, unsigned char* MIDIData)
+{
+	int RTPOutSize;
+
+	if (BlockSize == 0) return true;
+	if (SessionState!=SESSION_OPENED) return false;
+	if (BlockSize > MaxPayloadSize) return false;
+
+	// Block goes behind the blocks already queued, so order of MIDI events is kept
+	if (RTPStreamQueue.Push(BlockSize, MIDIData)==false) return false;
+
+	// Realtime thread holds the lock only while it builds and sends one packet
+	while (this->TransmitLock.test_and_set(std::memory_order_acquire))
+		std::this_thread::yield();
+
+	// Within the coalescing window, data is left in the queue for next tick (or next SendNow after the window)
+	if ((this->CoalescingWindow == 0) || (GetSystemTime()-this->LastTransmitTime >= this->CoalescingWindow))
+	{
+		do
+		{
+			RTPOutSize = PrepareMessage(&TransmitPacket, TimeCounter);
+			if (RTPOutSize > 0)
+			{
+				this->RTPSequence++;
+				SendRTPPacket(&TransmitPacket, RTPOutSize);
+			}
+		} while (RTPOutSize > 0);
+	}
+
+	this->TransmitLock.clear(std::memory_order_release);
+	return true;
+}  // CRTP_MIDI::SendNow
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetCoalescingWindow (unsigned int Window)
+{
+	this->CoalescingWindow = Window;
+}  // CRTP_MIDI::SetCoalescingWindow
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::SendSysEx (const unsigned char* Data, unsigned int Size)
+{
+	bool Busy = false;
+
+	if (SessionState!=SESSION_OPENED) return false;
+	if ((Size < 2) || (Data[0] != 0xF0) || (Data[Size-1] != 0xF7)) return false;
+
+	// Only one SYSEX at a time (several threads may call SendSysEx)
+	if (!SysExOutBusy.compare_exchange_strong(Busy, true, std::memory_order_acquire)) return false;
+
+	SysExOutSize = Size;
+	SysExOutPos = 1;		// F0 is replaced by the segment markers
+	SysExOutData.store(Data, std::memory_order_release);
+
+	if (WakeLoop!=0) WakeLoop->Wake();
+	LocalTransport.WakeSelf();
+	return true;
+}  // CRTP_MIDI::SendSysEx
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::IsSysExSending (void)
+{
+	return SysExOutBusy.load(std::memory_order_acquire);
+}  // CRTP_MIDI::IsSysExSending
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::SendScheduled (unsigned int Time, unsigned int Size, unsigned char* MIDIData)
+{
+	if (SessionState!=SESSION_OPENED) return false;
+	if (Scheduler.Push(Time, Size, MIDIData)==false) return false;
+
+	if (WakeLoop!=0) WakeLoop->Wake();
+	LocalTransport.WakeSelf();
+	return true;
+}  // CRTP_MIDI::SendScheduled
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::GetSessionTime (void)
+{
+	return TimeCounter;
+}  // CRTP_MIDI::GetSessionTime
+//--------------------------------------------------------------------------
+
+unsigned long long CRTP_MIDI::GetTime64 (void)
+{
+	return ((unsigned long long)TimeCounterHigh << 32) | TimeCounter;
+}  // CRTP_MIDI::GetTime64
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::GetClockInfo (TRTPMIDIClockInfo* Info)
+{
+	ClockSync.GetInfo(Info);
+	return Info->Valid;
+}  // CRTP_MIDI::GetClockInfo
+//--------------------------------------------------------------------------
+
+CRTPMIDITrace* CRTP_MIDI::GetTrace (void)
+{
+#ifdef RTP_MIDI_TRACE
+	return this->Trace;
+#else
+	return 0;
+#endif
+}  // CRTP_MIDI::GetTrace
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::RemoteToLocalTime (unsigned int RemoteTime)
+{
+	if (ClockSync.IsValid()==false) return RemoteTime;
+	// Wrap around of 32 bits times is handled by modulo arithmetic
+	return RemoteTime-(unsigned int)ClockSync.GetOffset(TimeCounter);
+}  // CRTP_MIDI::RemoteToLocalTime
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSyncedEventTime (bool Enable)
+{
+	this->SyncedEventTime = Enable;
+}  // CRTP_MIDI::SetSyncedEventTime
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetScheduleLookahead (unsigned int Lookahead)
+{
+	this->ScheduleLookahead = Lookahead;
+}  // CRTP_MIDI::SetScheduleLookahead
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetCompactEncoding (bool Enable)
+{
+	this->CompactEncoding = Enable;
+}  // CRTP_MIDI::SetCompactEncoding
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetInputFilter (const unsigned short* Mask)
+{
+	unsigned long long Words[2]={0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL};
+	int Class;
+
+	if (Mask!=0)
+	{
+		Words[0]=0;
+		Words[1]=0;
+		for (Class=0; Class<RTP_FILTER_WORDS; Class++)
+			Words[Class>>2]|=(unsigned long long)Mask[Class]<<((Class&3)<<4);
+	}
+	InputFilter[0].store(Words[0], std::memory_order_relaxed);
+	InputFilter[1].store(Words[1], std::memory_order_relaxed);
+}  // CRTP_MIDI::SetInputFilter
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetInputFilterStatus (unsigned char Status, bool Accept)
+{
+	unsigned int Class;
+	unsigned long long Bit;
+
+	if (Status<0x80) return;
+	Class=(Status>>4)&7;
+	Bit=1ULL<<(((Class&3)<<4)+(Status&0x0F));
+	if (Accept) InputFilter[Class>>2].fetch_or(Bit, std::memory_order_relaxed);
+	else InputFilter[Class>>2].fetch_and(~Bit, std::memory_order_relaxed);
+}  // CRTP_MIDI::SetInputFilterStatus
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSysExPacing (unsigned int Interval)
+{
+	this->SysExPacing = Interval;
+}  // CRTP_MIDI::SetSysExPacing
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::SysExFragmentDue (void)
+{
+	if (SysExOutData.load(std::memory_order_acquire) == 0) return false;
+	if (this->SysExPacing == 0) return true;
+	return (GetSystemTime()-this->LastSysExFragmentTime >= this->SysExPacing);
+}  // CRTP_MIDI::SysExFragmentDue
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::GenerateSysExFragment (unsigned char* MIDIList, unsigned int MaxSize)
+{
+	const unsigned char* Data;
+	unsigned int Remaining;
+	unsigned int Length;
+	unsigned int Pos = 0;
+
+	if (SysExFragmentDue() == false) return 0;
+	if (MaxSize < 4) return 0;		// Delta time, two segment markers and at least one byte
+	Data = SysExOutData.load(std::memory_order_relaxed);
+
+	// Data bytes not sent yet (final F7 is written as end marker)
+	Remaining = SysExOutSize-1-SysExOutPos;
+	Length = MaxSize-3;
+	if (Length > SYSEX_FRAGMENT_SIZE) Length = SYSEX_FRAGMENT_SIZE;
+	if (Length > Remaining) Length = Remaining;
+
+	// RFC 6295 segments : F0 ... F0 (first), F7 ... F0 (middle), F7 ... F7 (last), F0 ... F7 (not segmented)
+	MIDIList[Pos++] = 0;		// Delta time
+	MIDIList[Pos++] = (SysExOutPos == 1) ? 0xF0 : 0xF7;
+	memcpy(&MIDIList[Pos], &Data[SysExOutPos], Length);
+	Pos += Length;
+	SysExOutPos += Length;
+	this->LastSysExFragmentTime = GetSystemTime();
+
+	if (SysExOutPos >= SysExOutSize-1)
+	{
+		MIDIList[Pos++] = 0xF7;
+		EndSysExTransfer();
+	}
+	else
+	{
+		MIDIList[Pos++] = 0xF0;
+	}
+	return Pos;
+}  // CRTP_MIDI::GenerateSysExFragment
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::EndSysExTransfer (void)
+{
+	SysExOutData.store(0, std::memory_order_relaxed);
+	SysExOutBusy.store(false, std::memory_order_release);
+}  // CRTP_MIDI::EndSysExTransfer
+//--------------------------------------------------------------------------
+
 int CRTP_MIDI::getSessionStatus (void)
 {
-	if (SessionState==SESSION_CLOSED) return 0;
+	if ((SessionState==SESSION_CLOSED)||(SessionState==SESSION_CLOSING)) return 0;
 	if (SessionState==SESSION_OPENED) return 3;
 	if ((SessionState==SESSION_INVITE_DATA)||(SessionState==SESSION_INVITE_CONTROL)) return 1;
 	return 2;
@@ -697,36 +1833,112 @@ void CRTP_MIDI::setSessionName (char* Name)
 }  // CRTPMIDI::setSessionName
 //--------------------------------------------------------------------------
 
-bool CRTP_MIDI::SendRTPMIDIBlock (unsigned int BlockSize, unsigned char* MIDIData)
+bool CRTP_MIDI::SendRTPMIDIBlock (unsigned int BlockSize, unsigned char* MIDIData, int Lane)
 {
-	// TODO : add a semaphore in case this function is called from another thread
-	unsigned int TmpWrite;
-	unsigned int ByteCounter;
-
 	if (BlockSize == 0) return true;
 	if (SessionState!=SESSION_OPENED) return false;		// Avoid filling the FIFO when nothing can be sent
+	if (BlockSize > MaxPayloadSize) return false;		// Block would never fit in a RTP payload
 
-	// Try to copy the whole block in FIFO
-	TmpWrite = RTPStreamQueue.WritePtr;
-
-	for (ByteCounter=0; ByteCounter<BlockSize; ByteCounter++)
+	// The block is copied completely or not at all
+	if (Lane == RTP_LANE_BULK)
 	{
-		RTPStreamQueue.FIFO[TmpWrite] = MIDIData[ByteCounter];
-		TmpWrite++;
-		if (TmpWrite>=MIDI_CHAR_FIFO_SIZE)
-			TmpWrite = 0;
-
-		// Check if FIFO is not full
-		if (TmpWrite == RTPStreamQueue.ReadPtr) return false;
+		if (BulkQueue.Push(BlockSize, MIDIData)==false) return false;
+	}
+	else
+	{
+		if (RTPStreamQueue.Push(BlockSize, MIDIData)==false) return false;
 	}
 
-	// Update write pointer only when the whole block has been copied
-	RTPStreamQueue.WritePtr = TmpWrite;
-
+	// Event driven mode : send the block now rather than when the loop wakes up for next session event
+	if (WakeLoop!=0) WakeLoop->Wake();
+	LocalTransport.WakeSelf();
 	return true;
 }  // CRTP_MIDI::SendRTPMIDIBlock
 //--------------------------------------------------------------------------
 
+void CRTP_MIDI::SetMaxPayloadSize (unsigned int MaxSize)
+{
+	if (MaxSize > MAX_RTP_LOAD) MaxSize = MAX_RTP_LOAD;
+	if (MaxSize == 0) MaxSize = 1;
+	MaxPayloadSize = MaxSize;
+}  // CRTP_MIDI::SetMaxPayloadSize
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetPathMTU (unsigned int MTU)
+{
+	if (MTU <= RTP_MIDI_PACKET_OVERHEAD) return;
+	SetMaxPayloadSize(MTU-RTP_MIDI_PACKET_OVERHEAD);
+}  // CRTP_MIDI::SetPathMTU
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::EnableJournal (bool Enable)
+{
+	if (SessionState!=SESSION_CLOSED) return;
+
+	if (Enable)
+	{
+		if (Journal==0) Journal=new CRTPMIDIJournal();
+	}
+	else
+	{
+		if (Journal!=0) delete Journal;
+		Journal=0;
+	}
+}  // CRTP_MIDI::EnableJournal
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::EnableJitterBuffer (unsigned int Size, unsigned int MinDelay, unsigned int MaxDelay)
+{
+	if (SessionState!=SESSION_CLOSED) return;
+
+	if (JitterRing!=0) delete JitterRing;
+	JitterRing=0;
+	if (MaxDelay<MinDelay) MaxDelay=MinDelay;
+	JitterMinDelay=MinDelay;
+	JitterMaxDelay=MaxDelay;
+	JitterDelay.store(MinDelay, std::memory_order_relaxed);
+	if (Size>0) JitterRing=new CRTPMIDIEventRing(Size);
+}  // CRTP_MIDI::EnableJitterBuffer
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::GetJitterBufferDelay (void)
+{
+	return JitterDelay.load(std::memory_order_relaxed);
+}  // CRTP_MIDI::GetJitterBufferDelay
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::GetStatistics (TRTPMIDIStatistics* Stats)
+{
+	Stats->PacketsReceived=StatPacketsReceived.load(std::memory_order_relaxed);
+	Stats->PacketsLost=StatPacketsLost.load(std::memory_order_relaxed);
+	Stats->PacketsReordered=StatPacketsReordered.load(std::memory_order_relaxed);
+	Stats->PacketsDuplicated=StatPacketsDuplicated.load(std::memory_order_relaxed);
+	Stats->PacketsSent=StatPacketsSent.load(std::memory_order_relaxed);
+	Stats->BytesReceived=StatBytesReceived.load(std::memory_order_relaxed);
+	Stats->BytesSent=StatBytesSent.load(std::memory_order_relaxed);
+	Stats->QueueBusyTicks=StatQueueBusyTicks.load(std::memory_order_relaxed);
+	Stats->Jitter=StatJitter.load(std::memory_order_relaxed)>>4;
+	Stats->ScheduledDropped=Scheduler.GetDroppedCount();
+	Stats->GroupDropped=StatGroupDropped.load(std::memory_order_relaxed);
+}  // CRTP_MIDI::GetStatistics
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::ResetStatistics (void)
+{
+	StatPacketsReceived.store(0, std::memory_order_relaxed);
+	StatPacketsLost.store(0, std::memory_order_relaxed);
+	StatPacketsReordered.store(0, std::memory_order_relaxed);
+	StatPacketsDuplicated.store(0, std::memory_order_relaxed);
+	StatPacketsSent.store(0, std::memory_order_relaxed);
+	StatBytesReceived.store(0, std::memory_order_relaxed);
+	StatBytesSent.store(0, std::memory_order_relaxed);
+	StatQueueBusyTicks.store(0, std::memory_order_relaxed);
+	StatGroupDropped.store(0, std::memory_order_relaxed);
+	StatJitter.store(0, std::memory_order_relaxed);
+	Scheduler.ResetDroppedCount();
+}  // CRTP_MIDI::ResetStatistics
+//--------------------------------------------------------------------------
+
 unsigned int CRTP_MIDI::GetLatency (void)
 {
 	if (SessionState != SESSION_OPENED) return 0xFFFFFFFF;
@@ -742,13 +1954,79 @@ void CRTP_MIDI::RestartSession (void)
 	SYSEX_RTPActif=false;
 	SegmentSYSEXInput=false;
 	InviteCount=0;
-	TimeOutRemote=16;		// 120 seconds -> Five sync sequences every 1.5 seconds then sync sequence every 10 seconds = 11 + 5
+	FastReconnectPending=false;
+	SequenceValid=false;
+	TimeOutRemote=4*Policy.LossThreshold;		// Grace period at startup (default : 120 seconds)
 	IncomingThirdByte=false;
+	SyncSequenceCounter=0;
 	SessionState=SESSION_INVITE_CONTROL;
-    PrepareTimerEvent(1000);
+	// Partner address has been cleared if partner has closed the session
+	SetPartner(&RemoteAddressToInvite);
+	UpdatePartnerAddresses();
+	ConnectDataSocket(true);
+    PrepareTimerEvent(NextInviteDelay());
 }  // CRTP_MIDI::RestartSession
 //--------------------------------------------------------------------------
 
+unsigned int CRTP_MIDI::NextInviteDelay (void)
+{
+	unsigned int Delay=InviteDelay;
+
+	if (Policy.InviteJitter>0) Delay+=rand()%(Policy.InviteJitter+1);
+	// Exponential backoff for the next attempt
+	if (InviteDelay<Policy.InviteMaxInterval)
+	{
+		InviteDelay*=2;
+		if (InviteDelay>Policy.InviteMaxInterval) InviteDelay=Policy.InviteMaxInterval;
+	}
+	return Delay;
+}  // CRTP_MIDI::NextInviteDelay
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::NotifySessionEvent (int Event)
+{
+	if (SessionEventCallback!=0) SessionEventCallback(SessionEventInstance, Event);
+}  // CRTP_MIDI::NotifySessionEvent
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSessionEventCallback (TRTPMIDISessionEventCallback CallbackFunc, void* UserInstance)
+{
+	SessionEventInstance=UserInstance;
+	SessionEventCallback=CallbackFunc;
+}  // CRTP_MIDI::SetSessionEventCallback
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::GetDefaultSessionPolicy (TRTPMIDISessionPolicy* Policy)
+{
+	Policy->StartupSyncInterval=1500;
+	Policy->StartupSyncCount=6;
+	Policy->SyncInterval=10000;
+	Policy->LossThreshold=4;
+	Policy->InviteInterval=1000;
+	Policy->InviteMaxInterval=1000;
+	Policy->InviteJitter=0;
+	Policy->MaxDataInvites=12;
+	Policy->FastReconnect=false;
+}  // CRTP_MIDI::GetDefaultSessionPolicy
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSessionPolicy (const TRTPMIDISessionPolicy* NewPolicy)
+{
+	if (NewPolicy==0) return;
+	if (SessionState!=SESSION_CLOSED) return;
+
+	Policy=*NewPolicy;
+	// Timer values of 0 would stop the session timer
+	if (Policy.StartupSyncInterval==0) Policy.StartupSyncInterval=1;
+	if (Policy.SyncInterval==0) Policy.SyncInterval=1;
+	if (Policy.LossThreshold==0) Policy.LossThreshold=1;
+	if (Policy.InviteInterval==0) Policy.InviteInterval=1;
+	if (Policy.InviteMaxInterval<Policy.InviteInterval) Policy.InviteMaxInterval=Policy.InviteInterval;
+	if (Policy.MaxDataInvites<RTP_FAST_RECONNECT_INVITES) Policy.MaxDataInvites=RTP_FAST_RECONNECT_INVITES;
+	InviteDelay=Policy.InviteInterval;
+}  // CRTP_MIDI::SetSessionPolicy
+//--------------------------------------------------------------------------
+
 bool CRTP_MIDI::ReadAndResetConnectionLost (void)
 {
 	if (this->ConnectionLost==false) return false;
@@ -782,14 +2060,132 @@ bool CRTP_MIDI::RemotePeerHasRefusedSession(void)
 
 void CRTP_MIDI::SetCallback(TRTPMIDIDataCallback CallbackFunc, void* UserInstance)
 {
-	bool SocketState = this->SocketLocked;
+	LockConfig();
+	this->PendingClientInstance = UserInstance;
+	this->PendingRTPCallback = CallbackFunc;
+	PostConfig(RTP_CONFIG_CALLBACK);
+}  // CRTP_MIDI::SetCallback
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSpanCallback(TRTPMIDISpanCallback CallbackFunc, void* UserInstance, int Mode)
+{
+	LockConfig();
+	this->PendingSpanInstance = UserInstance;
+	this->PendingSpanMode = Mode;
+	this->PendingSpanCallback = CallbackFunc;
+	PostConfig(RTP_CONFIG_SPAN);
+}  // CRTP_MIDI::SetSpanCallback
+//--------------------------------------------------------------------------
 
-	this->SocketLocked = false;		// Block processing to avoid callbacks while we configure them
+void CRTP_MIDI::SetEventRing (CRTPMIDIEventRing* Ring)
+{
+	LockConfig();
+	this->PendingEventRing = Ring;
+	PostConfig(RTP_CONFIG_RING);
+}  // CRTP_MIDI::SetEventRing
+//--------------------------------------------------------------------------
 
-	this->ClientInstance = UserInstance;
-	this->RTPCallback = CallbackFunc;
+void CRTP_MIDI::SetSysExCallback (TRTPMIDISysExCallback CallbackFunc, void* UserInstance)
+{
+	if (InSYSEXBufferSize==0) return;		// Chunks need a buffer
 
-	// Restore lock state
-	this->SocketLocked = SocketState;
-}  // CRTP_MIDI::SetCallback
+	LockConfig();
+	this->PendingSysExInstance = UserInstance;
+	this->PendingSysExCallback = CallbackFunc;
+	PostConfig(RTP_CONFIG_SYSEX);
+}  // CRTP_MIDI::SetSysExCallback
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::LockConfig (void)
+{
+	while (this->ConfigLock.test_and_set(std::memory_order_acquire))
+		std::this_thread::yield();
+}  // CRTP_MIDI::LockConfig
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::PostConfig (unsigned int Changes)
+{
+	this->ConfigPending.fetch_or(Changes, std::memory_order_relaxed);
+	this->ConfigLock.clear(std::memory_order_release);
+}  // CRTP_MIDI::PostConfig
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::ApplyPendingConfig (void)
+{
+	unsigned int Changes;
+
+	if (this->ConfigPending.load(std::memory_order_relaxed)==0) return;
+	if (this->ConfigLock.test_and_set(std::memory_order_acquire)) return;
+
+	Changes=this->ConfigPending.exchange(0, std::memory_order_relaxed);
+
+	// Events already decoded are delivered with the previous configuration
+	if (Changes&(RTP_CONFIG_CALLBACK|RTP_CONFIG_SPAN|RTP_CONFIG_RING)) flushEventSpan();
+
+	if (Changes&RTP_CONFIG_CALLBACK)
+	{
+		this->ClientInstance=this->PendingClientInstance;
+		this->RTPCallback=this->PendingRTPCallback;
+	}
+	if (Changes&RTP_CONFIG_SPAN)
+	{
+		this->SpanInstance=this->PendingSpanInstance;
+		this->SpanMode=this->PendingSpanMode;
+		this->SpanCallback=this->PendingSpanCallback;
+	}
+	if (Changes&RTP_CONFIG_RING) this->EventRing=this->PendingEventRing;
+	if (Changes&RTP_CONFIG_SYSEX)
+	{
+		initRTP_SYSEXBuffer();			// SYSEX in progress is lost
+		this->SysExInstance=this->PendingSysExInstance;
+		this->SysExCallback=this->PendingSysExCallback;
+	}
+
+	this->ConfigLock.clear(std::memory_order_release);
+}  // CRTP_MIDI::ApplyPendingConfig
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::EnableSysExPool (unsigned int MaxSize)
+{
+	TSysExPoolBuffer* Buffer;
+
+	this->SysExPoolMaxSize = MaxSize;
+	if (MaxSize == 0)
+	{  // Free the buffers which have not been used
+		Buffer = SysExSpare.exchange(0);
+		if (Buffer != 0)
+		{
+			delete[] Buffer->Data;
+			delete Buffer;
+		}
+	}
+	ServiceSysExPool();
+}  // CRTP_MIDI::EnableSysExPool
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::ServiceSysExPool (void)
+{
+	TSysExPoolBuffer* Buffer;
+	unsigned int NewSize;
+
+	// Free the buffer replaced by the realtime thread
+	Buffer = SysExRetired.exchange(0, std::memory_order_acquire);
+	if (Buffer != 0)
+	{
+		delete[] Buffer->Data;
+		delete Buffer;
+	}
+
+	// Prepare next buffer, twice larger than current one
+	if ((this->SysExPoolMaxSize == 0) || (SysExSpare.load(std::memory_order_acquire) != 0)) return;
+	NewSize = SysExPoolCurrentSize.load(std::memory_order_relaxed)*2;
+	if (NewSize < 256) NewSize = 256;
+	if (NewSize > this->SysExPoolMaxSize) NewSize = this->SysExPoolMaxSize;
+	if (NewSize <= SysExPoolCurrentSize.load(std::memory_order_relaxed)) return;
+
+	Buffer = new TSysExPoolBuffer;
+	Buffer->Data = new unsigned char[NewSize];
+	Buffer->Size = NewSize;
+	SysExSpare.store(Buffer, std::memory_order_release);
+}  // CRTP_MIDI::ServiceSysExPool
 //--------------------------------------------------------------------------
@@ -32,6 +32,17 @@
 //---------------------------------------------------------------------------
 
 #include "network.h"
+#if defined (__TARGET_WIN__)
+#include <ws2tcpip.h>
+#endif
+#include "RTP_MIDI_BlockQueue.h"
+#include "RTP_MIDI_Journal.h"
+#include "RTP_MIDI_EventRing.h"
+#include "RTP_MIDI_Scheduler.h"
+#include "RTP_MIDI_ClockSync.h"
+#include "RTP_MIDI_Trace.h"
+#include "RTP_MIDI_LocalTransport.h"
+#include "RTP_MIDI_Capture.h"
 
 #define LONG_B_BIT 0x8000
 #define LONG_J_BIT 0x4000
@@ -42,17 +53,45 @@
 #define SHORT_Z_BIT 0x20
 #define SHORT_P_BIT 0x10
 
+// Sizes below can be changed for a given deployment by defining them on the compiler command line
+// (all files of the library must be compiled with the same values)
+
+#ifndef MAX_SESSION_NAME_LEN
 #define MAX_SESSION_NAME_LEN	64
+#endif
 
 // Max size for one RTP payload
+#ifndef MAX_RTP_LOAD
 #define MAX_RTP_LOAD 1024
-// Max size for a single fragmented SYSEX
+#endif
+// Size of IPv4 + UDP + RTP headers and RTP-MIDI long control word (subtracted from path MTU to get max payload)
+#define RTP_MIDI_PACKET_OVERHEAD	(20+8+12+2)
+
+// Number of packets of a transit time window of the playout buffer
+#define RTP_PLAYOUT_WINDOW			256
+
+// Max size for a single fragmented SYSEX (must not be larger than MAX_RTP_LOAD)
+#ifndef SYSEX_FRAGMENT_SIZE
 #define SYSEX_FRAGMENT_SIZE		512
+#endif
+
+// Number of datagrams which can be read from one socket in a single batch
+#ifndef RTP_RECEIVE_SLOTS
+#define RTP_RECEIVE_SLOTS		16
+#endif
+// Size of one reception slot (maximum size of a received datagram)
+#ifndef RTP_RECEIVE_SLOT_SIZE
+#define RTP_RECEIVE_SLOT_SIZE	1024
+#endif
 
 #define DEFAULT_RTP_ADDRESS 0xC0A800FD
 #define DEFAULT_RTP_DATA_PORT 5004
 #define DEFAULT_RTP_CTRL_PORT 5003
 
+// Clock sources for TimeCounter and LocalClock
+#define RTP_CLOCK_TICK			0	// Clocks advance by 1ms on each RunSession call (RunSession must be called every millisecond)
+#define RTP_CLOCK_SYSTEM		1	// Clocks follow the OS monotonic clock, whatever the RunSession call rate is
+
 // Session status
 #define SESSION_CLOSED			0	// No action
 #define SESSION_CLOSE			1	// Session should close in emergency
@@ -67,6 +106,10 @@
 #define SESSION_WAIT_INVITE_DATA		11	// Wait to be invited by remote station on data port
 #define SESSION_WAIT_CLOCK_SYNC			12  // Wait to receive CK2 message to confirm session is fully opened by remote initiator
 
+#define SESSION_CLOSING			13	// BY has been sent by CloseSessionAsync, session is closed after the last repetition
+
+#define RTP_BY_REPEAT_INTERVAL	20	// Time between BY repetitions of CloseSessionAsync (ms)
+
 #pragma pack (push, 1)
 typedef struct {
   unsigned char Reserved1;       // 0xFF
@@ -76,7 +119,7 @@ typedef struct {
   unsigned int ProtocolVersion;
   unsigned int InitiatorToken;
   unsigned int SSRC;
-  unsigned char Name [1024];
+  unsigned char Name [MAX_SESSION_NAME_LEN];
 } TSessionPacket;
 
 typedef struct {
@@ -153,15 +196,44 @@ typedef struct {
   TRTP_Header Header;
   TShortMIDIPayload Payload;
 } TShortMIDIRTPMsg;
+
+// Start of a long MIDI list packet, sent in front of a MIDI list shared by several sessions
+typedef struct {
+  TRTP_Header Header;
+  unsigned short Control;
+} TRTPGroupHeader;
 #pragma pack (pop)
 
-#define MIDI_CHAR_FIFO_SIZE		2048
+// Socket address of IPv4 or IPv6 sockets (dual-stack sockets use IPv4-mapped IPv6 addresses for IPv4 devices)
+typedef union {
+	sockaddr Generic;
+	sockaddr_in V4;
+	sockaddr_in6 V6;
+} TRTPMIDIAddress;
 
 typedef struct {
-	unsigned char FIFO[MIDI_CHAR_FIFO_SIZE];
-	unsigned int ReadPtr;
-	unsigned int WritePtr;
-} TMIDI_FIFO_CHAR;
+	unsigned char Data[RTP_RECEIVE_SLOT_SIZE];
+	int Size;						// Size of received datagram (0 or negative if reception failed)
+	unsigned int SenderIP;			// IPv4 address, or key of the IPv6 address (see CRTP_MIDI::GetAddressKey)
+	unsigned short SenderPort;
+	bool SenderIPv6;				// Sender has an IPv6 address (not an IPv4-mapped one) : SenderIP is a key
+	TRTPMIDIAddress SenderAddress;
+} TRTPReceiveSlot;
+
+// Session statistics (counters are reset when session starts)
+typedef struct {
+	unsigned int PacketsReceived;	// RTP-MIDI packets received from session partner
+	unsigned int PacketsLost;		// Packets never received (gaps in sequence numbers, corrected when a late packet arrives)
+	unsigned int PacketsReordered;	// Packets received after a packet with a higher sequence number
+	unsigned int PacketsDuplicated;	// Packets received twice (discarded)
+	unsigned int PacketsSent;		// RTP-MIDI packets sent to session partner
+	unsigned int BytesReceived;		// Size of RTP-MIDI packets received (UDP payload)
+	unsigned int BytesSent;			// Size of RTP-MIDI packets sent (UDP payload)
+	unsigned int QueueBusyTicks;	// Number of ticks where outgoing queue was not empty
+	unsigned int Jitter;			// Interarrival jitter (RFC 3550) in 1/10 ms
+	unsigned int ScheduledDropped;	// Events given to SendScheduled which have been dropped (too many events waiting)
+	unsigned int GroupDropped;		// Blocks of CRTP_MIDISessionManager::SendGroupBlock lost for this session (transmit queue full)
+} TRTPMIDIStatistics;
 
 #ifdef __TARGET_MAC__
 // This callback is called from realtime thread. Processing time in the callback shall be kept to a minimum
@@ -176,9 +248,111 @@ typedef void (*TRTPMIDIDataCallback) (void* UserInstance, unsigned int DataSize,
 typedef void (CALLBACK *TRTPMIDIDataCallback) (void* UserInstance, unsigned int DataSize, unsigned char* DataBlock, unsigned int DeltaTime);
 #endif
 
+// Transmit lanes : each packet is filled with realtime lane blocks first, then with bulk lane blocks in the space left
+#define RTP_LANE_REALTIME		0		// Realtime and channel voice messages
+#define RTP_LANE_BULK			1		// Large blocks (SYSEX, dumps) which must not delay realtime messages
+
+// Maximum number of events and bytes in an event span (span is delivered earlier when full)
+#define RTP_SPAN_MAX_EVENTS		512
+#define RTP_SPAN_DATA_SIZE		4096
+
+// Span delivery modes
+#define RTP_SPAN_PER_PACKET		0		// One span per RTP-MIDI packet received
+#define RTP_SPAN_PER_TICK		1		// One span per RunSession call
+
+// Decoded MIDI events, stored as arrays : event N is Length[N] bytes at Data[Offset[N]], received at Timestamp[N]
+typedef struct {
+	unsigned int Count;			// Number of events in span
+	unsigned int DataSize;		// Number of bytes used in Data
+	unsigned char* Data;		// Packed MIDI bytes of all events
+	unsigned int Offset[RTP_SPAN_MAX_EVENTS];
+	unsigned int Length[RTP_SPAN_MAX_EVENTS];
+	unsigned int Timestamp[RTP_SPAN_MAX_EVENTS];
+} TRTPMIDIEventSpan;
+
+// SYSEX chunk flags (streaming SYSEX mode)
+#define RTP_SYSEX_FIRST			0x01	// Chunk starts with F0
+#define RTP_SYSEX_LAST			0x02	// Chunk ends the SYSEX message (ends with F7 unless RTP_SYSEX_CANCELLED is set)
+#define RTP_SYSEX_CANCELLED		0x04	// SYSEX has been cancelled by sender (or corrupted) : chunks already received must be discarded
+
+// SYSEX chunk callback is called from realtime thread
+#ifdef __TARGET_MAC__
+typedef void (*TRTPMIDISysExCallback) (void* UserInstance, unsigned int DataSize, unsigned char* DataBlock, unsigned int Flags, unsigned int DeltaTime);
+#endif
+
+#ifdef __TARGET_LINUX__
+typedef void (*TRTPMIDISysExCallback) (void* UserInstance, unsigned int DataSize, unsigned char* DataBlock, unsigned int Flags, unsigned int DeltaTime);
+#endif
+
+#ifdef __TARGET_WIN__
+typedef void (CALLBACK *TRTPMIDISysExCallback) (void* UserInstance, unsigned int DataSize, unsigned char* DataBlock, unsigned int Flags, unsigned int DeltaTime);
+#endif
+
+// Buffer exchanged between realtime thread and host thread when SYSEX pool is enabled
+typedef struct {
+	unsigned char* Data;
+	unsigned int Size;
+} TSysExPoolBuffer;
+
+// Span callback is called from realtime thread. Span content is only valid during the call
+#ifdef __TARGET_MAC__
+typedef void (*TRTPMIDISpanCallback) (void* UserInstance, TRTPMIDIEventSpan* Span);
+#endif
+
+#ifdef __TARGET_LINUX__
+typedef void (*TRTPMIDISpanCallback) (void* UserInstance, TRTPMIDIEventSpan* Span);
+#endif
+
+#ifdef __TARGET_WIN__
+typedef void (CALLBACK *TRTPMIDISpanCallback) (void* UserInstance, TRTPMIDIEventSpan* Span);
+#endif
+
+// Session events sent to the session event callback
+#define RTP_EVENT_CONNECTION_LOST	1	// Partner does not answer anymore to sync messages
+#define RTP_EVENT_PEER_CLOSED		2	// Partner has sent a BY
+#define RTP_EVENT_REFUSED			3	// Partner has rejected our invitation
+#define RTP_EVENT_SESSION_CLOSED	4	// Close requested by CloseSessionAsync is completed
+
+// Session event callback is called from realtime thread
+#ifdef __TARGET_MAC__
+typedef void (*TRTPMIDISessionEventCallback) (void* UserInstance, int Event);
+#endif
+
+#ifdef __TARGET_LINUX__
+typedef void (*TRTPMIDISessionEventCallback) (void* UserInstance, int Event);
+#endif
+
+#ifdef __TARGET_WIN__
+typedef void (CALLBACK *TRTPMIDISessionEventCallback) (void* UserInstance, int Event);
+#endif
+
+// Timings of session management (all times in ms). Default values are the ones of the Apple driver
+typedef struct {
+	unsigned int StartupSyncInterval;	// Time between the first sync sequences (default 1500)
+	unsigned int StartupSyncCount;		// Number of sync sequences sent at StartupSyncInterval (default 6)
+	unsigned int SyncInterval;			// Time between sync sequences after startup (default 10000)
+	unsigned int LossThreshold;			// Sync intervals without CK from partner before connection is declared lost (default 4)
+	unsigned int InviteInterval;		// Time between first invitations (default 1000)
+	unsigned int InviteMaxInterval;		// Time between invitations is doubled after each attempt up to this value (default 1000 : no backoff)
+	unsigned int InviteJitter;			// Random time (0 to InviteJitter) added to each invitation interval (default 0)
+	unsigned int MaxDataInvites;		// Invitations sent on data port before inviting again on control port (default 12)
+	bool FastReconnect;					// After a connection loss, invite on data port with same token and ports first (default false)
+} TRTPMIDISessionPolicy;
+
+// Number of words of the input filter (see SetInputFilter)
+#define RTP_FILTER_WORDS	8
+
+// Number of data port invitations repeated by fast reconnect before a complete invitation sequence
+#define RTP_FAST_RECONNECT_INVITES	3
+
+class CRTP_MIDISessionManager;
+class CRTP_MIDIEventLoop;
 
 class CRTP_MIDI
 {
+	friend class CRTP_MIDISessionManager;
+	friend class CRTP_MIDIEventLoop;
+
 public:
     unsigned int LocalClock;           // Timestamp counter following session initiator
 
@@ -201,13 +375,143 @@ public:
 						unsigned short LocalCtrlPort,
 						unsigned short LocalDataPort,
 						bool IsInitiator);
+
+	//! Same as above, with dual-stack sockets : the partner can be an IPv4 or IPv6 device
+	//! \param DestAddress numeric IPv4 or IPv6 address (link-local IPv6 addresses need the interface, e.g "fe80::1%eth0"), 0 for a session listener
+	// \return 0=session being initiated -1=can not create control socket -2=can not create data socket -3=invalid address
+	int InitiateDualStackSession(const char* DestAddress,
+								 unsigned short DestCtrlPort,
+								 unsigned short DestDataPort,
+								 unsigned short LocalCtrlPort,
+								 unsigned short LocalDataPort,
+								 bool IsInitiator);
+
+	//! Starts a session with an endpoint of the same host through shared memory rather than UDP
+	//! The session listener creates the segment, the session initiator opens it (listener must be started first)
+	//! \param Name name of the shared segment (RTP_LOCAL_MAX_NAME characters at most), same on both endpoints
+	// \return 0=session being initiated -1=segment can not be created or opened
+	int InitiateLocalSession(const char* Name, bool IsInitiator);
+
+	//! Blocks until a packet is received from the local partner, MIDI data is queued or Timeout (ms) elapses (local sessions only)
+	//! Used by a thread which calls RunSession as soon as there is something to do (with RTP_CLOCK_SYSTEM clock source)
+	//! \return true if a packet is waiting
+	bool WaitLocalData(unsigned int Timeout);
+
 	void CloseSession(void);
 
+	//! Closes the session without blocking : BY is sent from RunSession thread, then repeated ByRepeat times every RTP_BY_REPEAT_INTERVAL
+	//! Sockets are released after the last BY, then RTP_EVENT_SESSION_CLOSED is sent to the session event callback
+	//! Can be called from any thread. RunSession must be called until IsClosing returns false
+	void CloseSessionAsync (unsigned int ByRepeat=0);
+
+	//! Returns true while a close requested by CloseSessionAsync is not completed
+	bool IsClosing (void);
+
 	//! Main processing function to call from high priority thread (audio or multimedia timer) every millisecond
 	void RunSession(void);
 
 	//! Send a RTP-MIDI block (with leading delta-times)
-	bool SendRTPMIDIBlock (unsigned int BlockSize, unsigned char* MIDIData);
+	//! Can be called from any number of threads : each block is queued atomically (block is either queued completely or rejected)
+	//! Lane = RTP_LANE_REALTIME or RTP_LANE_BULK. Blocks must start with a status byte (no running status across blocks)
+	bool SendRTPMIDIBlock (unsigned int BlockSize, unsigned char* MIDIData, int Lane=RTP_LANE_REALTIME);
+
+	//! Send a RTP-MIDI block immediately from the caller thread, with the blocks already queued by SendRTPMIDIBlock
+	//! Can be called from any thread, at the same time than RunSession is running (packets are never interleaved)
+	//! \return false if the block can not be queued (session closed, queue full or block too large)
+	bool SendNow (unsigned int BlockSize, unsigned char* MIDIData);
+
+	//! Sets the minimum time (in 1/10 ms) between two packets sent by SendNow. Blocks sent within the window are
+	//! grouped in a single packet sent by RunSession or by the next SendNow. 0 (default) sends every block immediately
+	void SetCoalescingWindow (unsigned int Window);
+
+	//! Sends a complete SYSEX message (F0 ... F7) of any size. The message is not copied : it is split in fragments of
+	//! SYSEX_FRAGMENT_SIZE bytes at most (RFC 6295 segments), read from Data when each packet is built
+	//! Data must stay valid until IsSysExSending returns false. Only one SYSEX can be sent at a time
+	//! \return false if a SYSEX is already being sent, if session is not opened or if Data is not a SYSEX message
+	bool SendSysEx (const unsigned char* Data, unsigned int Size);
+
+	//! Sends a MIDI message (without delta time, RTP_SCHEDULED_MAX_MSG bytes max) when session clock reaches Time (see GetSessionTime)
+	//! Events are sent in the packet built ScheduleLookahead before their time, with delta times giving their exact time
+	//! Can be called from any number of threads
+	//! \return false if session is not opened, message is too large or scheduler intake is full
+	bool SendScheduled (unsigned int Time, unsigned int Size, unsigned char* MIDIData);
+
+	//! Returns the session clock (1/10 ms) used for RTP timestamps and SendScheduled
+	unsigned int GetSessionTime (void);
+
+	//! Sets how long (1/10 ms) before their time scheduled events are sent (default 10 : one tick)
+	void SetScheduleLookahead (unsigned int Lookahead);
+
+	//! Copies the clock offset, round trip time and skew estimated from CK exchanges with the partner
+	//! Can be called from any thread. \return false if no CK exchange has been completed yet
+	bool GetClockInfo (TRTPMIDIClockInfo* Info);
+
+	//! Writes the numeric address of the session partner in Text (empty string if there is no partner)
+	void GetPartnerAddress (char* Text, unsigned int Size);
+
+	//! Returns the histograms and trace events of the realtime thread, 0 if the library is compiled without RTP_MIDI_TRACE
+	//! Sessions run by a session manager share the trace of the manager
+	CRTPMIDITrace* GetTrace (void);
+
+	//! Converts a time of the partner clock (1/10 ms) into the session clock (see GetSessionTime)
+	//! Time is returned unchanged while no CK exchange has been completed. Can be called from any thread
+	unsigned int RemoteToLocalTime (unsigned int RemoteTime);
+
+	//! true : time of incoming events is computed from the packet timestamp converted into the session clock
+	//! false (default) : time of incoming events is computed from the time of reception of the packet
+	void SetSyncedEventTime (bool Enable);
+
+	//! Returns true while the SYSEX given to SendSysEx is being sent
+	bool IsSysExSending (void);
+
+	//! Enables the compact encoding of outgoing packets : running status, no delta time before first command when it is 0,
+	//! short header when MIDI list is 15 bytes or less (all these forms are defined by RFC 6295). Disabled by default
+	void SetCompactEncoding (bool Enable);
+
+	//! Sets the filter applied by the decoder to incoming messages. Filtered messages never reach the callbacks (or rings)
+	//! and filtered SYSEX are not stored. Mask is an array of RTP_FILTER_WORDS words, one per status class :
+	//! Mask[0] to Mask[6] for 0x8n to 0xEn messages (bit n : channel n), Mask[7] for system messages (bit n : status 0xFn, bit 0 : SYSEX)
+	//! A bit set to 1 accepts the message. Mask=0 accepts all messages (default). Can be called from any thread
+	void SetInputFilter (const unsigned short* Mask);
+
+	//! Accepts or filters a single status (channel message with its channel, e.g 0xE3, or system message, e.g 0xFE)
+	//! Can be called from any thread
+	void SetInputFilterStatus (unsigned char Status, bool Accept);
+
+	//! Sets the minimum time (in 1/10 ms) between two SYSEX fragments (default 10 : one fragment per ms). 0 : no pacing
+	void SetSysExPacing (unsigned int Interval);
+
+	//! Sets the maximum size of the MIDI list in outgoing RTP packets (clamped to MAX_RTP_LOAD)
+	//! Blocks which do not fit in the current packet are sent in next packet
+	void SetMaxPayloadSize (unsigned int MaxSize);
+
+	//! Sets the maximum payload size from the path MTU (in bytes), so outgoing packets are never fragmented by IP layer
+	void SetPathMTU (unsigned int MTU);
+
+	//! Enables the recovery journal (RFC 6295, chapters P, C, W and N) for outgoing packets and repair of lost packets on reception
+	//! Must be called before the session is started
+	void EnableJournal (bool Enable);
+
+	//! Enables the playout buffer of incoming MIDI events (Size=0 disables it). Must be called before the session is started
+	//! Events are delivered at their sender time (RTP timestamp and delta times) plus a constant latency, adapted to
+	//! the measured jitter between MinDelay and MaxDelay (1/10 ms). SYSEX chunks sent to SysExCallback are not delayed
+	//! An event which does not fit in the buffer is delivered at once, after the buffered events which are not later
+	//! \param Size storage of the buffer in bytes (allocated here)
+	void EnableJitterBuffer (unsigned int Size, unsigned int MinDelay, unsigned int MaxDelay);
+
+	//! Returns the latency (1/10 ms) currently added by the playout buffer
+	unsigned int GetJitterBufferDelay (void);
+
+	//! Selects the clock source used for timestamps and session timers (RTP_CLOCK_TICK or RTP_CLOCK_SYSTEM)
+	//! With RTP_CLOCK_SYSTEM, late or irregular RunSession calls do not affect timestamps accuracy
+	void SetClockSource (int Source);
+
+	//! Returns the time (in ms) before RunSession has something to do if no packet is received (0xFFFFFFFF : nothing scheduled)
+	//! Used by event driven hosts (see CRTP_MIDIEventLoop) to sleep until next session event
+	unsigned int GetTimeToNextEvent (void);
+
+	//! Returns the OS monotonic clock in 100us units (wraps around after 2^32 units)
+	static unsigned int GetSystemTime (void);
 
 	//! Returns the session status
 	/*!
@@ -238,22 +542,126 @@ public:
 	bool RemotePeerHasRefusedSession(void);
 
 	//! Declares callback and instance parameter for the callback
+	//! Callback setters and SetEventRing can be called from any thread : the change is applied by the realtime thread at the beginning of next RunSession
 	void SetCallback (TRTPMIDIDataCallback CallbackFunc, void* UserInstance);
 
+	//! Declares a callback called as soon as connection is lost, partner closes the session or refuses the invitation (RTP_EVENT_xxx)
+	//! Flags read by ReadAndResetConnectionLost, RemotePeerHasClosedSession and RemotePeerHasRefusedSession are still set
+	void SetSessionEventCallback (TRTPMIDISessionEventCallback CallbackFunc, void* UserInstance);
+
+	//! Sets the timings of sync messages, connection loss detection and invitations (see TRTPMIDISessionPolicy)
+	//! Must be called before the session is started. Both partners should use the same sync timings
+	void SetSessionPolicy (const TRTPMIDISessionPolicy* Policy);
+
+	//! Fills Policy with the default timings
+	static void GetDefaultSessionPolicy (TRTPMIDISessionPolicy* Policy);
+
+	//! Declares a callback receiving all decoded events of a packet (RTP_SPAN_PER_PACKET) or of a RunSession call (RTP_SPAN_PER_TICK)
+	//! in a single call. When a span callback is declared, the callback declared by SetCallback is not used anymore
+	//! CallbackFunc = 0 goes back to one callback per MIDI message
+	void SetSpanCallback (TRTPMIDISpanCallback CallbackFunc, void* UserInstance, int Mode);
+
+	//! Declares a ring in which decoded events are written instead of being sent to callbacks (0 : callbacks are used)
+	//! The ring belongs to the host, which reads it from its own thread (single consumer)
+	//! A ring which has been replaced must not be deleted before next RunSession has been completed
+	void SetEventRing (CRTPMIDIEventRing* Ring);
+
+	//! Records all datagrams sent and received by the session in a capture buffer (0 : no capture)
+	//! The buffer belongs to the host, which writes it to a file from its own thread with CRTPMIDICapture::Flush
+	void SetCapture (CRTPMIDICapture* Capture);
+
+	//! Processes the received datagrams of a capture file without sockets, with the session clock set to their capture time
+	//! Callbacks (or event ring, spans) receive the same events with the same timestamps as during the capture
+	//! Session must be closed. It is closed again at the end of the replay
+	//! \return number of datagrams replayed, -1 if File is not a capture file or if the session is not closed
+	int ReplayCapture (FILE* File);
+
+	//! Enables streaming of incoming SYSEX : SYSEX messages are sent to CallbackFunc by chunks (RTP_SYSEX_FIRST / RTP_SYSEX_LAST flags)
+	//! as each RTP segment is decoded, or when SYSEX buffer is full. Memory stays bounded to SYXInSize whatever the SYSEX size
+	//! All chunks of a SYSEX are timestamped with the time of its F0
+	//! CallbackFunc = 0 goes back to complete SYSEX messages sent to the other callbacks
+	void SetSysExCallback (TRTPMIDISysExCallback CallbackFunc, void* UserInstance);
+
+	//! Lets the SYSEX buffer grow up to MaxSize (0 : fixed buffer of SYXInSize bytes). Applies when SYSEX streaming is not used
+	//! Buffers are allocated by ServiceSysExPool, never by the realtime thread
+	void EnableSysExPool (unsigned int MaxSize);
+
+	//! Allocates the next (larger) SYSEX buffer and frees the buffer replaced by realtime thread
+	//! Must be called regularly from a non realtime thread when the SYSEX pool is enabled
+	void ServiceSysExPool (void);
+
+	//! Copies session statistics in Stats
+	//! Lock-free : can be called from any thread while RunSession is running (each counter is read atomically)
+	void GetStatistics (TRTPMIDIStatistics* Stats);
+
+	//! Clears all statistics counters (can be called from any thread)
+	void ResetStatistics (void);
+
+	//! Decodes a RTP-MIDI packet which has not been received from the data socket (capture file, benchmark, other transport)
+	//! Packet is processed as if it came from the session partner (callbacks, journal, statistics)
+	//! Must be called from the thread which calls RunSession
+	void InjectRTPPacket (unsigned char* Buffer, int Size);
+
 private:
 	// Callback data
 	TRTPMIDIDataCallback RTPCallback;	// Callback for incoming RTP-MIDI message
 	void* ClientInstance;
+	TRTPMIDISpanCallback SpanCallback;	// Callback for spans of incoming MIDI messages (0 : RTPCallback is used)
+	void* SpanInstance;
+	int SpanMode;
+	TRTPMIDIEventSpan EventSpan;		// Events waiting to be delivered to SpanCallback
+	unsigned char SpanData[RTP_SPAN_DATA_SIZE];
+	CRTPMIDIEventRing* EventRing;		// Ring receiving decoded events (0 : callbacks are used)
+	CRTPMIDICapture* Capture;			// Buffer recording sent and received datagrams (0 : no capture)
+
+	// Callback and ring changes requested by host threads, applied by the realtime thread (see ApplyPendingConfig)
+	std::atomic_flag ConfigLock;		// Held while pending configuration is written or applied
+	std::atomic<unsigned int> ConfigPending;	// RTP_CONFIG_xxx bits of the changes waiting
+	TRTPMIDIDataCallback PendingRTPCallback;
+	void* PendingClientInstance;
+	TRTPMIDISpanCallback PendingSpanCallback;
+	void* PendingSpanInstance;
+	int PendingSpanMode;
+	CRTPMIDIEventRing* PendingEventRing;
+	TRTPMIDISysExCallback PendingSysExCallback;
+	void* PendingSysExInstance;
+
+	// Playout buffer (events are stored with their release time, producer and consumer are the realtime thread)
+	CRTPMIDIEventRing* JitterRing;
+	unsigned int JitterMinDelay;
+	unsigned int JitterMaxDelay;
+	std::atomic<unsigned int> JitterDelay;
+	unsigned int TransitMin[2];			// Smallest transit time (local clock minus RTP timestamp) on current and previous windows
+	unsigned int TransitPackets;		// Packets received in the current window
+	bool TransitValid;
+	unsigned int PacketEventTime;		// Time of the packet being decoded (events add their delta time to it)
 
 	unsigned char SessionName [MAX_SESSION_NAME_LEN];
 
-	unsigned int RemoteIPToInvite;				// Address of remote computer (0 if module is used as session listener)
-	unsigned int SessionPartnerIP;              // IP address of session partner
+	unsigned int RemoteIPToInvite;				// Address (or IPv6 address key) of remote computer (0 if module is used as session listener)
+	unsigned int SessionPartnerIP;              // IP address (or IPv6 address key) of session partner
+	TRTPMIDIAddress RemoteAddressToInvite;		// Full addresses (port not used) in the family of the sockets
+	TRTPMIDIAddress PartnerAddress;
+	bool PartnerIPv6;							// Partner addresses must be fully compared, SessionPartnerIP is only a key
+	int SocketFamily;							// AF_INET, or AF_INET6 for dual-stack sockets
 	unsigned short PartnerControlPort;			// Remote control port number (0 if module is used as session listener)
 	unsigned short PartnerDataPort;				// Remote data port number (0 if module is used as session listener)
 
 	TSOCKTYPE ControlSocket;
 	TSOCKTYPE DataSocket;
+	bool SharedSockets;				// Sockets belong to a session manager (they are read and closed by the manager)
+	CRTPMIDILocalTransport LocalTransport;	// Replaces the sockets when it is opened (local session)
+	bool DataSocketConnected;		// Data socket is connected to the partner data port (owned sockets only)
+
+	// Destination addresses and packet headers, prebuilt when session parameters change
+	TRTPMIDIAddress PartnerControlAddress;
+	TRTPMIDIAddress PartnerDataAddress;
+	int PartnerAddressLength;
+	TSessionPacketNoName SessionTemplate;
+	TSyncPacket SyncTemplate;
+	TFeedbackPacket FeedbackTemplate;
+	TRTP_Header RTPHeaderTemplate;
+	CRTP_MIDIEventLoop* WakeLoop;	// Event loop to wake up when MIDI data is queued (0 if session is polled)
 
 	bool SocketLocked;
 	unsigned int SSRC;
@@ -272,9 +680,59 @@ private:
 	bool TimerRunning;				// Event timer is running
 	unsigned int EventTime;			// Time to which event will be signalled
 
-	unsigned int TimeCounter;		// Counter in 100us used for clock synchronization
+	std::atomic<unsigned int> TimeCounter;	// Counter in 100us used for clock synchronization (read by SendNow from other threads)
+	unsigned int TimeCounterHigh;			// Number of TimeCounter wrap arounds (high word of 64 bits CK timestamps)
+	CRTPMIDIClockSync ClockSync;
 
-	TMIDI_FIFO_CHAR RTPStreamQueue;		// Streaming MIDI messages with precomputed RTP deltatime
+#ifdef RTP_MIDI_TRACE
+	CRTPMIDITrace LocalTrace;
+	CRTPMIDITrace* Trace;				// LocalTrace, or trace of the session manager
+#endif
+	bool SyncedEventTime;					// Incoming event time is computed from the packet timestamp
+
+	int ClockSource;				// RTP_CLOCK_TICK or RTP_CLOCK_SYSTEM
+	unsigned int LastSystemTime;	// OS clock value (100us) read on previous tick
+	unsigned int TimerRemainder;	// Elapsed time (100us) not yet applied to timer since it is less than 1ms
+
+	CRTPMIDIBlockQueue RTPStreamQueue;	// Streaming MIDI messages with precomputed RTP deltatime
+	CRTPMIDIBlockQueue BulkQueue;		// Bulk lane : sent in the room left by RTPStreamQueue
+	CRTPMIDIScheduler Scheduler;		// Events sent at a given time of session clock (consumer protected by TransmitLock)
+	unsigned int ScheduleLookahead;
+	bool CompactEncoding;				// Outgoing MIDI list is rewritten in its shortest form
+	unsigned int MaxPayloadSize;		// Maximum size of MIDI list in one outgoing RTP packet
+	std::atomic_flag TransmitLock;		// Held while a RTP-MIDI packet is built and sent (RTPSequence and queue consumer protection)
+	unsigned int CoalescingWindow;		// Minimum time (100us) between two packets sent by SendNow
+	unsigned int LastTransmitTime;		// OS time (100us) of the last RTP-MIDI packet sent (protected by TransmitLock)
+
+	// Outgoing SYSEX fragmentation
+	std::atomic<bool> SysExOutBusy;					// SendSysEx has been accepted, SYSEX not completely sent
+	std::atomic<const unsigned char*> SysExOutData;	// SYSEX being sent (0 : none)
+	unsigned int SysExOutSize;
+	unsigned int SysExOutPos;			// Next byte to send (protected by TransmitLock)
+	unsigned int SysExPacing;			// Minimum time (100us) between two fragments
+	unsigned int LastSysExFragmentTime;	// OS time (100us) of last fragment sent (protected by TransmitLock)
+
+	CRTPMIDIJournal* Journal;			// Recovery journal (0 if journal is not enabled)
+	unsigned char JournalBuffer[RTP_JOURNAL_MAX_SIZE];	// Journal built for the outgoing packet (protected by TransmitLock)
+	TLongMIDIRTPMsg TransmitPacket;		// RTP-MIDI packet built by EndTick and SendNow (protected by TransmitLock)
+	unsigned char CompactBuffer[MAX_RTP_LOAD];	// Work buffer of CompactMIDIList (protected by TransmitLock)
+	bool GuardPending;					// A guard packet must be sent if nothing is transmitted for RTP_JOURNAL_GUARD_TIME (protected by TransmitLock)
+	bool SequenceValid;					// LastRTPCounter contains the sequence number of a received packet
+
+	// Statistics (written by realtime thread or under TransmitLock, read by any thread)
+	std::atomic<unsigned int> StatPacketsReceived;
+	std::atomic<unsigned int> StatPacketsLost;
+	std::atomic<unsigned int> StatPacketsReordered;
+	std::atomic<unsigned int> StatPacketsDuplicated;
+	std::atomic<unsigned int> StatPacketsSent;
+	std::atomic<unsigned int> StatBytesReceived;
+	std::atomic<unsigned int> StatBytesSent;
+	std::atomic<unsigned int> StatQueueBusyTicks;
+	std::atomic<unsigned int> StatGroupDropped;
+	std::atomic<unsigned int> StatJitter;	// Jitter estimation x16 (RFC 3550 fixed point implementation)
+	unsigned int LastTransit;		// Relative transit time of last packet (local clock - RTP timestamp)
+
+	TRTPReceiveSlot* ReceiveSlots;		// Datagrams read from a socket in the last batch (allocated only when the session owns its sockets)
 
 	// Decoding variables for incoming RTP message
 	bool SYSEX_RTPActif;			// We are receiving a SYSEX message from network
@@ -288,6 +746,25 @@ private:
 	unsigned char* InSYSEXBuffer;
 	unsigned int InSYSEXBufferPtr;		// Number of SYSEX bytes received
 	bool InSYSEXOverflow;				// Received SYSEX message can not fit in the local buffer
+	TRTPMIDISysExCallback SysExCallback;	// Receives SYSEX chunks (0 : SYSEX are sent complete)
+	void* SysExInstance;
+	bool SysExChunkSent;				// A chunk of current SYSEX has already been sent to SysExCallback
+	bool SysExFiltered;					// Current SYSEX is rejected by the input filter : it is decoded but not stored
+	unsigned int SysExEventTime;		// Time of the F0 of current SYSEX, given to all its chunks (streaming mode)
+
+	// Input filter : 16 bits word per status class (see SetInputFilter), four words in each atomic
+	std::atomic<unsigned long long> InputFilter[2];
+
+	//! Returns true if the input filter accepts a status byte (0x80 to 0xFF)
+	bool AcceptStatus (unsigned char Status)
+	{
+		unsigned int Class=(Status>>4)&7;
+		return ((InputFilter[Class>>2].load(std::memory_order_relaxed)>>(((Class&3)<<4)+(Status&0x0F)))&1)!=0;
+	}
+	unsigned int SysExPoolMaxSize;		// Maximum size of SYSEX buffer (0 : pool disabled)
+	std::atomic<unsigned int> SysExPoolCurrentSize;		// Size of SYSEX buffer in use (read by ServiceSysExPool)
+	std::atomic<TSysExPoolBuffer*> SysExSpare;			// Larger buffer prepared by ServiceSysExPool
+	std::atomic<TSysExPoolBuffer*> SysExRetired;		// Buffer replaced by realtime thread, to be freed by ServiceSysExPool
 
 	unsigned int TS1H;
 	unsigned int TS1L;
@@ -296,16 +773,114 @@ private:
 	unsigned int TS3H;
 	unsigned int TS3L;
 
+	// Per tick state (set by BeginTick and by incoming packets, used by EndTick)
+	bool TickTimerEvent;
+	bool InvitationAcceptedOnCtrl;
+	bool InvitationRejectedOnCtrl;
+	bool InvitationAcceptedOnData;
+	bool InvitationRejectedOnData;
+
 	bool ConnectionLost;				// Set to 1 when connection is lost after a session has opened successfully
 	bool PeerClosedSession;				// Set to 1 when we receive a BY message on a opened session
 	bool ConnectionRefused;				// Set to 1 when remote device refuses the invitation
 
+	TRTPMIDISessionPolicy Policy;
+	unsigned int InviteDelay;			// Current time between invitations (ms)
+	bool FastReconnectPending;			// Data port invitations are sent with the token of the lost session
+	TRTPMIDISessionEventCallback SessionEventCallback;
+	void* SessionEventInstance;
+
+	std::atomic<int> CloseRequest;		// Number of BY repetitions requested by CloseSessionAsync (-1 : no request)
+	unsigned int ByRepeatCount;			// BY messages still to send before the session is closed
+
+	//! Sends the first BY of CloseSessionAsync from the realtime thread
+	void StartClosing (void);
+
+	//! Repeats the BY then closes the session (SESSION_CLOSING state)
+	void RunClosing (void);
+
+	//! Returns the next invitation interval (exponential backoff with random part)
+	unsigned int NextInviteDelay (void);
+
+	//! Calls the session event callback if one is declared
+	void NotifySessionEvent (int Event);
+
 	void CloseSockets(void);
+
+	//! Initializes session variables and state machine once sockets are available
+	//! \param DestAddress address of the device to invite in the family of the sockets (0 for a session listener)
+	void StartSession(const TRTPMIDIAddress* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort, bool IsInitiator);
+
+	//! Starts session on sockets owned by a session manager (incoming packets are then dispatched by the manager)
+	void AttachSession(TSOCKTYPE SharedControlSocket, TSOCKTYPE SharedDataSocket, int Family, const TRTPMIDIAddress* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort, bool IsInitiator);
+
+	//! First part of RunSession : advances clocks and timers
+	//! \return false if session is not active (nothing else shall be done during this tick)
+	bool BeginTick(void);
+
+	//! Last part of RunSession, after incoming packets have been processed : runs the state machine and sends outgoing packets
+	void EndTick(void);
+
+	//! Builds the destination addresses from partner IP address and ports. Must be called each time one of them changes
+	void UpdatePartnerAddresses (void);
+
+	//! Records the partner address (0 : no partner)
+	void SetPartner (const TRTPMIDIAddress* Address);
+
+	//! Records a datagram sent by the session
+	void CaptureSent (unsigned int Flags, const void* Data, int Size)
+	{
+		if (Capture!=0) Capture->Record(TimeCounter, Flags|RTP_CAPTURE_SENT, Data, Size);
+	}
+
+	//! Records a datagram processed by the session (Capture must not be 0)
+	void CaptureReceived (TRTPReceiveSlot* Slot, unsigned int Flags);
+
+	//! Starts a session without sockets for ReplayCapture
+	void StartReplay (bool IsInitiator);
+
+	//! Same processing than EndTick for the data received during a tick (playout buffer and spans) during replay
+	void EndReplayTick (void);
+
+	//! Returns true if the packet comes from the session partner (address only)
+	bool IsPartner (TRTPReceiveSlot* Slot)
+	{
+		if ((Slot->SenderIP!=SessionPartnerIP)||(Slot->SenderIPv6!=PartnerIPv6)) return false;
+		return ((PartnerIPv6==false)||(SameHost(&Slot->SenderAddress, &PartnerAddress)));
+	}
+
+	// Address helpers, also used by the session manager
+	//! Returns the IPv4 address (host order) of IPv4 and IPv4-mapped addresses, or a non zero key of an IPv6 address
+	static unsigned int GetAddressKey (const TRTPMIDIAddress* Address, bool* IsIPv6);
+	//! Compares the host part (address and interface) of two addresses of the same family
+	static bool SameHost (const TRTPMIDIAddress* A, const TRTPMIDIAddress* B);
+	static int GetAddressLength (const TRTPMIDIAddress* Address);
+	//! Builds the address of an IPv4 host in a socket family
+	static void MakeIPv4Address (unsigned int IP, int Family, TRTPMIDIAddress* Address);
+	//! Converts a numeric address in a socket family. \return false if address is invalid or can not be used with this family
+	static bool ParseAddress (const char* Text, int Family, TRTPMIDIAddress* Address);
+	static void SetAddressPort (TRTPMIDIAddress* Address, unsigned short Port);
+	//! Fills SenderIP, SenderIPv6 and SenderPort from the sender address of a received datagram
+	static void SetSlotSender (TRTPReceiveSlot* Slot);
+	//! Opens an IPv6 socket accepting also IPv4 packets
+	static bool CreateDualStackSocket (TSOCKTYPE* Socket, unsigned short Port);
+
+	//! Builds the constant part of session and RTP packets. Must be called when SSRC or initiator token changes
+	void BuildPacketTemplates (void);
+
+	//! Connects the data socket to the partner data port (or removes the connection). Does nothing on shared sockets
+	void ConnectDataSocket (bool Connect);
+
+	//! Sends a packet to the partner data port (or data channel of the local transport)
+	void SendToPartnerData (const void* Packet, int Size);
+	//! Sends a packet to the partner control port (or control channel of the local transport)
+	void SendToPartnerControl (const void* Packet, int Size);
+
 	void SendInvitation (bool DestControl);
 
 	//! Sends an answer to an invitation
 	//! \param Accept true : send invitation accepted message, false : send invitation rejected message
-	void SendInvitationReply (bool FromControlSocket, bool Accept, unsigned int DestinationIP, unsigned short DestinationPort);
+	void SendInvitationReply (bool FromControlSocket, bool Accept, TRTPMIDIAddress* Destination);
 
 	void SendSyncPacket (char Count, unsigned int TS1H, unsigned int TS1L, unsigned int TS2H, unsigned int TS2L, unsigned int TS3H, unsigned int TS3L);
 	void SendBYCommand (void);
@@ -319,22 +894,66 @@ private:
 	/*!
 	 \param : BufPtr = pointer sur octets a lire dans le tampon RTP
 	 \param : ByteCtr = number of byte read (updated by function). Must contain the position of first byte to read at call
+	 \param : TailleBloc = size of the MIDI list : bytes are never read after it
 	 */
-	unsigned int GetDeltaTime(unsigned char* BufPtr, int* ByteCtr);
+	unsigned int GetDeltaTime(unsigned char* BufPtr, int* ByteCtr, int TailleBloc);
+
+	//! Returns TimeCounter extended to 64 bits for CK timestamps
+	unsigned long long GetTime64 (void);
+
+	//! Returns true if a block is waiting in one of the transmit lanes
+	bool TransmitPending (void);
 
-	//! Fill the payload area of RTP buffer with MIDI data to send to the network
+	//! Fill the payload area of RTP buffer with MIDI data to send to the network (realtime lane first, then bulk lane)
 	//! \return Number of bytes put in payload (0 = no data to be sent)
-	int GeneratePayload (unsigned char* MIDIList);
+	int GeneratePayload (unsigned char* MIDIList, unsigned int MaxSize);
+
+	//! Rewrites a MIDI list (every command with delta time) with running status, and without first delta time if it is 0
+	//! FirstDelta is set to false if the first delta time has been removed (Z=0)
+	//! \return new size of the list (list is not changed if it can not be parsed)
+	//! Uses CompactBuffer : must be called with TransmitLock held
+	unsigned int CompactMIDIList (unsigned char* MIDIList, unsigned int Size, bool* FirstDelta);
+
+	//! Returns the sum of the delta times of a MIDI list (every command with delta time)
+	//! Parsing stops at the first command which can not be decoded
+	static unsigned int GetListDuration (unsigned char* MIDIList, unsigned int Size);
+
+	//! Sends a RTP-MIDI packet to the session partner on data socket
+	void SendRTPPacket (TLongMIDIRTPMsg* Buffer, int Size);
 
 	//! Prepare a RTP_MIDI for sending on the network
 	//* Returns the size of generated message. Value 0 means no MIDI data to send */
-	int PrepareMessage (TLongMIDIRTPMsg* Buffer, unsigned int TimeStamp);
+	//* AllowEmpty generates a packet with an empty MIDI list if a journal is available (guard packet) */
+	int PrepareMessage (TLongMIDIRTPMsg* Buffer, unsigned int TimeStamp, bool AllowEmpty=false);
+
+	//! Prepares header and journal of a packet whose MIDI list is shared with other sessions (session manager fan-out)
+	//! Journal is built in JournalBuffer. On success, the transmit lock is kept until EndGroupPacket is called
+	//! If the lock is busy, the MIDI list is queued in the RTP stream queue to be sent with next packet of the session
+	//! \return false if nothing has to be sent by the caller for this session
+	bool BeginGroupPacket (TRTPGroupHeader* Header, unsigned char* MIDIList, unsigned int Size, unsigned int* JournalSize);
+
+	//! Releases the transmit lock once the group packet has been sent
+	void EndGroupPacket (void);
+
+	//! Returns true if a fragment of the SYSEX given to SendSysEx can be sent now
+	bool SysExFragmentDue (void);
+
+	//! Writes next fragment of the SYSEX given to SendSysEx (with its delta time) in MIDIList
+	//! \return number of bytes written (0 : no SYSEX to send, pacing time not elapsed or no room)
+	unsigned int GenerateSysExFragment (unsigned char* MIDIList, unsigned int MaxSize);
+
+	//! Forgets the SYSEX given to SendSysEx (Data can be freed by caller)
+	void EndSysExTransfer (void);
 
 	//! Analyze incoming RTP frame from network
-	/*! Buffer = buffer containing RTP message received */
-	void ProcessIncomingRTP (unsigned char* Buffer);
+	/*! Buffer = buffer containing RTP message received, Size = size of datagram */
+	void ProcessIncomingRTP (unsigned char* Buffer, int Size);
+
+	//! Receives the repair commands generated from a recovery journal and sends them to client
+	static void JournalRepairCallback (void* Instance, unsigned int NumBytes, unsigned char* MIDIMsg);
 
 	//! Read and decode next MIDI event in RTP reception buffer and send it to callback
+	//! Complete channel messages are decoded directly, other messages go through the byte state machine
 	void GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int TailleBloc, unsigned int DeltaTime);
 
 	//! Initializes local SYSEX buffer
@@ -346,13 +965,65 @@ private:
 	//! Send the SYSEX buffer to client
 	void sendRTP_SYSEXBuffer (unsigned int DeltaTime);
 
+	//! Send the SYSEX bytes received so far to SysExCallback and empty the buffer (streaming mode)
+	void sendRTP_SYSEXChunk (unsigned int Flags, unsigned int DeltaTime);
+
+	//! Cancels the SYSEX being received (tells SysExCallback if chunks have already been sent)
+	void cancelRTP_SYSEXBuffer (unsigned int DeltaTime);
+
+	//! Replaces the SYSEX buffer by the larger spare buffer, if ServiceSysExPool has prepared one
+	void growRTP_SYSEXBuffer (void);
+
 	//! Send the MIDI message to client (max 3 bytes)
 	void sendMIDIToClient (unsigned int NumBytes, unsigned int DeltaTime);
+
+	//! Sends a decoded message to the event ring, to RTPCallback or adds it to the event span
+	void deliverToClient (unsigned int NumBytes, unsigned char* Data, unsigned int DeltaTime);
+
+	//! Stores a decoded message in the playout buffer (or delivers it if the buffer is not enabled or full)
+	void playoutEvent (unsigned int NumBytes, unsigned char* Data, unsigned int EventTime);
+
+	//! Computes the release time of a packet in the playout buffer and adapts the buffer latency
+	unsigned int getPlayoutTime (unsigned int Transit, unsigned int RemoteTime);
+
+	//! Delivers the events of the playout buffer whose time has come
+	void releasePlayoutEvents (void);
+
+	//! Delivers the events at the head of the playout buffer which are not later than Time
+	//! \return true if at least one event has been delivered
+	bool releasePlayoutEventsUntil (unsigned int Time);
+
+	//! Sends the event span to SpanCallback (nothing is done if span is empty)
+	void flushEventSpan (void);
+
+	//! Locks the pending configuration from a host thread (released by PostConfig)
+	void LockConfig (void);
+	//! Records the pending changes (RTP_CONFIG_xxx bits) and releases the pending configuration
+	void PostConfig (unsigned int Changes);
+	//! Applies callback and ring changes requested by host threads. Called by the realtime thread before decoding
+	//! Never waits : if a host thread is writing the configuration, changes are applied at next call
+	void ApplyPendingConfig (void);
 	
+	//! Read all pending datagrams (up to RTP_RECEIVE_SLOTS) from a socket into Slots
+	//! \return number of slots filled (RTP_RECEIVE_SLOTS means that more datagrams may be pending)
+	static int ReceiveBatch (TSOCKTYPE Socket, TRTPReceiveSlot* Slots);
+
+	//! Allocates the reception slots, if not done yet (sessions attached to a session manager never need them)
+	void AllocateReceiveSlots (void);
+
+	//! Same as ReceiveBatch for a channel of the local transport
+	int ReceiveLocal (int Channel, TRTPReceiveSlot* Slots);
+
 	//! Process communication on Control socket (processing of incoming invitations)
-	//! \return true if a packet has been received on control port socket
+	//! \return true if the reception batch was full (more packets may be waiting on control port socket)
 	bool ProcessControlSocket(bool* InvitationAccepted, bool* InvitationRejected);
 
+	//! Process one session packet received on control socket
+	void ProcessControlPacket(TRTPReceiveSlot* Slot, bool* InvitationAccepted, bool* InvitationRejected);
+
+	//! Process one packet (RTP-MIDI or session message) received on data socket
+	void ProcessDataPacket(TRTPReceiveSlot* Slot, bool* InvitationAccepted, bool* InvitationRejected);
+
 	//! Remote partner has asked to close the session
 	void PartnerCloseSession(void);
 };
@@ -0,0 +1,218 @@
+/*
+ *  RTP_MIDI_Address.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  IPv4 and IPv6 socket addresses
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Sessions compare the sender of each packet with their partner. IPv4
+ addresses are compared as integers. An IPv6 address is reduced to a 32 bits
+ key once when the packet is received (or when the partner is recorded), so
+ the same integer compare rejects almost all packets from other devices.
+ The full address is only compared when the keys are equal.
+ */
+
+#include "RTP_MIDI.h"
+#include <string.h>
+#if defined (__TARGET_LINUX__) || defined (__TARGET_MAC__)
+#include <netdb.h>
+#endif
+
+// IPv4-mapped IPv6 addresses : ::ffff:a.b.c.d
+static const unsigned char IPv4MappedPrefix[12]={0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+unsigned int CRTP_MIDI::GetAddressKey (const TRTPMIDIAddress* Address, bool* IsIPv6)
+{
+	const unsigned char* Bytes;
+	unsigned int Key=2166136261u;		// FNV-1a
+	unsigned int ScopeID;
+	int Index;
+
+	*IsIPv6=false;
+	if (Address->Generic.sa_family==AF_INET) return htonl(Address->V4.sin_addr.s_addr);
+	if (Address->Generic.sa_family!=AF_INET6) return 0;
+
+	Bytes=(const unsigned char*)&Address->V6.sin6_addr;
+	if (memcmp(Bytes, IPv4MappedPrefix, 12)==0)
+		return ((unsigned int)Bytes[12]<<24)|((unsigned int)Bytes[13]<<16)|((unsigned int)Bytes[14]<<8)|(unsigned int)Bytes[15];
+
+	*IsIPv6=true;
+	for (Index=0; Index<16; Index++)
+	{
+		Key^=Bytes[Index];
+		Key*=16777619u;
+	}
+	ScopeID=(unsigned int)Address->V6.sin6_scope_id;
+	for (Index=0; Index<4; Index++)
+	{
+		Key^=(ScopeID>>(Index*8))&0xFF;
+		Key*=16777619u;
+	}
+	if (Key==0) Key=1;		// 0 means "no partner"
+	return Key;
+}  // CRTP_MIDI::GetAddressKey
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::SameHost (const TRTPMIDIAddress* A, const TRTPMIDIAddress* B)
+{
+	if (A->Generic.sa_family!=B->Generic.sa_family) return false;
+	if (A->Generic.sa_family==AF_INET) return (A->V4.sin_addr.s_addr==B->V4.sin_addr.s_addr);
+	if (A->Generic.sa_family!=AF_INET6) return false;
+	if (memcmp(&A->V6.sin6_addr, &B->V6.sin6_addr, sizeof(in6_addr))!=0) return false;
+	return (A->V6.sin6_scope_id==B->V6.sin6_scope_id);
+}  // CRTP_MIDI::SameHost
+//---------------------------------------------------------------------------
+
+int CRTP_MIDI::GetAddressLength (const TRTPMIDIAddress* Address)
+{
+	if (Address->Generic.sa_family==AF_INET6) return sizeof(sockaddr_in6);
+	return sizeof(sockaddr_in);
+}  // CRTP_MIDI::GetAddressLength
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::MakeIPv4Address (unsigned int IP, int Family, TRTPMIDIAddress* Address)
+{
+	unsigned char* Bytes;
+
+	memset (Address, 0, sizeof(TRTPMIDIAddress));
+	if (Family==AF_INET6)
+	{
+		Address->V6.sin6_family=AF_INET6;
+		Bytes=(unsigned char*)&Address->V6.sin6_addr;
+		memcpy(Bytes, IPv4MappedPrefix, 12);
+		Bytes[12]=(unsigned char)(IP>>24);
+		Bytes[13]=(unsigned char)(IP>>16);
+		Bytes[14]=(unsigned char)(IP>>8);
+		Bytes[15]=(unsigned char)IP;
+	}
+	else
+	{
+		Address->V4.sin_family=AF_INET;
+		Address->V4.sin_addr.s_addr=htonl(IP);
+	}
+}  // CRTP_MIDI::MakeIPv4Address
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::ParseAddress (const char* Text, int Family, TRTPMIDIAddress* Address)
+{
+	addrinfo Hints;
+	addrinfo* Result=0;
+	bool Valid=false;
+
+	memset (&Hints, 0, sizeof(addrinfo));
+	Hints.ai_family=AF_UNSPEC;
+	Hints.ai_socktype=SOCK_DGRAM;
+	Hints.ai_flags=AI_NUMERICHOST;		// Never wait for a name resolution
+	if (getaddrinfo(Text, 0, &Hints, &Result)!=0) return false;
+
+	if (Result->ai_family==AF_INET)
+	{
+		MakeIPv4Address(htonl(((sockaddr_in*)Result->ai_addr)->sin_addr.s_addr), Family, Address);
+		Valid=true;
+	}
+	else if ((Result->ai_family==AF_INET6)&&(Family==AF_INET6))
+	{
+		memset (Address, 0, sizeof(TRTPMIDIAddress));
+		memcpy(&Address->V6, Result->ai_addr, sizeof(sockaddr_in6));
+		Address->V6.sin6_port=0;
+		Valid=true;
+	}
+	freeaddrinfo(Result);
+	return Valid;
+}  // CRTP_MIDI::ParseAddress
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SetAddressPort (TRTPMIDIAddress* Address, unsigned short Port)
+{
+	if (Address->Generic.sa_family==AF_INET6) Address->V6.sin6_port=htons(Port);
+	else Address->V4.sin_port=htons(Port);
+}  // CRTP_MIDI::SetAddressPort
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDI::CreateDualStackSocket (TSOCKTYPE* Socket, unsigned short Port)
+{
+	sockaddr_in6 Local;
+	int V6Only=0;
+
+	*Socket=socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (*Socket==INVALID_SOCKET) return false;
+
+	// IPv4 packets are received with IPv4-mapped addresses
+	setsockopt(*Socket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&V6Only, sizeof(int));
+
+	memset (&Local, 0, sizeof(sockaddr_in6));
+	Local.sin6_family=AF_INET6;
+	Local.sin6_addr=in6addr_any;
+	Local.sin6_port=htons(Port);
+	if (bind(*Socket, (const sockaddr*)&Local, sizeof(sockaddr_in6))!=0)
+	{
+		CloseSocket(Socket);
+		*Socket=INVALID_SOCKET;
+		return false;
+	}
+	return true;
+}  // CRTP_MIDI::CreateDualStackSocket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SetPartner (const TRTPMIDIAddress* Address)
+{
+	if (Address==0)
+	{
+		memset (&PartnerAddress, 0, sizeof(TRTPMIDIAddress));
+		SessionPartnerIP=0;
+		PartnerIPv6=false;
+		return;
+	}
+	PartnerAddress=*Address;
+	SessionPartnerIP=GetAddressKey(Address, &PartnerIPv6);
+}  // CRTP_MIDI::SetPartner
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::GetPartnerAddress (char* Text, unsigned int Size)
+{
+	TRTPMIDIAddress Address;
+	bool IsIPv6;
+	unsigned int Key;
+
+	if (Size==0) return;
+	Text[0]=0;
+	Address=PartnerAddress;		// Local copy, as the partner may change meanwhile
+	Key=GetAddressKey(&Address, &IsIPv6);
+	if (Key==0) return;
+	if ((IsIPv6==false)&&(Address.Generic.sa_family==AF_INET6))
+		MakeIPv4Address(Key, AF_INET, &Address);		// IPv4-mapped address is shown as IPv4
+	if (getnameinfo(&Address.Generic, GetAddressLength(&Address), Text, Size, 0, 0, NI_NUMERICHOST)!=0) Text[0]=0;
+}  // CRTP_MIDI::GetPartnerAddress
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SetSlotSender (TRTPReceiveSlot* Slot)
+{
+	Slot->SenderIP=GetAddressKey(&Slot->SenderAddress, &Slot->SenderIPv6);
+	if (Slot->SenderAddress.Generic.sa_family==AF_INET6) Slot->SenderPort=htons(Slot->SenderAddress.V6.sin6_port);
+	else Slot->SenderPort=htons(Slot->SenderAddress.V4.sin_port);
+}  // CRTP_MIDI::SetSlotSender
+//---------------------------------------------------------------------------
+
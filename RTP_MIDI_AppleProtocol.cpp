@@ -30,22 +30,118 @@
 #include "RTP_MIDI.h"
 #include <stdio.h>
 
+void CRTP_MIDI::UpdatePartnerAddresses (void)
+{
+	if (SessionPartnerIP!=0) PartnerControlAddress=PartnerAddress;
+	else MakeIPv4Address(0, SocketFamily, &PartnerControlAddress);		// No partner yet
+	SetAddressPort(&PartnerControlAddress, PartnerControlPort);
+	PartnerAddressLength=GetAddressLength(&PartnerControlAddress);
+
+	PartnerDataAddress=PartnerControlAddress;
+	SetAddressPort(&PartnerDataAddress, PartnerDataPort);
+}  // CRTP_MIDI::UpdatePartnerAddresses
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::BuildPacketTemplates (void)
+{
+	SessionTemplate.Reserved1=0xFF;
+	SessionTemplate.Reserved2=0xFF;
+	SessionTemplate.CommandH=0;
+	SessionTemplate.CommandL=0;
+	SessionTemplate.ProtocolVersion=htonl(2);
+	SessionTemplate.InitiatorToken=htonl(InitiatorToken);
+	SessionTemplate.SSRC=htonl(SSRC);
+
+	memset (&SyncTemplate, 0, sizeof(TSyncPacket));
+	SyncTemplate.Reserved1=0xFF;
+	SyncTemplate.Reserved2=0xFF;
+	SyncTemplate.CommandH='C';
+	SyncTemplate.CommandL='K';
+	SyncTemplate.SSRC=htonl(SSRC);
+
+	FeedbackTemplate.Reserved1=0xFF;
+	FeedbackTemplate.Reserved2=0xFF;
+	FeedbackTemplate.CommandH='R';
+	FeedbackTemplate.CommandL='S';
+	FeedbackTemplate.SSRC=htonl(SSRC);
+	FeedbackTemplate.SequenceNumber=0;
+	FeedbackTemplate.Unused=0;
+
+	// Write directly value rather than bit coding
+	// Version=2, Padding=0, Extension=0, CSRCCount=0, Marker=1, PayloadType=0x11
+	RTPHeaderTemplate.Code1=0x80;
+	RTPHeaderTemplate.Code2=0x61;
+	RTPHeaderTemplate.SequenceNumber=0;
+	RTPHeaderTemplate.Timestamp=0;
+	RTPHeaderTemplate.SSRC=htonl(SSRC);
+}  // CRTP_MIDI::BuildPacketTemplates
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::ConnectDataSocket (bool Connect)
+{
+	TRTPMIDIAddress NoAddress;
+
+	// Shared sockets receive packets from all the sessions of the manager
+	if ((SharedSockets)||(DataSocket==INVALID_SOCKET)) return;
+
+	if (Connect)
+	{  // Connected UDP socket : no route lookup on each send, and only the partner can reach the socket
+		if (connect(DataSocket, &PartnerDataAddress.Generic, PartnerAddressLength)==0)
+			DataSocketConnected=true;
+		return;
+	}
+
+	if (DataSocketConnected==false) return;
+	memset (&NoAddress, 0, sizeof(TRTPMIDIAddress));
+#if defined (__TARGET_WIN__)
+	NoAddress.Generic.sa_family=SocketFamily;		// Null address removes the connection
+#else
+	NoAddress.Generic.sa_family=AF_UNSPEC;
+#endif
+	connect(DataSocket, &NoAddress.Generic, GetAddressLength(&NoAddress));
+	DataSocketConnected=false;
+}  // CRTP_MIDI::ConnectDataSocket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SendToPartnerData (const void* Packet, int Size)
+{
+	CaptureSent(RTP_CAPTURE_DATA, Packet, Size);
+	if (LocalTransport.IsOpen())
+	{
+		LocalTransport.Send(RTP_LOCAL_DATA, Packet, Size);
+		return;
+	}
+
+	// Some platforms refuse sendto with a destination on a connected socket
+	if (DataSocketConnected)
+		send(DataSocket, (const char*)Packet, Size, 0);
+	else
+		sendto(DataSocket, (const char*)Packet, Size, 0, &PartnerDataAddress.Generic, PartnerAddressLength);
+}  // CRTP_MIDI::SendToPartnerData
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SendToPartnerControl (const void* Packet, int Size)
+{
+	CaptureSent(0, Packet, Size);
+	if (LocalTransport.IsOpen())
+		LocalTransport.Send(RTP_LOCAL_CONTROL, Packet, Size);
+	else
+		sendto(ControlSocket, (const char*)Packet, Size, 0, &PartnerControlAddress.Generic, PartnerAddressLength);
+}  // CRTP_MIDI::SendToPartnerControl
+//---------------------------------------------------------------------------
+
 void CRTP_MIDI::SendInvitation (bool DestControl)
 {
 	// DestControl = true : destination is control port (data port otherwise)
+	// Invitations are only sent by session initiator : partner address is the address to invite
 	TSessionPacket Invit;
-	sockaddr_in AdrEmit;
 	int NameLen;
 
 	NameLen=strlen((char*)&this->SessionName[0]);
-	
-	Invit.Reserved1=0xFF;
-	Invit.Reserved2=0xFF;
+
+	memcpy (&Invit, &SessionTemplate, sizeof(TSessionPacketNoName));
 	Invit.CommandH='I';
 	Invit.CommandL='N';
-	Invit.ProtocolVersion=htonl(2);
-	Invit.InitiatorToken=htonl(this->InitiatorToken);
-	Invit.SSRC=htonl(SSRC);
 
 	if (NameLen>0)  
 	{
@@ -53,53 +149,31 @@ void CRTP_MIDI::SendInvitation (bool DestControl)
 		Invit.Name[NameLen]=0x00;
 		NameLen+=1;
 	}
-	
-	memset (&AdrEmit, 0, sizeof(sockaddr_in));
-	AdrEmit.sin_family=AF_INET;
-	AdrEmit.sin_addr.s_addr=htonl(RemoteIPToInvite);
+
 	if (DestControl)
-	{
-		AdrEmit.sin_port=htons(PartnerControlPort);
-		sendto(ControlSocket, (const char*)&Invit, sizeof(TSessionPacketNoName)+NameLen, 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
-	}
+		SendToPartnerControl(&Invit, sizeof(TSessionPacketNoName)+NameLen);
 	else
-	{
-		AdrEmit.sin_port=htons(PartnerDataPort);
-		sendto(DataSocket, (const char*)&Invit, sizeof(TSessionPacketNoName)+NameLen, 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
-	}
+		SendToPartnerData(&Invit, sizeof(TSessionPacketNoName)+NameLen);
 } // CRTP_MIDI::SendInvitation
 //---------------------------------------------------------------------------
 
 void CRTP_MIDI::SendBYCommand (void)
 {
 	TSessionPacketNoName PacketBY;
-	sockaddr_in AdrEmit;
-	
-	PacketBY.Reserved1=0xFF;
-	PacketBY.Reserved2=0xFF;
+
+	PacketBY=SessionTemplate;
 	PacketBY.CommandH='B';
 	PacketBY.CommandL='Y';
-	PacketBY.ProtocolVersion=htonl(2);
-	PacketBY.InitiatorToken=htonl(InitiatorToken);
-	PacketBY.SSRC=htonl(SSRC);
-	
-	memset (&AdrEmit, 0, sizeof(sockaddr_in));
-	AdrEmit.sin_family=AF_INET;
-	//AdrEmit.sin_addr.s_addr=htonl(RemoteIP);
-	AdrEmit.sin_addr.s_addr=htonl(SessionPartnerIP);
-	AdrEmit.sin_port=htons(PartnerControlPort);
-	sendto(ControlSocket, (const char*)&PacketBY, sizeof(TSessionPacketNoName), 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+	SendToPartnerControl(&PacketBY, sizeof(TSessionPacketNoName));
 } // CRTP_MIDI::SendBYCommand
 //---------------------------------------------------------------------------
 
-void CRTP_MIDI::SendInvitationReply (bool FromControlSocket, bool Accept, unsigned int DestinationIP, unsigned short DestinationPort)
+void CRTP_MIDI::SendInvitationReply (bool FromControlSocket, bool Accept, TRTPMIDIAddress* Destination)
 {
-	TSessionPacket Reply;
-	int Size;
-	sockaddr_in AdrEmit;
-	
-	Reply.Reserved1=0xFF;
-	Reply.Reserved2=0xFF;
+	TSessionPacketNoName Reply;
+
+	// Reply can go to another device than the partner (rejection), so it is sent to the sender of the invitation
+	Reply=SessionTemplate;
 	if (Accept)
 	{
 		Reply.CommandH='O';
@@ -110,24 +184,28 @@ void CRTP_MIDI::SendInvitationReply (bool FromControlSocket, bool Accept, unsign
 		Reply.CommandH='N';
 		Reply.CommandL='O';
 	}
-	Reply.ProtocolVersion=htonl(2);
-	Reply.InitiatorToken=htonl(this->InitiatorToken);
-	Reply.SSRC=htonl(this->SSRC);
 
-	Size=sizeof(TSessionPacketNoName);
-	
-	memset (&AdrEmit, 0, sizeof(sockaddr_in));
-	AdrEmit.sin_family=AF_INET;
-	AdrEmit.sin_addr.s_addr = htonl(DestinationIP);
-	AdrEmit.sin_port = htons(DestinationPort);
+	if ((FromControlSocket==false)&&(DataSocketConnected))
+	{  // Only the partner can reach a connected data socket
+		SendToPartnerData(&Reply, sizeof(TSessionPacketNoName));
+		return;
+	}
+
+	if (LocalTransport.IsOpen())
+	{  // Only the partner can reach the local transport
+		if (FromControlSocket) SendToPartnerControl(&Reply, sizeof(TSessionPacketNoName));
+		else SendToPartnerData(&Reply, sizeof(TSessionPacketNoName));
+		return;
+	}
 
+	CaptureSent(FromControlSocket?0:RTP_CAPTURE_DATA, &Reply, sizeof(TSessionPacketNoName));
 	if (FromControlSocket)
 	{
-		sendto(ControlSocket, (const char*)&Reply, Size, 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+		sendto(ControlSocket, (const char*)&Reply, sizeof(TSessionPacketNoName), 0, &Destination->Generic, GetAddressLength(Destination));
 	}
 	else
 	{
-		sendto(DataSocket, (const char*)&Reply, Size, 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+		sendto(DataSocket, (const char*)&Reply, sizeof(TSessionPacketNoName), 0, &Destination->Generic, GetAddressLength(Destination));
 	}
 }  // CRTP_MIDI::SendInvitationReply
 //---------------------------------------------------------------------------
@@ -135,51 +213,26 @@ void CRTP_MIDI::SendInvitationReply (bool FromControlSocket, bool Accept, unsign
 void CRTP_MIDI::SendSyncPacket (char Count, unsigned int LTS1H, unsigned int LTS1L, unsigned int LTS2H, unsigned int LTS2L, unsigned int LTS3H, unsigned int LTS3L)
 {
 	TSyncPacket Sync;
-	sockaddr_in AdrEmit;
-	
-	Sync.Reserved1=0xFF;
-	Sync.Reserved2=0xFF;
-	Sync.CommandH='C';
-	Sync.CommandL='K';
-	Sync.SSRC=htonl(SSRC);
+
+	Sync=SyncTemplate;
 	Sync.Count=Count;
-	Sync.Unused[0]=0;
-	Sync.Unused[1]=0;
-	Sync.Unused[2]=0;
 	Sync.TS1H=htonl(LTS1H);
 	Sync.TS1L=htonl(LTS1L);
 	Sync.TS2H=htonl(LTS2H);
 	Sync.TS2L=htonl(LTS2L);
 	Sync.TS3H=htonl(LTS3H);
 	Sync.TS3L=htonl(LTS3L);
-	
-	memset (&AdrEmit, 0, sizeof(sockaddr_in));
-	AdrEmit.sin_family=AF_INET;
-	AdrEmit.sin_addr.s_addr=htonl(SessionPartnerIP);
-	AdrEmit.sin_port=htons(PartnerDataPort);
-	sendto(DataSocket, (const char*)&Sync, sizeof(TSyncPacket), 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+	SendToPartnerData(&Sync, sizeof(TSyncPacket));
 }  // CRTP_MIDI::SendSyncPacket
 //---------------------------------------------------------------------------
 
 void CRTP_MIDI::SendFeedbackPacket (unsigned short LastNumber)
 {
 	TFeedbackPacket Feed;
-	sockaddr_in AdrEmit;
-	
-	Feed.Reserved1=0xFF;
-	Feed.Reserved2=0xFF;
-	Feed.CommandH='R';
-	Feed.CommandL='S';
-	Feed.SSRC=htonl(SSRC);
+
+	Feed=FeedbackTemplate;
 	Feed.SequenceNumber=htons(LastNumber);
-	Feed.Unused=0;
-	
-	memset (&AdrEmit, 0, sizeof(sockaddr_in));
-	AdrEmit.sin_family=AF_INET;
-	//AdrEmit.sin_addr.s_addr=htonl(RemoteIP);
-	AdrEmit.sin_addr.s_addr=htonl(SessionPartnerIP);
-	AdrEmit.sin_port=htons(PartnerControlPort);
-	sendto(ControlSocket, (const char*)&Feed, sizeof(TFeedbackPacket), 0, (const sockaddr*)&AdrEmit, sizeof(sockaddr_in));
+	SendToPartnerControl(&Feed, sizeof(TFeedbackPacket));
 }  // CRTP_MIDI::SendFeedbackPacket
 //---------------------------------------------------------------------------
 
@@ -0,0 +1,156 @@
+/*
+ *  RTP_MIDI_BlockQueue.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Lock-free multiple producers / single consumer queue for outgoing MIDI blocks
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Producers reserve cells by a compare and swap on ReservePtr, copy their block
+ then publish it by writing its size in the header of the first reserved cell
+ (release). The consumer reads headers in order (acquire) and stops on the first
+ block which is not committed yet. Headers are cleared before ReadPtr is moved,
+ so a non zero header always means "committed block not yet read".
+ */
+
+#include "RTP_MIDI_BlockQueue.h"
+#include <string.h>
+
+static_assert((MIDI_CHAR_FIFO_SIZE & (MIDI_CHAR_FIFO_SIZE-1)) == 0, "MIDI_CHAR_FIFO_SIZE must be a power of two");
+static_assert(MIDI_CHAR_FIFO_SIZE >= 4*MIDI_BLOCK_CELL_SIZE, "MIDI_CHAR_FIFO_SIZE is too small");
+
+CRTPMIDIBlockQueue::CRTPMIDIBlockQueue(void)
+{
+	Reset();
+}  // CRTPMIDIBlockQueue::CRTPMIDIBlockQueue
+//---------------------------------------------------------------------------
+
+void CRTPMIDIBlockQueue::Reset (void)
+{
+	unsigned int Cell;
+
+	for (Cell=0; Cell<MIDI_BLOCK_CELLS; Cell++)
+		BlockHeader[Cell].store(0, std::memory_order_relaxed);
+	ReservePtr.store(0, std::memory_order_relaxed);
+	ReadPtr.store(0, std::memory_order_release);
+}  // CRTPMIDIBlockQueue::Reset
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIBlockQueue::Push (unsigned int BlockSize, const unsigned char* Block)
+{
+	unsigned int CellCount;
+	unsigned int FirstCell;
+	unsigned int Offset;
+	unsigned int FirstSpan;
+
+	if (BlockSize == 0) return true;
+
+	CellCount = (BlockSize+MIDI_BLOCK_CELL_SIZE-1)/MIDI_BLOCK_CELL_SIZE;
+	if (CellCount > MIDI_BLOCK_CELLS) return false;
+
+	// Reserve room for the whole block
+	FirstCell = ReservePtr.load(std::memory_order_relaxed);
+	do
+	{
+		if (FirstCell+CellCount-ReadPtr.load(std::memory_order_acquire) > MIDI_BLOCK_CELLS) return false;		// FIFO is full
+	} while (!ReservePtr.compare_exchange_weak(FirstCell, FirstCell+CellCount, std::memory_order_relaxed));
+
+	// Copy the block : two spans if it wraps at end of storage
+	Offset = (FirstCell%MIDI_BLOCK_CELLS)*MIDI_BLOCK_CELL_SIZE;
+	FirstSpan = MIDI_CHAR_FIFO_SIZE-Offset;
+	if (FirstSpan >= BlockSize)
+	{
+		memcpy(&Data[Offset], Block, BlockSize);
+	}
+	else
+	{
+		memcpy(&Data[Offset], Block, FirstSpan);
+		memcpy(&Data[0], &Block[FirstSpan], BlockSize-FirstSpan);
+	}
+
+	// Publish the block only when it has been completely copied
+	BlockHeader[FirstCell%MIDI_BLOCK_CELLS].store(BlockSize, std::memory_order_release);
+
+	return true;
+}  // CRTPMIDIBlockQueue::Push
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIBlockQueue::Pop (unsigned char* Dest, unsigned int MaxSize)
+{
+	unsigned int Cell;
+	unsigned int BlockSize;
+	unsigned int Offset;
+	unsigned int FirstSpan;
+	unsigned int Copied = 0;
+
+	Cell = ReadPtr.load(std::memory_order_relaxed);
+	while (true)
+	{
+		BlockSize = BlockHeader[Cell%MIDI_BLOCK_CELLS].load(std::memory_order_acquire);
+		if (BlockSize == 0) break;		// Queue empty or next block still being written
+
+		if (Copied+BlockSize > MaxSize)
+		{
+			if (Copied != 0) break;		// Block will be sent in next packet
+			// Else the block can never fit in a packet : drop it
+		}
+		else
+		{
+			Offset = (Cell%MIDI_BLOCK_CELLS)*MIDI_BLOCK_CELL_SIZE;
+			FirstSpan = MIDI_CHAR_FIFO_SIZE-Offset;
+			if (FirstSpan >= BlockSize)
+			{
+				memcpy(&Dest[Copied], &Data[Offset], BlockSize);
+			}
+			else
+			{
+				memcpy(&Dest[Copied], &Data[Offset], FirstSpan);
+				memcpy(&Dest[Copied+FirstSpan], &Data[0], BlockSize-FirstSpan);
+			}
+			Copied += BlockSize;
+		}
+
+		BlockHeader[Cell%MIDI_BLOCK_CELLS].store(0, std::memory_order_relaxed);
+		Cell += (BlockSize+MIDI_BLOCK_CELL_SIZE-1)/MIDI_BLOCK_CELL_SIZE;
+	}
+
+	// Give room back to producers
+	ReadPtr.store(Cell, std::memory_order_release);
+
+	return Copied;
+}  // CRTPMIDIBlockQueue::Pop
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIBlockQueue::IsEmpty (void)
+{
+	return (ReservePtr.load(std::memory_order_acquire)==ReadPtr.load(std::memory_order_acquire));
+}  // CRTPMIDIBlockQueue::IsEmpty
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIBlockQueue::HeadSize (void)
+{
+	return BlockHeader[ReadPtr.load(std::memory_order_relaxed)%MIDI_BLOCK_CELLS].load(std::memory_order_acquire);
+}  // CRTPMIDIBlockQueue::HeadSize
+//---------------------------------------------------------------------------
@@ -0,0 +1,77 @@
+/*
+ *  RTP_MIDI_BlockQueue.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Lock-free multiple producers / single consumer queue for outgoing MIDI blocks
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_BLOCKQUEUE_H__
+#define __RTP_MIDI_BLOCKQUEUE_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+
+// Size of the byte storage of a block queue (must be a power of two, can be defined on the compiler command line)
+#ifndef MIDI_CHAR_FIFO_SIZE
+#define MIDI_CHAR_FIFO_SIZE		2048
+#endif
+
+// Blocks are stored on a granularity of cells. Each cell can hold the header of one block
+#define MIDI_BLOCK_CELL_SIZE	8
+#define MIDI_BLOCK_CELLS		(MIDI_CHAR_FIFO_SIZE/MIDI_BLOCK_CELL_SIZE)
+
+class CRTPMIDIBlockQueue
+{
+public:
+	CRTPMIDIBlockQueue(void);
+
+	//! Empties the queue. Shall not be called while producers or consumer are running
+	void Reset (void);
+
+	//! Copy a complete block in the queue. Can be called from any number of threads at the same time
+	//! \return false if there is not enough room in the queue for the whole block (nothing is queued in this case)
+	bool Push (unsigned int BlockSize, const unsigned char* Block);
+
+	//! Copy as many complete blocks as possible in Dest, without exceeding MaxSize bytes
+	//! Only one thread may call this method. It never waits on producers : a block being written is left for next call
+	//! A block larger than MaxSize at head of queue can never be sent and is discarded
+	//! \return number of bytes copied in Dest
+	unsigned int Pop (unsigned char* Dest, unsigned int MaxSize);
+
+	//! Returns true if no block is queued (or being queued)
+	bool IsEmpty (void);
+
+	//! Returns the size of the block at head of queue (0 if queue is empty or head block is still being written)
+	unsigned int HeadSize (void);
+
+private:
+	unsigned char Data[MIDI_CHAR_FIFO_SIZE];
+	std::atomic<unsigned int> BlockHeader[MIDI_BLOCK_CELLS];	// Size of the committed block starting in this cell (0 if no block or block not yet committed)
+	std::atomic<unsigned int> ReservePtr;		// Free running cell counter : first cell not yet reserved by producers
+	std::atomic<unsigned int> ReadPtr;			// Free running cell counter : first cell not yet read by consumer
+};
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ *  RTP_MIDI_Capture.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Capture of sent and received datagrams, replay of capture files
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Records are written in a byte ring by the sessions and written to the file
+ by a host thread, so the realtime thread never blocks on file I/O. Records
+ may wrap around the end of the ring : the file is a plain copy of the ring
+ content. Replay feeds the received datagrams of a capture to the packet
+ processing functions, with the session clock set to the capture time of
+ each datagram, so the decoder produces the same callbacks as during the
+ capture.
+ */
+
+#include "RTP_MIDI.h"
+#include "RTP_MIDI_Capture.h"
+#include <string.h>
+
+CRTPMIDICapture::CRTPMIDICapture(unsigned int Size)
+{
+	StorageSize=64;
+	while (StorageSize<Size) StorageSize*=2;
+	Storage=new unsigned char[StorageSize];
+	WritePtr.store(0);
+	ReadPtr.store(0);
+	WriteLock.clear();
+	DroppedCount.store(0);
+}  // CRTPMIDICapture::CRTPMIDICapture
+//---------------------------------------------------------------------------
+
+CRTPMIDICapture::~CRTPMIDICapture(void)
+{
+	delete [] Storage;
+}  // CRTPMIDICapture::~CRTPMIDICapture
+//---------------------------------------------------------------------------
+
+bool CRTPMIDICapture::WriteHeader (FILE* File)
+{
+	TRTPCaptureFileHeader Header;
+
+	Header.Magic=RTP_CAPTURE_MAGIC;
+	Header.Version=RTP_CAPTURE_VERSION;
+	Header.Reserved=0;
+	return (fwrite(&Header, sizeof(TRTPCaptureFileHeader), 1, File)==1);
+}  // CRTPMIDICapture::WriteHeader
+//---------------------------------------------------------------------------
+
+void CRTPMIDICapture::CopyIn (unsigned int Position, const void* Data, unsigned int Size)
+{
+	unsigned int Start=Position&(StorageSize-1);
+	unsigned int First=StorageSize-Start;
+
+	if (First>=Size)
+	{
+		memcpy(&Storage[Start], Data, Size);
+		return;
+	}
+	memcpy(&Storage[Start], Data, First);
+	memcpy(&Storage[0], (const unsigned char*)Data+First, Size-First);
+}  // CRTPMIDICapture::CopyIn
+//---------------------------------------------------------------------------
+
+void CRTPMIDICapture::Record (unsigned int Time, unsigned int Flags, const void* Data, unsigned int Size)
+{
+	TRTPCaptureRecord Header;
+	unsigned int Write;
+	unsigned int Total=sizeof(TRTPCaptureRecord)+Size;
+
+	if (Size>0xFFFF) return;
+	Header.Time=Time;
+	Header.Size=(unsigned short)Size;
+	Header.Flags=(unsigned char)Flags;
+	Header.Reserved=0;
+
+	while (WriteLock.test_and_set(std::memory_order_acquire)) {}
+	Write=WritePtr.load(std::memory_order_relaxed);
+	if (Total>StorageSize-(Write-ReadPtr.load(std::memory_order_acquire)))
+	{
+		WriteLock.clear(std::memory_order_release);
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	CopyIn(Write, &Header, sizeof(TRTPCaptureRecord));
+	CopyIn(Write+sizeof(TRTPCaptureRecord), Data, Size);
+	WritePtr.store(Write+Total, std::memory_order_release);
+	WriteLock.clear(std::memory_order_release);
+}  // CRTPMIDICapture::Record
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDICapture::Flush (FILE* File)
+{
+	unsigned int Read=ReadPtr.load(std::memory_order_relaxed);
+	unsigned int Size=WritePtr.load(std::memory_order_acquire)-Read;
+	unsigned int Start=Read&(StorageSize-1);
+	unsigned int First;
+	unsigned int Written;
+
+	if (Size==0) return 0;
+	First=StorageSize-Start;
+	if (First>Size) First=Size;
+	Written=(unsigned int)fwrite(&Storage[Start], 1, First, File);
+	if ((Written==First)&&(Size>First)) Written+=(unsigned int)fwrite(&Storage[0], 1, Size-First, File);
+	// Bytes which could not be written stay in the buffer for next Flush
+	ReadPtr.store(Read+Written, std::memory_order_release);
+	return Written;
+}  // CRTPMIDICapture::Flush
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDICapture::GetDroppedCount (void)
+{
+	return DroppedCount.load(std::memory_order_relaxed);
+}  // CRTPMIDICapture::GetDroppedCount
+//---------------------------------------------------------------------------
+
+bool CRTPMIDICapture::ReadHeader (FILE* File)
+{
+	TRTPCaptureFileHeader Header;
+
+	if (fread(&Header, sizeof(TRTPCaptureFileHeader), 1, File)!=1) return false;
+	return ((Header.Magic==RTP_CAPTURE_MAGIC)&&(Header.Version==RTP_CAPTURE_VERSION));
+}  // CRTPMIDICapture::ReadHeader
+//---------------------------------------------------------------------------
+
+bool CRTPMIDICapture::ReadRecord (FILE* File, TRTPCaptureRecord* Record, unsigned char* Data, unsigned int MaxSize)
+{
+	unsigned int Size;
+
+	if (fread(Record, sizeof(TRTPCaptureRecord), 1, File)!=1) return false;
+	Size=Record->Size;
+	if (Size>MaxSize)
+	{
+		Record->Size=(unsigned short)MaxSize;
+		if (fread(Data, 1, MaxSize, File)!=MaxSize) return false;
+		return (fseek(File, Size-MaxSize, SEEK_CUR)==0);
+	}
+	return (fread(Data, 1, Size, File)==Size);
+}  // CRTPMIDICapture::ReadRecord
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::SetCapture (CRTPMIDICapture* NewCapture)
+{
+	unsigned char Initiator;
+
+	if ((NewCapture!=0)&&(SessionState!=SESSION_CLOSED))
+	{  // Replay needs the role of the session
+		Initiator=IsInitiatorNode?1:0;
+		NewCapture->Record(TimeCounter, RTP_CAPTURE_SESSION, &Initiator, 1);
+	}
+	this->Capture=NewCapture;
+}  // CRTP_MIDI::SetCapture
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::CaptureReceived (TRTPReceiveSlot* Slot, unsigned int Flags)
+{
+	if (SessionState==SESSION_OPENED) Flags|=RTP_CAPTURE_OPENED;
+	else if (SessionState==SESSION_CLOSING) Flags|=RTP_CAPTURE_CLOSING;
+	if (!IsPartner(Slot)) Flags|=RTP_CAPTURE_OTHER;
+	Capture->Record(TimeCounter, Flags, &Slot->Data[0], Slot->Size);
+}  // CRTP_MIDI::CaptureReceived
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::StartReplay (bool IsInitiator)
+{
+	TRTPMIDIAddress LocalHost;
+
+	CloseSockets();
+	MakeIPv4Address(0x7F000001, AF_INET, &LocalHost);
+	StartSession(&LocalHost, 0, 0, IsInitiator);
+	this->SocketLocked=true;		// RunSession must not run the session during replay
+	this->TimerRunning=false;
+}  // CRTP_MIDI::StartReplay
+//---------------------------------------------------------------------------
+
+void CRTP_MIDI::EndReplayTick (void)
+{
+	if (JitterRing!=0) releasePlayoutEvents();
+	if (SpanMode==RTP_SPAN_PER_TICK) flushEventSpan();
+}  // CRTP_MIDI::EndReplayTick
+//---------------------------------------------------------------------------
+
+int CRTP_MIDI::ReplayCapture (FILE* File)
+{
+	TRTPCaptureRecord Record;
+	TRTPReceiveSlot* Slot;
+	TRTPMIDIAddress LocalHost;
+	CRTPMIDICapture* SavedCapture;
+	bool Started=false;
+	bool Initiator=false;
+	unsigned int Clock=0;
+	int Count=0;
+
+	if (SessionState!=SESSION_CLOSED) return -1;
+	if (CRTPMIDICapture::ReadHeader(File)==false) return -1;
+	AllocateReceiveSlots();
+	ApplyPendingConfig();
+	Slot=&ReceiveSlots[0];
+
+	SavedCapture=this->Capture;
+	this->Capture=0;				// Replayed datagrams are not captured again
+	MakeIPv4Address(0x7F000001, AF_INET, &LocalHost);
+
+	while (CRTPMIDICapture::ReadRecord(File, &Record, &Slot->Data[0], RTP_RECEIVE_SLOT_SIZE))
+	{
+		if (Record.Flags&RTP_CAPTURE_SESSION)
+		{
+			if (Started) EndReplayTick();
+			Initiator=(Slot->Data[0]!=0);
+			StartReplay(Initiator);
+			Started=true;
+			Clock=Record.Time;
+			this->TimeCounter=Clock;
+			this->LocalClock=Clock;
+			continue;
+		}
+		if ((Record.Flags&(RTP_CAPTURE_SENT|RTP_CAPTURE_CLOSING))||(!Started)) continue;
+
+		if (Record.Time!=Clock)
+		{  // Datagrams of the previous tick are complete
+			EndReplayTick();
+			Clock=Record.Time;
+			this->TimeCounter=Clock;
+			this->LocalClock=Clock;
+		}
+
+		// State and partner as they were when the datagram was processed
+		if (Record.Flags&RTP_CAPTURE_OPENED) SessionState=SESSION_OPENED;
+		else if ((SessionState==SESSION_OPENED)||(SessionState==SESSION_CLOSED))
+			SessionState=Initiator?SESSION_CLOCK_SYNC0:SESSION_WAIT_CLOCK_SYNC;
+		if (((Record.Flags&RTP_CAPTURE_OTHER)==0)&&(SessionPartnerIP!=0x7F000001))
+		{  // Partner may have been cleared (BY) or replaced (invitation accepted from another device)
+			SetPartner(&LocalHost);
+			UpdatePartnerAddresses();
+		}
+
+		Slot->Size=Record.Size;
+		MakeIPv4Address((Record.Flags&RTP_CAPTURE_OTHER)?0x7F000002:0x7F000001, AF_INET, &Slot->SenderAddress);
+		SetSlotSender(Slot);
+		if (Record.Flags&RTP_CAPTURE_DATA)
+			ProcessDataPacket(Slot, &InvitationAcceptedOnData, &InvitationRejectedOnData);
+		else
+			ProcessControlPacket(Slot, &InvitationAcceptedOnCtrl, &InvitationRejectedOnCtrl);
+		Count++;
+	}
+	if (Started) EndReplayTick();
+
+	this->SessionState=SESSION_CLOSED;
+	SetPartner(0);
+	this->Capture=SavedCapture;
+	return Count;
+}  // CRTP_MIDI::ReplayCapture
+//---------------------------------------------------------------------------
+
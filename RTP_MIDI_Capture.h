@@ -0,0 +1,102 @@
+/*
+ *  RTP_MIDI_Capture.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Capture of sent and received datagrams, replay of capture files
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_CAPTURE_H__
+#define __RTP_MIDI_CAPTURE_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+#include <stdio.h>
+
+// Capture file : TRTPCaptureFileHeader, then records (TRTPCaptureRecord followed by Size bytes). Values are in host byte order
+#define RTP_CAPTURE_MAGIC			0x43505452		// "RTPC" on little endian hosts
+#define RTP_CAPTURE_VERSION			1
+
+// Record flags
+#define RTP_CAPTURE_SENT			0x01	// Datagram sent by the session (otherwise received)
+#define RTP_CAPTURE_DATA			0x02	// Data socket (otherwise control socket)
+#define RTP_CAPTURE_OPENED			0x04	// Received while the session was opened
+#define RTP_CAPTURE_OTHER			0x08	// Received from another device than the session partner
+#define RTP_CAPTURE_SESSION			0x10	// Session start (or capture started on a running session) : one byte, 1 if session initiator
+#define RTP_CAPTURE_CLOSING			0x20	// Received after the session sent BY (ignored by the session)
+
+typedef struct {
+	unsigned int Magic;
+	unsigned short Version;
+	unsigned short Reserved;
+} TRTPCaptureFileHeader;
+
+typedef struct {
+	unsigned int Time;				// Session clock (TimeCounter, 1/10 ms) when the datagram was sent or processed
+	unsigned short Size;
+	unsigned char Flags;
+	unsigned char Reserved;
+} TRTPCaptureRecord;
+
+class CRTPMIDICapture
+{
+public:
+	//! Size is the size of the buffer in bytes (rounded up to a power of two). Memory is allocated here, never by the realtime thread
+	CRTPMIDICapture(unsigned int Size);
+	~CRTPMIDICapture(void);
+
+	//! Writes the header of a capture file. Must be called once before the first Flush
+	static bool WriteHeader (FILE* File);
+
+	//! Producer (session sending or receiving a datagram) : appends a record to the buffer
+	//! Record is dropped (and counted) if there is not enough room in the buffer
+	void Record (unsigned int Time, unsigned int Flags, const void* Data, unsigned int Size);
+
+	//! Consumer (non realtime thread) : appends the records waiting in the buffer to File
+	//! \return number of bytes written. Bytes which can not be written (disk full...) stay in the buffer
+	unsigned int Flush (FILE* File);
+
+	//! Returns the number of records dropped because the buffer was full
+	unsigned int GetDroppedCount (void);
+
+	//! Checks the header of a capture file. \return false if this is not a capture file
+	static bool ReadHeader (FILE* File);
+
+	//! Reads next record of a capture file. Datagrams larger than MaxSize are truncated
+	//! \return false at end of file
+	static bool ReadRecord (FILE* File, TRTPCaptureRecord* Record, unsigned char* Data, unsigned int MaxSize);
+
+private:
+	unsigned char* Storage;
+	unsigned int StorageSize;						// Power of two
+	std::atomic<unsigned int> WritePtr;				// Free running byte counters
+	std::atomic<unsigned int> ReadPtr;
+	std::atomic_flag WriteLock;						// Only contended when a datagram is sent from another thread than RunSession (CloseSession)
+	std::atomic<unsigned int> DroppedCount;
+
+	void CopyIn (unsigned int Position, const void* Data, unsigned int Size);
+};
+
+#endif
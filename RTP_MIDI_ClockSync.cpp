@@ -0,0 +1,176 @@
+/*
+ *  RTP_MIDI_ClockSync.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Clock offset, round trip time and skew estimation from CK exchanges
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Each CK exchange gives three timestamps : T1 (CK0) and T3 (CK1 reception)
+ from the initiator clock, T2 (CK1) from the responder clock. Assuming a
+ symmetric path, the responder clock reads T2 when the initiator clock reads
+ (T1+T3)/2, and T3-T1 is the round trip time.
+ Queueing delays only make the round trip longer, so the sample with the
+ smallest round trip time in the last exchanges gives the best offset. The
+ skew is the slope of this offset over time, measured against the first
+ estimate.
+ */
+
+#include "RTP_MIDI_ClockSync.h"
+
+CRTPMIDIClockSync::CRTPMIDIClockSync(void)
+{
+	PublishSequence.store(0, std::memory_order_relaxed);
+	Reset();
+}  // CRTPMIDIClockSync::CRTPMIDIClockSync
+//---------------------------------------------------------------------------
+
+void CRTPMIDIClockSync::Reset (void)
+{
+	WindowCount=0;
+	WindowPos=0;
+	ReferenceValid=false;
+	SkewPPM=0;
+	Estimate.Offset=0;
+	Estimate.RoundTrip=0xFFFFFFFF;
+	Estimate.Time=0;
+	PublishEstimate();
+
+	InfoOffset.store(0, std::memory_order_relaxed);
+	InfoRoundTrip.store(0xFFFFFFFF, std::memory_order_relaxed);
+	InfoSkew.store(0, std::memory_order_relaxed);
+	InfoSamples.store(0, std::memory_order_release);
+}  // CRTPMIDIClockSync::Reset
+//---------------------------------------------------------------------------
+
+void CRTPMIDIClockSync::AddSample (unsigned long long T1, unsigned long long T2, unsigned long long T3, bool LocalIsInitiator, unsigned long long LocalTime)
+{
+	TClockSyncSample* Sample;
+	long long DoubleOffset;
+	unsigned int Index;
+	unsigned long long Span;
+
+	if (T3<T1) return;		// Corrupted exchange
+
+	// Responder clock minus initiator clock, computed on doubled values to keep the half unit before rounding
+	DoubleOffset=(long long)(2*T2)-(long long)(T1+T3);
+	if (LocalIsInitiator==false) DoubleOffset=-DoubleOffset;
+
+	Sample=&Window[WindowPos];
+	Sample->Offset=(DoubleOffset>=0)?(DoubleOffset+1)/2:-((-DoubleOffset+1)/2);
+	Sample->RoundTrip=(T3-T1>0xFFFFFFFEull)?0xFFFFFFFE:(unsigned int)(T3-T1);
+	Sample->Time=LocalTime;
+	WindowPos=(WindowPos+1)%RTP_CLOCK_SYNC_WINDOW;
+	if (WindowCount<RTP_CLOCK_SYNC_WINDOW) WindowCount++;
+
+	// Minimum round trip filter
+	Estimate=Window[0];
+	for (Index=1; Index<WindowCount; Index++)
+	{
+		if (Window[Index].RoundTrip<Estimate.RoundTrip) Estimate=Window[Index];
+	}
+
+	if (ReferenceValid==false)
+	{
+		Reference=Estimate;
+		ReferenceValid=true;
+	}
+	else if (Estimate.Time>Reference.Time)
+	{
+		Span=Estimate.Time-Reference.Time;
+		if (Span>=RTP_CLOCK_SKEW_MIN_SPAN)
+			SkewPPM=((Estimate.Offset-Reference.Offset)*1000000)/(long long)Span;
+	}
+	PublishEstimate();
+
+	InfoOffset.store((int)PredictOffset(LocalTime), std::memory_order_relaxed);
+	InfoRoundTrip.store(Estimate.RoundTrip, std::memory_order_relaxed);
+	InfoSkew.store((int)SkewPPM, std::memory_order_relaxed);
+	InfoSamples.fetch_add(1, std::memory_order_release);
+}  // CRTPMIDIClockSync::AddSample
+//---------------------------------------------------------------------------
+
+long long CRTPMIDIClockSync::PredictOffset (unsigned long long LocalTime)
+{
+	if (WindowCount==0) return 0;
+	if (LocalTime<=Estimate.Time) return Estimate.Offset;
+	return Estimate.Offset+(SkewPPM*(long long)(LocalTime-Estimate.Time))/1000000;
+}  // CRTPMIDIClockSync::PredictOffset
+//---------------------------------------------------------------------------
+
+void CRTPMIDIClockSync::PublishEstimate (void)
+{
+	unsigned int Sequence;
+
+	// Single writer (the thread calling AddSample) : readers retry while the sequence is odd or has changed
+	Sequence=PublishSequence.load(std::memory_order_relaxed);
+	PublishSequence.store(Sequence+1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	PublishOffset.store(Estimate.Offset, std::memory_order_relaxed);
+	PublishTime.store(Estimate.Time, std::memory_order_relaxed);
+	PublishSkew.store(SkewPPM, std::memory_order_relaxed);
+	PublishSequence.store(Sequence+2, std::memory_order_release);
+}  // CRTPMIDIClockSync::PublishEstimate
+//---------------------------------------------------------------------------
+
+long long CRTPMIDIClockSync::GetOffset (unsigned int LocalTime)
+{
+	unsigned int Sequence;
+	long long Offset;
+	unsigned long long Time;
+	long long Skew;
+	int Elapsed;
+
+	do
+	{
+		Sequence=PublishSequence.load(std::memory_order_acquire);
+		Offset=PublishOffset.load(std::memory_order_relaxed);
+		Time=PublishTime.load(std::memory_order_relaxed);
+		Skew=PublishSkew.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((Sequence&1)||(Sequence!=PublishSequence.load(std::memory_order_relaxed)));
+
+	// Wrap around of 32 bits times is handled by modulo arithmetic
+	Elapsed=(int)(LocalTime-(unsigned int)Time);
+	if (Elapsed<=0) return Offset;
+	return Offset+(Skew*(long long)Elapsed)/1000000;
+}  // CRTPMIDIClockSync::GetOffset
+//---------------------------------------------------------------------------
+
+void CRTPMIDIClockSync::GetInfo (TRTPMIDIClockInfo* Info)
+{
+	Info->Samples=InfoSamples.load(std::memory_order_acquire);
+	Info->Valid=(Info->Samples>0);
+	Info->Offset=InfoOffset.load(std::memory_order_relaxed);
+	Info->RoundTrip=InfoRoundTrip.load(std::memory_order_relaxed);
+	Info->Skew=InfoSkew.load(std::memory_order_relaxed);
+}  // CRTPMIDIClockSync::GetInfo
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIClockSync::IsValid (void)
+{
+	return (InfoSamples.load(std::memory_order_acquire)>0);
+}  // CRTPMIDIClockSync::IsValid
+//---------------------------------------------------------------------------
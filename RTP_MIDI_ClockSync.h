@@ -0,0 +1,110 @@
+/*
+ *  RTP_MIDI_ClockSync.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Clock offset, round trip time and skew estimation from CK exchanges
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_CLOCKSYNC_H__
+#define __RTP_MIDI_CLOCKSYNC_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+
+// Number of CK exchanges kept by the minimum round trip filter
+#define RTP_CLOCK_SYNC_WINDOW		8
+
+// Minimum time (1/10 ms) between the reference and current estimates to compute the skew (10 seconds)
+#define RTP_CLOCK_SKEW_MIN_SPAN		100000
+
+typedef struct {
+	bool Valid;					// At least one CK exchange has been completed
+	int Offset;					// Partner clock minus local clock (1/10 ms)
+	unsigned int RoundTrip;		// Smallest round trip time of the last RTP_CLOCK_SYNC_WINDOW exchanges (1/10 ms)
+	int Skew;					// Partner clock drift relative to local clock (ppm, positive when partner clock is faster)
+	unsigned int Samples;		// Number of CK exchanges used since the session started
+} TRTPMIDIClockInfo;
+
+typedef struct {
+	long long Offset;
+	unsigned int RoundTrip;
+	unsigned long long Time;	// Local time of the exchange
+} TClockSyncSample;
+
+class CRTPMIDIClockSync
+{
+public:
+	CRTPMIDIClockSync(void);
+
+	//! Forgets all samples (new session)
+	void Reset (void);
+
+	//! Adds the timestamps of a complete CK exchange (64 bits, 1/10 ms)
+	//! \param T1 CK0 time and T3 CK2 time (initiator clock), T2 CK1 time (responder clock)
+	//! \param LocalIsInitiator true if local clock is the initiator clock
+	//! \param LocalTime local time at which the exchange is completed
+	void AddSample (unsigned long long T1, unsigned long long T2, unsigned long long T3, bool LocalIsInitiator, unsigned long long LocalTime);
+
+	//! Returns the estimated offset (partner clock minus local clock) at a given local time, including skew since last estimate
+	//! Only the thread calling AddSample may call this method
+	long long PredictOffset (unsigned long long LocalTime);
+
+	//! Same as PredictOffset, computed from the published estimate. Can be called from any thread
+	//! \param LocalTime low 32 bits of the local clock, extended from the time of the estimate
+	long long GetOffset (unsigned int LocalTime);
+
+	//! Copies the current estimates. Can be called from any thread
+	void GetInfo (TRTPMIDIClockInfo* Info);
+
+	//! At least one CK exchange has been completed. Can be called from any thread
+	bool IsValid (void);
+
+private:
+	void PublishEstimate (void);
+
+	TClockSyncSample Window[RTP_CLOCK_SYNC_WINDOW];
+	unsigned int WindowCount;
+	unsigned int WindowPos;
+
+	TClockSyncSample Estimate;			// Sample with the smallest round trip time in the window
+	TClockSyncSample Reference;			// First estimate, used to measure the skew
+	bool ReferenceValid;
+	long long SkewPPM;
+
+	// Copies of the estimates for other threads
+	std::atomic<int> InfoOffset;
+	std::atomic<unsigned int> InfoRoundTrip;
+	std::atomic<int> InfoSkew;
+	std::atomic<unsigned int> InfoSamples;
+
+	// Estimate and skew published for GetOffset. Sequence is odd while the values are written
+	std::atomic<unsigned int> PublishSequence;
+	std::atomic<long long> PublishOffset;
+	std::atomic<unsigned long long> PublishTime;
+	std::atomic<long long> PublishSkew;
+};
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ *  RTP_MIDI_EventLoop.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Event driven processing of sessions (no 1ms polling thread)
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Rather than running every session each millisecond, the loop sleeps in
+ epoll_wait (Linux) or poll (MacOS, WSAPoll on Windows) on the sockets of all
+ endpoints. The sleep duration is the shortest time before a session timer
+ event (invitation, synchronization, feedback) as given by GetTimeToNextEvent.
+ An endpoint is run only when one of its sockets is readable, when its next
+ event is due or when MIDI data has been queued (SendRTPMIDIBlock wakes the
+ loop by sending a datagram to a loopback socket).
+ Sessions use the OS clock (RTP_CLOCK_SYSTEM), so timers and timestamps stay
+ correct whatever the time between two RunSession calls is.
+ */
+
+#include "RTP_MIDI_EventLoop.h"
+#include <string.h>
+
+#if defined (__TARGET_LINUX__)
+#include <unistd.h>
+#endif
+
+#define WAKE_ENDPOINT_INDEX		0xFFFFFFFF
+
+CRTP_MIDIEventLoop::CRTP_MIDIEventLoop(unsigned int MaxEndpoints)
+{
+#if defined (__TARGET_MAC__)
+	socklen_t AddressLen;
+#endif
+#if defined (__TARGET_LINUX__)
+	socklen_t AddressLen;
+#endif
+#if defined (__TARGET_WIN__)
+	int AddressLen;
+#endif
+
+	if (MaxEndpoints==0) MaxEndpoints=1;
+	this->MaxEndpoints=MaxEndpoints;
+	this->NumEndpoints=0;
+	Endpoints=new TEventLoopEndpoint[MaxEndpoints];
+	WakePending.store(false);
+
+#if defined (__TARGET_LINUX__)
+	EpollFD=epoll_create1(0);
+	Events=new epoll_event[2*MaxEndpoints+1];
+#else
+#if defined (__TARGET_WIN__)
+	PollSet=new WSAPOLLFD[2*MaxEndpoints+1];
+#else
+	PollSet=new pollfd[2*MaxEndpoints+1];
+#endif
+#endif
+
+	// Loopback socket used by Wake : we send datagrams to ourselves
+	memset(&WakeAddress, 0, sizeof(sockaddr_in));
+	if (CreateUDPSocket(&WakeSocket, 0, false))
+	{
+		AddressLen=sizeof(sockaddr_in);
+		getsockname(WakeSocket, (sockaddr*)&WakeAddress, &AddressLen);
+		WakeAddress.sin_family=AF_INET;
+		WakeAddress.sin_addr.s_addr=htonl(0x7F000001);
+		if (RegisterSocket(WakeSocket, WAKE_ENDPOINT_INDEX)==false)
+			CloseSocket(&WakeSocket);
+	}
+	else WakeSocket=INVALID_SOCKET;
+}  // CRTP_MIDIEventLoop::CRTP_MIDIEventLoop
+//---------------------------------------------------------------------------
+
+CRTP_MIDIEventLoop::~CRTP_MIDIEventLoop(void)
+{
+	while (NumEndpoints>0)
+		RemoveEndpoint(NumEndpoints-1);
+
+	if (WakeSocket!=INVALID_SOCKET)
+		CloseSocket(&WakeSocket);
+
+#if defined (__TARGET_LINUX__)
+	if (EpollFD>=0) close(EpollFD);
+	delete [] Events;
+#else
+	delete [] PollSet;
+#endif
+	delete [] Endpoints;
+}  // CRTP_MIDIEventLoop::~CRTP_MIDIEventLoop
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::IsOpen (void)
+{
+#if defined (__TARGET_LINUX__)
+	if (EpollFD<0) return false;
+#endif
+	return (WakeSocket!=INVALID_SOCKET);
+}  // CRTP_MIDIEventLoop::IsOpen
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::RegisterSocket (TSOCKTYPE Socket, unsigned int Index)
+{
+#if defined (__TARGET_LINUX__)
+	epoll_event Event;
+
+	if (EpollFD<0) return false;
+	memset(&Event, 0, sizeof(epoll_event));
+	Event.events=EPOLLIN;
+	Event.data.u32=Index;
+	// Socket may already be registered (endpoint moved in the table) : update its index
+	if (epoll_ctl(EpollFD, EPOLL_CTL_ADD, Socket, &Event)!=0)
+	{
+		if (epoll_ctl(EpollFD, EPOLL_CTL_MOD, Socket, &Event)!=0) return false;
+	}
+#endif
+	// Poll set is rebuilt before each wait, nothing to do on other platforms
+	return true;
+}  // CRTP_MIDIEventLoop::RegisterSocket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::UnregisterSocket (TSOCKTYPE Socket)
+{
+#if defined (__TARGET_LINUX__)
+	epoll_event Event;
+
+	if (EpollFD>=0) epoll_ctl(EpollFD, EPOLL_CTL_DEL, Socket, &Event);
+#endif
+}  // CRTP_MIDIEventLoop::UnregisterSocket
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::AddEndpoint (CRTP_MIDI* Session, CRTP_MIDISessionManager* Manager, TSOCKTYPE ControlSocket, TSOCKTYPE DataSocket)
+{
+	TEventLoopEndpoint* Endpoint;
+
+	if (NumEndpoints>=MaxEndpoints) return false;
+	if ((ControlSocket==INVALID_SOCKET)||(DataSocket==INVALID_SOCKET)) return false;
+	if (IsOpen()==false) return false;		// Endpoint would never be woken up
+
+	Endpoint=&Endpoints[NumEndpoints];
+	Endpoint->Session=Session;
+	Endpoint->Manager=Manager;
+	Endpoint->ControlSocket=ControlSocket;
+	Endpoint->DataSocket=DataSocket;
+	Endpoint->Deadline=0;
+	Endpoint->DeadlineSet=false;
+	Endpoint->Ready=true;			// Run the endpoint immediately to start its timers
+	if ((RegisterSocket(ControlSocket, NumEndpoints)==false)||(RegisterSocket(DataSocket, NumEndpoints)==false))
+	{
+		UnregisterSocket(ControlSocket);
+		UnregisterSocket(DataSocket);
+		return false;
+	}
+	NumEndpoints++;
+	return true;
+}  // CRTP_MIDIEventLoop::AddEndpoint
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::RemoveEndpoint (unsigned int Index)
+{
+	UnregisterSocket(Endpoints[Index].ControlSocket);
+	UnregisterSocket(Endpoints[Index].DataSocket);
+
+	// Move last endpoint in the free entry
+	NumEndpoints--;
+	if (Index!=NumEndpoints)
+	{
+		Endpoints[Index]=Endpoints[NumEndpoints];
+		RegisterSocket(Endpoints[Index].ControlSocket, Index);
+		RegisterSocket(Endpoints[Index].DataSocket, Index);
+	}
+}  // CRTP_MIDIEventLoop::RemoveEndpoint
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::AddSession (CRTP_MIDI* Session)
+{
+	if (Session==0) return false;
+	if (Session->SharedSockets) return false;		// Session is run by a session manager
+
+	Session->SetClockSource(RTP_CLOCK_SYSTEM);
+	if (AddEndpoint(Session, 0, Session->ControlSocket, Session->DataSocket)==false) return false;
+	Session->WakeLoop=this;
+	return true;
+}  // CRTP_MIDIEventLoop::AddSession
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::AddManager (CRTP_MIDISessionManager* Manager)
+{
+	unsigned int Index;
+
+	if (Manager==0) return false;
+
+	Manager->SetClockSource(RTP_CLOCK_SYSTEM);
+	if (AddEndpoint(0, Manager, Manager->ControlSocket, Manager->DataSocket)==false) return false;
+	for (Index=0; Index<Manager->MaxSessions; Index++)
+		Manager->Sessions[Index].Session->WakeLoop=this;
+	return true;
+}  // CRTP_MIDIEventLoop::AddManager
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::RemoveSession (CRTP_MIDI* Session)
+{
+	unsigned int Index;
+
+	for (Index=0; Index<NumEndpoints; Index++)
+	{
+		if (Endpoints[Index].Session==Session)
+		{
+			Session->WakeLoop=0;
+			RemoveEndpoint(Index);
+			return;
+		}
+	}
+}  // CRTP_MIDIEventLoop::RemoveSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::RemoveManager (CRTP_MIDISessionManager* Manager)
+{
+	unsigned int Index;
+	unsigned int SessionIndex;
+
+	for (Index=0; Index<NumEndpoints; Index++)
+	{
+		if (Endpoints[Index].Manager==Manager)
+		{
+			for (SessionIndex=0; SessionIndex<Manager->MaxSessions; SessionIndex++)
+				Manager->Sessions[SessionIndex].Session->WakeLoop=0;
+			RemoveEndpoint(Index);
+			return;
+		}
+	}
+}  // CRTP_MIDIEventLoop::RemoveManager
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::Wake (void)
+{
+	unsigned char WakeByte=0;
+
+	if (WakeSocket==INVALID_SOCKET) return;
+
+	// Only one wake up datagram is sent until the loop has read it
+	if (WakePending.exchange(true)) return;
+	sendto(WakeSocket, (const char*)&WakeByte, 1, 0, (const sockaddr*)&WakeAddress, sizeof(sockaddr_in));
+}  // CRTP_MIDIEventLoop::Wake
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::DrainWakeSocket (void)
+{
+	unsigned char Buffer[16];
+
+	WakePending.store(false);		// Clear before reading, so a Wake which happens now is not lost
+	while (DataAvail(WakeSocket, 0))
+	{
+		recvfrom(WakeSocket, (char*)&Buffer[0], sizeof(Buffer), 0, 0, 0);
+	}
+}  // CRTP_MIDIEventLoop::DrainWakeSocket
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDIEventLoop::WaitSockets (unsigned int Timeout)
+{
+	bool Woken=false;
+	int EventCount;
+	int Event;
+	unsigned int Index;
+
+#if defined (__TARGET_LINUX__)
+	EventCount=epoll_wait(EpollFD, Events, 2*MaxEndpoints+1, (int)Timeout);
+	for (Event=0; Event<EventCount; Event++)
+	{
+		Index=Events[Event].data.u32;
+		if (Index==WAKE_ENDPOINT_INDEX) Woken=true;
+		else if (Index<NumEndpoints) Endpoints[Index].Ready=true;
+	}
+#else
+	unsigned int NumFD=0;
+
+	for (Index=0; Index<NumEndpoints; Index++)
+	{
+		PollSet[NumFD].fd=Endpoints[Index].ControlSocket;
+		PollSet[NumFD].events=POLLIN;
+		PollSet[NumFD].revents=0;
+		PollSet[NumFD+1].fd=Endpoints[Index].DataSocket;
+		PollSet[NumFD+1].events=POLLIN;
+		PollSet[NumFD+1].revents=0;
+		NumFD+=2;
+	}
+	if (WakeSocket!=INVALID_SOCKET)
+	{
+		PollSet[NumFD].fd=WakeSocket;
+		PollSet[NumFD].events=POLLIN;
+		PollSet[NumFD].revents=0;
+		NumFD++;
+	}
+
+#if defined (__TARGET_WIN__)
+	EventCount=WSAPoll(PollSet, NumFD, (int)Timeout);
+#else
+	EventCount=poll(PollSet, NumFD, (int)Timeout);
+#endif
+	if (EventCount>0)
+	{
+		for (Event=0; Event<(int)(2*NumEndpoints); Event++)
+		{
+			if (PollSet[Event].revents!=0) Endpoints[Event/2].Ready=true;
+		}
+		if ((WakeSocket!=INVALID_SOCKET)&&(PollSet[NumFD-1].revents!=0)) Woken=true;
+	}
+#endif
+
+	if (Woken) DrainWakeSocket();
+	return Woken;
+}  // CRTP_MIDIEventLoop::WaitSockets
+//---------------------------------------------------------------------------
+
+void CRTP_MIDIEventLoop::RunOnce (unsigned int MaxWait)
+{
+	unsigned int Index;
+	unsigned int Now;
+	unsigned int Timeout;
+	unsigned int NextEvent;
+	bool Woken;
+	bool RunEndpoint;
+	TEventLoopEndpoint* Endpoint;
+
+	// Sleep until the first session event, at most
+	Now=CRTP_MIDI::GetSystemTime();
+	Timeout=MaxWait;
+	for (Index=0; Index<NumEndpoints; Index++)
+	{
+		Endpoint=&Endpoints[Index];
+		if (Endpoint->Session!=0) NextEvent=Endpoint->Session->GetTimeToNextEvent();
+		else NextEvent=Endpoint->Manager->GetTimeToNextEvent();
+
+		Endpoint->DeadlineSet=(NextEvent!=0xFFFFFFFF);
+		if (Endpoint->DeadlineSet)
+		{
+			Endpoint->Deadline=Now+NextEvent*10;
+			if (NextEvent<Timeout) Timeout=NextEvent;
+		}
+		if (Endpoint->Ready) Timeout=0;
+	}
+
+	Woken=WaitSockets(Timeout);
+
+	// Run endpoints which have received data, whose next event is due or which have MIDI data to send
+	Now=CRTP_MIDI::GetSystemTime();
+	for (Index=0; Index<NumEndpoints; Index++)
+	{
+		Endpoint=&Endpoints[Index];
+		RunEndpoint=Endpoint->Ready;
+		if ((!RunEndpoint)&&(Endpoint->DeadlineSet))
+			RunEndpoint=((int)(Now-Endpoint->Deadline)>=0);
+		if ((!RunEndpoint)&&(Woken))
+		{
+			if (Endpoint->Session!=0) RunEndpoint=(Endpoint->Session->GetTimeToNextEvent()==0);
+			else RunEndpoint=(Endpoint->Manager->GetTimeToNextEvent()==0);
+		}
+
+		if (RunEndpoint)
+		{
+			Endpoint->Ready=false;
+			if (Endpoint->Session!=0) Endpoint->Session->RunSession();
+			else Endpoint->Manager->RunSession();
+		}
+	}
+}  // CRTP_MIDIEventLoop::RunOnce
+//---------------------------------------------------------------------------
@@ -0,0 +1,120 @@
+/*
+ *  RTP_MIDI_EventLoop.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Event driven processing of sessions (no 1ms polling thread)
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_EVENTLOOP_H__
+#define __RTP_MIDI_EVENTLOOP_H__
+//---------------------------------------------------------------------------
+
+#include "RTP_MIDI.h"
+#include "RTP_MIDI_SessionManager.h"
+
+#if defined (__TARGET_LINUX__)
+#include <sys/epoll.h>
+#endif
+#if defined (__TARGET_MAC__)
+#include <poll.h>
+#endif
+
+typedef struct {
+	CRTP_MIDI* Session;					// Endpoint is either a single session...
+	CRTP_MIDISessionManager* Manager;	// ... or a session manager
+	TSOCKTYPE ControlSocket;
+	TSOCKTYPE DataSocket;
+	unsigned int Deadline;				// System time (100us) at which next session event is due
+	bool DeadlineSet;
+	bool Ready;							// One of the sockets has received data
+} TEventLoopEndpoint;
+
+class CRTP_MIDIEventLoop
+{
+public:
+	//! \param MaxEndpoints maximum number of sessions and session managers which can be added to the loop
+	CRTP_MIDIEventLoop(unsigned int MaxEndpoints);
+	~CRTP_MIDIEventLoop(void);
+
+	//! \return false if the loop could not be created (epoll instance or wake up socket not available)
+	//! Sessions and managers can not be added to a loop which is not opened
+	bool IsOpen (void);
+
+	//! Adds a session to the loop. The session must have been initiated (InitiateSession) before
+	//! Session clock is switched to RTP_CLOCK_SYSTEM, since RunSession is no longer called every millisecond
+	//! \return false if the loop is full or not opened
+	bool AddSession (CRTP_MIDI* Session);
+
+	//! Adds a session manager to the loop. The manager sockets must be opened before
+	bool AddManager (CRTP_MIDISessionManager* Manager);
+
+	//! Removes a session or a session manager from the loop
+	void RemoveSession (CRTP_MIDI* Session);
+	void RemoveManager (CRTP_MIDISessionManager* Manager);
+
+	//! Waits until a packet is received, a session timer elapses, MIDI data is queued or MaxWait (ms) elapses
+	//! then runs the sessions which have something to do. Call it in a loop from a dedicated thread
+	//! Add/Remove methods shall not be called while RunOnce is running
+	void RunOnce (unsigned int MaxWait);
+
+	//! Makes RunOnce return immediately. Can be called from any thread (called by SendRTPMIDIBlock)
+	void Wake (void);
+
+private:
+	unsigned int MaxEndpoints;
+	unsigned int NumEndpoints;
+	TEventLoopEndpoint* Endpoints;
+
+	TSOCKTYPE WakeSocket;				// Loopback socket receiving wake up datagrams
+	sockaddr_in WakeAddress;
+	std::atomic<bool> WakePending;		// A wake up datagram has been sent and not yet read
+
+#if defined (__TARGET_LINUX__)
+	int EpollFD;
+	epoll_event* Events;
+#else
+#if defined (__TARGET_WIN__)
+	WSAPOLLFD* PollSet;
+#else
+	pollfd* PollSet;
+#endif
+#endif
+
+	//! \return false if the socket can not be watched by the loop
+	bool RegisterSocket (TSOCKTYPE Socket, unsigned int Index);
+	void UnregisterSocket (TSOCKTYPE Socket);
+	bool AddEndpoint (CRTP_MIDI* Session, CRTP_MIDISessionManager* Manager, TSOCKTYPE ControlSocket, TSOCKTYPE DataSocket);
+	void RemoveEndpoint (unsigned int Index);
+
+	//! Waits for socket activity during Timeout ms at most and marks the ready endpoints
+	//! \return true if the loop has been woken up by Wake
+	bool WaitSockets (unsigned int Timeout);
+
+	//! Reads the pending wake up datagrams
+	void DrainWakeSocket (void);
+};
+
+#endif
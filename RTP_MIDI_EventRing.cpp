@@ -0,0 +1,151 @@
+/*
+ *  RTP_MIDI_EventRing.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Single producer / single consumer ring for decoded incoming MIDI events
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Records are always contiguous in storage, so the consumer can read them in
+ place : when a record does not fit before the end of storage, a padding
+ record is written and the record starts again at beginning of storage.
+ The producer publishes a record by moving WritePtr (release), the consumer
+ frees it by moving ReadPtr (release). There is no other shared state.
+ */
+
+#include "RTP_MIDI_EventRing.h"
+#include <string.h>
+
+// Record header (followed by the MIDI bytes)
+typedef struct {
+	unsigned int Timestamp;
+	unsigned int Length;		// RTP_RING_PADDING : rest of storage is not used, next record is at beginning
+} TRingRecordHeader;
+
+#define RTP_RING_PADDING		0xFFFFFFFF
+
+static_assert(sizeof(TRingRecordHeader)==RTP_RING_ALIGN, "Ring record header must be RTP_RING_ALIGN bytes");
+
+CRTPMIDIEventRing::CRTPMIDIEventRing(unsigned int Size)
+{
+	StorageSize=RTP_RING_ALIGN*4;
+	while (StorageSize<Size) StorageSize<<=1;
+	Storage=new unsigned char[StorageSize];
+
+	WritePtr.store(0, std::memory_order_relaxed);
+	ReadPtr.store(0, std::memory_order_relaxed);
+	DroppedCount.store(0, std::memory_order_relaxed);
+	PeekSize=0;
+}  // CRTPMIDIEventRing::CRTPMIDIEventRing
+//---------------------------------------------------------------------------
+
+CRTPMIDIEventRing::~CRTPMIDIEventRing(void)
+{
+	if (Storage!=0) delete[] Storage;
+}  // CRTPMIDIEventRing::~CRTPMIDIEventRing
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIEventRing::Write (const unsigned char* Data, unsigned int Length, unsigned int Timestamp)
+{
+	unsigned int Write;
+	unsigned int Read;
+	unsigned int RecordSize;
+	unsigned int Offset;
+	unsigned int Padding=0;
+	TRingRecordHeader* Header;
+
+	RecordSize=(sizeof(TRingRecordHeader)+Length+RTP_RING_ALIGN-1)&~(RTP_RING_ALIGN-1);
+	Write=WritePtr.load(std::memory_order_relaxed);
+	Read=ReadPtr.load(std::memory_order_acquire);
+	Offset=Write&(StorageSize-1);
+
+	// Record does not fit before end of storage : it will start at beginning, after a padding record
+	if (Offset+RecordSize>StorageSize) Padding=StorageSize-Offset;
+
+	if ((Write-Read)+Padding+RecordSize>StorageSize)
+	{
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	if (Padding!=0)
+	{
+		Header=(TRingRecordHeader*)&Storage[Offset];
+		Header->Timestamp=0;
+		Header->Length=RTP_RING_PADDING;
+		Offset=0;
+	}
+
+	Header=(TRingRecordHeader*)&Storage[Offset];
+	Header->Timestamp=Timestamp;
+	Header->Length=Length;
+	memcpy(&Storage[Offset+sizeof(TRingRecordHeader)], Data, Length);
+
+	WritePtr.store(Write+Padding+RecordSize, std::memory_order_release);
+	return true;
+}  // CRTPMIDIEventRing::Write
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIEventRing::Peek (TRTPMIDIRingEvent* Event)
+{
+	unsigned int Read;
+	unsigned int Write;
+	TRingRecordHeader* Header;
+
+	Read=ReadPtr.load(std::memory_order_relaxed);
+	Write=WritePtr.load(std::memory_order_acquire);
+	if (Read==Write) return false;
+
+	Header=(TRingRecordHeader*)&Storage[Read&(StorageSize-1)];
+	if (Header->Length==RTP_RING_PADDING)
+	{  // Skip end of storage
+		Read+=StorageSize-(Read&(StorageSize-1));
+		ReadPtr.store(Read, std::memory_order_release);
+		if (Read==Write) return false;
+		Header=(TRingRecordHeader*)&Storage[0];
+	}
+
+	Event->Timestamp=Header->Timestamp;
+	Event->Length=Header->Length;
+	Event->Data=(unsigned char*)Header+sizeof(TRingRecordHeader);
+	PeekSize=(sizeof(TRingRecordHeader)+Header->Length+RTP_RING_ALIGN-1)&~(RTP_RING_ALIGN-1);
+	return true;
+}  // CRTPMIDIEventRing::Peek
+//---------------------------------------------------------------------------
+
+void CRTPMIDIEventRing::Release (void)
+{
+	if (PeekSize==0) return;
+	ReadPtr.store(ReadPtr.load(std::memory_order_relaxed)+PeekSize, std::memory_order_release);
+	PeekSize=0;
+}  // CRTPMIDIEventRing::Release
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIEventRing::GetDroppedCount (void)
+{
+	return DroppedCount.load(std::memory_order_relaxed);
+}  // CRTPMIDIEventRing::GetDroppedCount
+//---------------------------------------------------------------------------
+
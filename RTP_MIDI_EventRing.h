@@ -0,0 +1,77 @@
+/*
+ *  RTP_MIDI_EventRing.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Single producer / single consumer ring for decoded incoming MIDI events
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_EVENTRING_H__
+#define __RTP_MIDI_EVENTRING_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+
+// Each event is stored as a header followed by the MIDI bytes, rounded up to RTP_RING_ALIGN bytes
+#define RTP_RING_ALIGN			8
+
+// Event read in place from the ring (Data points inside the ring storage)
+typedef struct {
+	unsigned int Timestamp;
+	unsigned int Length;
+	unsigned char* Data;
+} TRTPMIDIRingEvent;
+
+class CRTPMIDIEventRing
+{
+public:
+	//! Size is the storage size in bytes (rounded up to a power of two). Memory is allocated here, never by the realtime thread
+	CRTPMIDIEventRing(unsigned int Size);
+	~CRTPMIDIEventRing(void);
+
+	//! Producer (decoder, realtime thread) : stores an event
+	//! \return false if there is not enough room (event is dropped and counted)
+	bool Write (const unsigned char* Data, unsigned int Length, unsigned int Timestamp);
+
+	//! Consumer : gets the oldest event without copying it
+	//! \return false if the ring is empty. Event remains valid until Release is called
+	bool Peek (TRTPMIDIRingEvent* Event);
+
+	//! Consumer : frees the event returned by last Peek
+	void Release (void);
+
+	//! Returns the number of events dropped because the ring was full (or event larger than the ring)
+	unsigned int GetDroppedCount (void);
+
+private:
+	unsigned char* Storage;
+	unsigned int StorageSize;						// Power of two
+	std::atomic<unsigned int> WritePtr;				// Free running byte counters
+	std::atomic<unsigned int> ReadPtr;
+	std::atomic<unsigned int> DroppedCount;
+	unsigned int PeekSize;							// Size of the record returned by last Peek (consumer only)
+};
+
+#endif
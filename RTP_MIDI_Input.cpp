@@ -29,35 +29,52 @@
 
 #include "RTP_MIDI.h"
 #include <stdio.h>
-
-unsigned int CRTP_MIDI::GetDeltaTime(unsigned char* BufPtr, int* ByteCtr)
+#include <string.h>
+
+// Size of MIDI messages from their status byte (0 = variable size or not a MIDI message start)
+static const unsigned char MIDIMessageLength[256] = {
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,		// 8x Note Off, 9x Note On
+	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,		// Ax Poly Pressure, Bx Control Change
+	2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,		// Cx Program Change, Dx Channel Pressure
+	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,									// Ex Pitch Bend
+	0,2,3,2,0,0,1,0,1,1,1,1,1,1,1,1										// Fx System (SYSEX handled by state machine)
+};
+
+unsigned int CRTP_MIDI::GetDeltaTime(unsigned char* BufPtr, int* ByteCtr, int TailleBloc)
 {
-	unsigned int value;
-	unsigned int ByteCount;
-	char Data;
-
-	value=(unsigned int)BufPtr[*ByteCtr];
-	*ByteCtr=*ByteCtr+1;
-	ByteCount=1;
+	unsigned int value=0;
+	unsigned int ByteCount=0;
+	unsigned char Data;
 
-	if ((value & 0x80)!=0)
+	// Delta time is coded on 1 to 4 bytes, MSB set on all bytes except the last one
+	do
 	{
-		value=value&0x7F;
-		do
-		{
-			Data=BufPtr[*ByteCtr];
-			*ByteCtr=*ByteCtr+1;
-			ByteCount++;
-			value=(value << 7)+(unsigned int)Data;
-		} while (((Data & 0x80)!=0)&&(ByteCount<=4));
-	}
+		if (*ByteCtr>=TailleBloc) break;		// Truncated delta time : the caller finds the end of list
+		Data=BufPtr[*ByteCtr];
+		*ByteCtr=*ByteCtr+1;
+		ByteCount++;
+		value=(value << 7)|(unsigned int)(Data&0x7F);
+	} while (((Data & 0x80)!=0)&&(ByteCount<4));
 	return value;
 }  // CRTP_MIDI::GetDeltaTime
 //--------------------------------------------------------------------------
 
-void CRTP_MIDI::ProcessIncomingRTP (unsigned char* Buffer)
+void CRTP_MIDI::ProcessIncomingRTP (unsigned char* Buffer, int Size)
 {
 	int CtrByteMIDI=0;
+	int JournalSize;
+	bool JournalPresent;
+	bool PacketLost=false;
+	short SequenceDelta;
+	unsigned short SequenceNumber;
+	unsigned int Transit;
+	unsigned int TransitDelta;
+	unsigned int Jitter;
+	unsigned int Lost;
 	int TailleListeMIDI;
 	bool PresenceFirstDelta;
 	unsigned char* PtrListeMIDI;
@@ -67,9 +84,55 @@ void CRTP_MIDI::ProcessIncomingRTP (unsigned char* Buffer)
 	TLongMIDIRTPMsg* LInputMessage;
 	TShortMIDIRTPMsg* SInputMessage;
 
+	if (Size<(int)sizeof(TRTP_Header)+1) return;
+
 	// Store last RTP counter
 	SInputMessage=(TShortMIDIRTPMsg*)Buffer;
-	LastRTPCounter=htons(SInputMessage->Header.SequenceNumber);
+	SequenceNumber=htons(SInputMessage->Header.SequenceNumber);
+	StatPacketsReceived.fetch_add(1, std::memory_order_relaxed);
+
+	// Interarrival jitter (RFC 3550 A.8) : both clocks are in 1/10 ms
+	Transit=TimeCounter-htonl(SInputMessage->Header.Timestamp);
+	if (SequenceValid)
+	{
+		TransitDelta=Transit-LastTransit;
+		if ((int)TransitDelta<0) TransitDelta=-(int)TransitDelta;
+		Jitter=StatJitter.load(std::memory_order_relaxed);
+		StatJitter.store(Jitter+TransitDelta-((Jitter+8)>>4), std::memory_order_relaxed);
+	}
+	LastTransit=Transit;
+
+	if (SequenceValid)
+	{
+		SequenceDelta=(short)(SequenceNumber-LastRTPCounter);
+		if (SequenceDelta==0)
+		{  // Same packet received twice : do not play it again
+			StatPacketsDuplicated.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (SequenceDelta<0)
+		{  // Late packet : it has been counted as lost
+			StatPacketsReordered.fetch_add(1, std::memory_order_relaxed);
+			Lost=StatPacketsLost.load(std::memory_order_relaxed);
+			if (Lost>0) StatPacketsLost.store(Lost-1, std::memory_order_relaxed);
+			// MIDI state has already been repaired from the journal : playing the packet now would corrupt it
+			if (Journal!=0) return;
+		}
+		else
+		{
+			if (SequenceDelta>1)
+			{
+				StatPacketsLost.fetch_add(SequenceDelta-1, std::memory_order_relaxed);
+				PacketLost=true;
+			}
+			LastRTPCounter=SequenceNumber;		// Keep the highest sequence number received for RS feedback
+		}
+	}
+	else
+	{
+		LastRTPCounter=SequenceNumber;
+		SequenceValid=true;
+	}
 
     //Timestamp=htonl(SInputMessage->Header.Timestamp);
     //printf ("Timestamp: %u\n", Timestamp);
@@ -80,10 +143,12 @@ void CRTP_MIDI::ProcessIncomingRTP (unsigned char* Buffer)
 	// Identify type of RTP MIDI message (short or long) : check B bit in MIDI payload
 	if ((SInputMessage->Payload.Control&0x80)!=0)
 	{  // B=1 : long block
+		if (Size<(int)sizeof(TRTP_Header)+2) return;
 		LInputMessage=(TLongMIDIRTPMsg*)Buffer;
 		LInputMessage->Payload.Control=htons(LInputMessage->Payload.Control);
 		TailleListeMIDI=LInputMessage->Payload.Control&0xFFF;
 		PresenceFirstDelta=((LInputMessage->Payload.Control&LONG_Z_BIT)!=0);
+		JournalPresent=((LInputMessage->Payload.Control&LONG_J_BIT)!=0);
 		PtrListeMIDI=&LInputMessage->Payload.MIDIList[0];
 	}
 	else
@@ -91,37 +156,99 @@ void CRTP_MIDI::ProcessIncomingRTP (unsigned char* Buffer)
 		SInputMessage=(TShortMIDIRTPMsg*)Buffer;
 		TailleListeMIDI=SInputMessage->Payload.Control&0xF;
 		PresenceFirstDelta=((SInputMessage->Payload.Control&SHORT_Z_BIT)!=0);
+		JournalPresent=((SInputMessage->Payload.Control&SHORT_J_BIT)!=0);
 		PtrListeMIDI=&SInputMessage->Payload.MIDIList[0];
 	}
 
+	// Malformed packet : MIDI list can not be longer than the received datagram
+	if (TailleListeMIDI>Size-(int)(PtrListeMIDI-Buffer)) return;
+
+	// Delta times are relative to the packet timestamp : it gives the event time in the sender clock
+	if (JitterRing!=0)
+		PacketEventTime=getPlayoutTime(Transit, htonl(SInputMessage->Header.Timestamp));
+	else if ((SyncedEventTime)&&(ClockSync.IsValid()))
+		PacketEventTime=RemoteToLocalTime(htonl(SInputMessage->Header.Timestamp));
+	else
+		PacketEventTime=LocalClock;
+
+	// Packets have been lost : repair the MIDI state from the journal (placed after MIDI list) before playing this packet
+	if ((PacketLost)&&(JournalPresent)&&(Journal!=0))
+	{
+		JournalSize=Size-(int)(PtrListeMIDI-Buffer)-TailleListeMIDI;
+		if (JournalSize>0)
+			Journal->Recover(&PtrListeMIDI[TailleListeMIDI], JournalSize, JournalRepairCallback, this);
+	}
+
 	if (TailleListeMIDI>0)  // Note : MIDI block can be empty (see protocol specification)
 	{
         DeltaTime=0;
 		// Analyze first MIDI code
 		if (PresenceFirstDelta)
-			DeltaTime=GetDeltaTime(&PtrListeMIDI[0], &CtrByteMIDI);
+			DeltaTime=GetDeltaTime(&PtrListeMIDI[0], &CtrByteMIDI, TailleListeMIDI);
 		if (CtrByteMIDI<TailleListeMIDI)  // The last event can be empty (see chapter 3.0 of spec) !
 		{
-			GenerateMIDIEvent(PtrListeMIDI, &CtrByteMIDI, TailleListeMIDI, DeltaTime+LocalClock);
+			GenerateMIDIEvent(PtrListeMIDI, &CtrByteMIDI, TailleListeMIDI, DeltaTime+PacketEventTime);
 		}
 
 		// Scan data list
 		while (CtrByteMIDI<TailleListeMIDI)
 		{
-			// Jump over the next timestamp
-			DeltaTime=GetDeltaTime(&PtrListeMIDI[0], &CtrByteMIDI);
+			// Jump over the next timestamp (delta time is relative to the previous command)
+			DeltaTime+=GetDeltaTime(&PtrListeMIDI[0], &CtrByteMIDI, TailleListeMIDI);
 			if (CtrByteMIDI<TailleListeMIDI)
 			{
-				GenerateMIDIEvent(PtrListeMIDI, &CtrByteMIDI, TailleListeMIDI, DeltaTime+LocalClock);
+				GenerateMIDIEvent(PtrListeMIDI, &CtrByteMIDI, TailleListeMIDI, DeltaTime+PacketEventTime);
 			}
 		}
 	}
+
+	// Streaming SYSEX : send what has been received in this packet
+	if ((SysExCallback!=0)&&(SYSEX_RTPActif)&&(InSYSEXBufferPtr>0)) sendRTP_SYSEXChunk(0, SysExEventTime);
+
+	if (SpanMode==RTP_SPAN_PER_PACKET) flushEventSpan();
 }  // CRTP_MIDI::ProcessIncomingRTP
 //--------------------------------------------------------------------------
 
+void CRTP_MIDI::InjectRTPPacket (unsigned char* Buffer, int Size)
+{
+	if (Size<(int)sizeof(TRTP_Header)+1) return;
+	if ((Buffer[0]!=0x80)||(Buffer[1]!=0x61)) return;		// Not a RTP-MIDI packet
+
+	ApplyPendingConfig();
+	StatBytesReceived.fetch_add(Size, std::memory_order_relaxed);
+	ProcessIncomingRTP(Buffer, Size);
+}  // CRTP_MIDI::InjectRTPPacket
+//--------------------------------------------------------------------------
+
 void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int TailleBloc, unsigned int LEventTime)
 {
 	unsigned char DataByte;
+	unsigned char Status;
+	unsigned int Length;
+	int Ptr;
+
+	// Fast path : complete channel message (with status byte or running status)
+	if ((SYSEX_RTPActif==false)&&(IncomingThirdByte==false))
+	{
+		Ptr=*ByteCtr;
+		Status=Buffer[Ptr];
+		if (Status&0x80) Ptr++;
+		else Status=RTPRunningStatus;
+		if ((Status>=0x80)&&(Status<0xF0))
+		{
+			Length=MIDIMessageLength[Status];
+			if ((Ptr+(int)Length-1<=TailleBloc)&&(((Buffer[Ptr]|Buffer[Ptr+Length-2])&0x80)==0))
+			{  // Both data bytes are in the block and are real data bytes (second test reads first data byte again for 2 bytes messages)
+				FullInMidiMsg[0]=Status;
+				FullInMidiMsg[1]=Buffer[Ptr];
+				FullInMidiMsg[2]=Buffer[Ptr+Length-2];
+				RTPRunningStatus=Status;
+				*ByteCtr=Ptr+Length-1;
+				sendMIDIToClient(Length, LEventTime);
+				return;
+			}
+		}
+	}
 
 	// Decode event type and record it locally
 	while (*ByteCtr<TailleBloc)  // Safety measure : do not cross the buffer boundary
@@ -136,8 +263,10 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 			// Header F0 received
 			SYSEX_RTPActif=true;
 			SegmentSYSEXInput=true;
+			SysExFiltered=!AcceptStatus(0xF0);		// Filtered SYSEX is decoded to find its end, but never stored
+			SysExEventTime=LEventTime;				// All chunks of the SYSEX are sent with the time of F0
 			storeRTP_SYSEXData (0xF0);  // Store SYSEX byte
-			goto NextByte;
+			continue;
 		}
 
 		if (SYSEX_RTPActif==true)
@@ -146,7 +275,8 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 			{
 				// F0 of end of segment
 				SegmentSYSEXInput=false;
-				goto NextByte;									// Stop decoding of the SYSEX message, a new MIDI message is expected
+				if ((SysExCallback!=0)&&(InSYSEXBufferPtr>0)) sendRTP_SYSEXChunk(0, SysExEventTime);
+				continue;									// Stop decoding of the SYSEX message, a new MIDI message is expected
 			}
 
 			if (DataByte==0xF7)
@@ -163,13 +293,13 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 				{
 					// F7 signalling a start of segment : do not record
 					SegmentSYSEXInput=true;
-					goto NextByte;						// Continue SYSEX decoding
+					continue;						// Continue SYSEX decoding
 				}
 			}
 
 			if (DataByte==0xF4)
 			{  // SYSEX cancellation code
-				initRTP_SYSEXBuffer ();					// Clean SYSEX buffer
+				cancelRTP_SYSEXBuffer (LEventTime);		// Clean SYSEX buffer
 				return;									// Stop decoding of the SYSEX message, a new MIDI message is expected
 			}
 
@@ -179,7 +309,7 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 				if (DataByte<0x80)
 				{
 					storeRTP_SYSEXData (DataByte);  // Store SYSEX data
-					goto NextByte;					// Search next data byte
+					continue;					// Search next data byte
 				}
 
 				if (DataByte>=0xF8)
@@ -187,11 +317,11 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 					// Realtime data in SYSEX : transmit it to client
 					FullInMidiMsg[0]=DataByte;
 					sendMIDIToClient(1, LEventTime);
-					goto NextByte;					// Continue SYSEX decoding
+					continue;					// Continue SYSEX decoding
 				}
 
 				// Any other data (between 0x80 and 0xF6) : corrupted SYSEX (cancel processing)
-				initRTP_SYSEXBuffer();  // Clean SYSEX buffer for next SYSEX message
+				cancelRTP_SYSEXBuffer(LEventTime);  // Clean SYSEX buffer for next SYSEX message
 				// We do not exit here, to process the status byte we just received
 			}
 		}
@@ -237,7 +367,7 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 				// Waiting 3 bytes message
 				IncomingThirdByte=true;
 				FullInMidiMsg[1]=DataByte;
-				goto NextByte;
+				continue;
 			}
 
 			if (RTPRunningStatus<0xE0)
@@ -254,7 +384,7 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 				// Waiting 3 bytes message
 				IncomingThirdByte=true;
 				FullInMidiMsg[1]=DataByte;
-				goto NextByte;
+				continue;
 			}
 
 			if (RTPRunningStatus==0xF2)
@@ -263,7 +393,7 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 				RTPRunningStatus=0;
 				IncomingThirdByte=true;
 				FullInMidiMsg[1]=DataByte;
-				goto NextByte;
+				continue;
 			}
 
 			if ((RTPRunningStatus==0xF1)||(RTPRunningStatus==0xF3))
@@ -279,8 +409,6 @@ void CRTP_MIDI::GenerateMIDIEvent(unsigned char* Buffer, int* ByteCtr, int Taill
 			RTPRunningStatus=0;
 			return;
 		}  // MSB = 0
-	NextByte:
-		;
 	}  // while
 }  // GenerateMIDIEvent
 //--------------------------------------------------------------------------
@@ -291,12 +419,24 @@ void CRTP_MIDI::initRTP_SYSEXBuffer(void)
 	SegmentSYSEXInput=false;
 	SYSEX_RTPActif=false;
 	InSYSEXOverflow=false;
+	SysExChunkSent=false;
+	SysExFiltered=false;
 }  // CRTP_MIDI::initRTP_SYSEXBuffer
 //--------------------------------------------------------------------------
 
 void CRTP_MIDI::storeRTP_SYSEXData (unsigned char SysexData)
 {
-	if (InSYSEXBuffer==0) return;
+	if ((InSYSEXBuffer==0)||(SysExFiltered)) return;
+
+	if (SysExCallback!=0)
+	{  // Streaming : send the full buffer as a chunk
+		if (InSYSEXBufferPtr>=InSYSEXBufferSize) sendRTP_SYSEXChunk(0, SysExEventTime);
+		InSYSEXBuffer[InSYSEXBufferPtr]=SysexData;
+		InSYSEXBufferPtr+=1;
+		return;
+	}
+
+	if ((InSYSEXBufferPtr>=InSYSEXBufferSize-1)&&(SysExPoolMaxSize!=0)) growRTP_SYSEXBuffer();
 
 	InSYSEXBuffer[InSYSEXBufferPtr]=SysexData;
 	if (InSYSEXBufferPtr<InSYSEXBufferSize-1) InSYSEXBufferPtr+=1;
@@ -306,17 +446,215 @@ void CRTP_MIDI::storeRTP_SYSEXData (unsigned char SysexData)
 
 void CRTP_MIDI::sendRTP_SYSEXBuffer (unsigned int LEventTime)
 {
-	if (RTPCallback==0) return;
-
-	RTPCallback(ClientInstance, InSYSEXBufferPtr, &InSYSEXBuffer[0], LEventTime);
+	if (SysExFiltered) return;
+	if (SysExCallback!=0)
+	{
+		sendRTP_SYSEXChunk(RTP_SYSEX_LAST, SysExEventTime);
+		return;
+	}
+	// Through the playout buffer, so the SYSEX is not delivered before the events received before it
+	playoutEvent(InSYSEXBufferPtr, &InSYSEXBuffer[0], LEventTime);
 }  // CRTP_MIDI::sendRTP_SYSEXBuffer
 //--------------------------------------------------------------------------
 
-void CRTP_MIDI::sendMIDIToClient (unsigned int NumBytes, unsigned int LEventTime)
+void CRTP_MIDI::sendRTP_SYSEXChunk (unsigned int Flags, unsigned int LEventTime)
 {
-	if (RTPCallback==0) return;
+	if (SysExChunkSent==false) Flags|=RTP_SYSEX_FIRST;
+	RTP_TRACE_STAMP(CallbackStart);
+	SysExCallback(SysExInstance, InSYSEXBufferPtr, &InSYSEXBuffer[0], Flags, LEventTime);
+	RTP_TRACE_ADD(Trace, RTP_TRACE_CALLBACK, CallbackStart);
+	SysExChunkSent=true;
+	InSYSEXBufferPtr=0;
+}  // CRTP_MIDI::sendRTP_SYSEXChunk
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::cancelRTP_SYSEXBuffer (unsigned int LEventTime)
+{
+	if ((SysExCallback!=0)&&(SysExChunkSent))
+	{  // Client has already received the beginning of the SYSEX
+		InSYSEXBufferPtr=0;
+		RTP_TRACE_STAMP(CallbackStart);
+		SysExCallback(SysExInstance, 0, &InSYSEXBuffer[0], RTP_SYSEX_LAST|RTP_SYSEX_CANCELLED, LEventTime);
+		RTP_TRACE_ADD(Trace, RTP_TRACE_CALLBACK, CallbackStart);
+	}
+	initRTP_SYSEXBuffer();
+}  // CRTP_MIDI::cancelRTP_SYSEXBuffer
+//--------------------------------------------------------------------------
 
-	RTPCallback(ClientInstance, NumBytes, &FullInMidiMsg[0], LEventTime);
+void CRTP_MIDI::growRTP_SYSEXBuffer (void)
+{
+	TSysExPoolBuffer* Spare;
+	unsigned char* OldData;
+	unsigned int OldSize;
+
+	if (SysExRetired.load(std::memory_order_acquire)!=0) return;	// Previous buffer has not been freed yet
+	Spare=SysExSpare.exchange(0, std::memory_order_acq_rel);
+	if (Spare==0) return;
+
+	if (Spare->Size>InSYSEXBufferSize)
+	{  // Copy the beginning of the SYSEX in the larger buffer and swap buffers
+		memcpy(Spare->Data, InSYSEXBuffer, InSYSEXBufferPtr+1);
+		OldData=InSYSEXBuffer;
+		OldSize=InSYSEXBufferSize;
+		InSYSEXBuffer=Spare->Data;
+		InSYSEXBufferSize=Spare->Size;
+		Spare->Data=OldData;
+		Spare->Size=OldSize;
+		SysExPoolCurrentSize.store(InSYSEXBufferSize, std::memory_order_relaxed);
+	}
+	SysExRetired.store(Spare, std::memory_order_release);
+}  // CRTP_MIDI::growRTP_SYSEXBuffer
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::sendMIDIToClient (unsigned int NumBytes, unsigned int LEventTime)
+{
+	// Journal state must follow all commands, even filtered ones
+	if (Journal!=0) Journal->RecordReceivedCommand(&FullInMidiMsg[0], NumBytes);
+	if (!AcceptStatus(FullInMidiMsg[0])) return;
+	playoutEvent(NumBytes, &FullInMidiMsg[0], LEventTime);
 }  // CRTP_MIDI::sendRTP_SYSEXBuffer
 //--------------------------------------------------------------------------
 
+void CRTP_MIDI::deliverToClient (unsigned int NumBytes, unsigned char* Data, unsigned int LEventTime)
+{
+	if (EventRing!=0)
+	{  // Event is dropped (and counted by the ring) if consumer does not read fast enough
+		EventRing->Write(Data, NumBytes, LEventTime);
+		return;
+	}
+
+	if (SpanCallback==0)
+	{
+		if (RTPCallback==0) return;
+		RTP_TRACE_STAMP(CallbackStart);
+		RTPCallback(ClientInstance, NumBytes, Data, LEventTime);
+		RTP_TRACE_ADD(Trace, RTP_TRACE_CALLBACK, CallbackStart);
+		return;
+	}
+
+	if (NumBytes>RTP_SPAN_DATA_SIZE)
+	{  // Large SYSEX : send pending events, then the span made only of the SYSEX, pointing to the reception buffer
+		flushEventSpan();
+		EventSpan.Data=Data;
+		EventSpan.Offset[0]=0;
+		EventSpan.Length[0]=NumBytes;
+		EventSpan.Timestamp[0]=LEventTime;
+		EventSpan.DataSize=NumBytes;
+		EventSpan.Count=1;
+		flushEventSpan();
+		EventSpan.Data=&SpanData[0];
+		return;
+	}
+
+	if ((EventSpan.Count==RTP_SPAN_MAX_EVENTS)||(EventSpan.DataSize+NumBytes>RTP_SPAN_DATA_SIZE))
+		flushEventSpan();
+
+	EventSpan.Offset[EventSpan.Count]=EventSpan.DataSize;
+	EventSpan.Length[EventSpan.Count]=NumBytes;
+	EventSpan.Timestamp[EventSpan.Count]=LEventTime;
+	memcpy(&SpanData[EventSpan.DataSize], Data, NumBytes);
+	EventSpan.DataSize+=NumBytes;
+	EventSpan.Count++;
+}  // CRTP_MIDI::deliverToClient
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::playoutEvent (unsigned int NumBytes, unsigned char* Data, unsigned int EventTime)
+{
+	if (JitterRing!=0)
+	{
+		if (JitterRing->Write(Data, NumBytes, EventTime)) return;
+		// Buffer is full (or event is larger than the buffer) : the event is delivered at once rather than lost,
+		// after the buffered events which are not later, so the order of events is kept
+		releasePlayoutEventsUntil(EventTime);
+	}
+	deliverToClient(NumBytes, Data, EventTime);
+}  // CRTP_MIDI::playoutEvent
+//--------------------------------------------------------------------------
+
+unsigned int CRTP_MIDI::getPlayoutTime (unsigned int Transit, unsigned int RemoteTime)
+{
+	unsigned int MinTransit;
+	unsigned int Target;
+	unsigned int Delay;
+
+	// Smallest transit time over the current and previous windows : packet with the least queueing delay
+	// Windows are restarted regularly, so the reference follows the drift between the two clocks
+	if (TransitValid==false)
+	{
+		TransitMin[0]=Transit;
+		TransitMin[1]=Transit;
+		TransitPackets=0;
+		TransitValid=true;
+	}
+	if ((int)(Transit-TransitMin[0])<0) TransitMin[0]=Transit;
+	TransitPackets++;
+	if (TransitPackets>=RTP_PLAYOUT_WINDOW)
+	{
+		TransitMin[1]=TransitMin[0];
+		TransitMin[0]=Transit;
+		TransitPackets=0;
+	}
+	MinTransit=((int)(TransitMin[0]-TransitMin[1])<0)?TransitMin[0]:TransitMin[1];
+
+	// Latency : three times the interarrival jitter plus one tick, within the configured limits
+	Target=3*(StatJitter.load(std::memory_order_relaxed)>>4)+10;
+	if (Target<JitterMinDelay) Target=JitterMinDelay;
+	if (Target>JitterMaxDelay) Target=JitterMaxDelay;
+
+	// Latency grows at once to absorb a burst, and decreases slowly (1/10 ms every 16 packets) so it stays constant
+	Delay=JitterDelay.load(std::memory_order_relaxed);
+	if (Target>Delay) Delay=Target;
+	else if ((Delay>Target)&&((TransitPackets&15)==0)) Delay--;
+	JitterDelay.store(Delay, std::memory_order_relaxed);
+
+	return RemoteTime+MinTransit+Delay;
+}  // CRTP_MIDI::getPlayoutTime
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::releasePlayoutEvents (void)
+{
+	if ((releasePlayoutEventsUntil(TimeCounter))&&(SpanMode==RTP_SPAN_PER_PACKET)) flushEventSpan();
+}  // CRTP_MIDI::releasePlayoutEvents
+//--------------------------------------------------------------------------
+
+bool CRTP_MIDI::releasePlayoutEventsUntil (unsigned int Time)
+{
+	TRTPMIDIRingEvent Event;
+	bool Released=false;
+
+	while (JitterRing->Peek(&Event))
+	{
+		if ((int)(Event.Timestamp-Time)>0) break;
+		deliverToClient(Event.Length, Event.Data, Event.Timestamp);
+		JitterRing->Release();
+		Released=true;
+	}
+	return Released;
+}  // CRTP_MIDI::releasePlayoutEventsUntil
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::flushEventSpan (void)
+{
+	if (EventSpan.Count==0) return;
+
+	if (SpanCallback!=0)
+	{
+		RTP_TRACE_STAMP(CallbackStart);
+		SpanCallback(SpanInstance, &EventSpan);
+		RTP_TRACE_ADD(Trace, RTP_TRACE_CALLBACK, CallbackStart);
+	}
+	EventSpan.Count=0;
+	EventSpan.DataSize=0;
+}  // CRTP_MIDI::flushEventSpan
+//--------------------------------------------------------------------------
+
+void CRTP_MIDI::JournalRepairCallback (void* Instance, unsigned int NumBytes, unsigned char* MIDIMsg)
+{
+	CRTP_MIDI* Session=(CRTP_MIDI*)Instance;
+
+	if (!Session->AcceptStatus(MIDIMsg[0])) return;
+	// Repaired state is played with the packet which revealed the loss
+	Session->playoutEvent(NumBytes, MIDIMsg, Session->PacketEventTime);
+}  // CRTP_MIDI::JournalRepairCallback
+//--------------------------------------------------------------------------
+
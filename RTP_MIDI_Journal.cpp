@@ -0,0 +1,525 @@
+/*
+ *  RTP_MIDI_Journal.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Recovery journal (RFC 6295) for channel voice messages
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Sender side : each journalled item (program, controller, pitch wheel, note)
+ keeps the sequence number of the last packet which changed it. The journal of
+ packet P contains all items changed since the checkpoint (first packet not yet
+ acknowledged by a RS from the partner) up to P-1. Items older than checkpoint
+ are cleared when the journal is built, so history is trimmed at each RS.
+ Receiver side : the state of notes, controllers, pitch wheel and program seen
+ by the application is tracked. When a packet is lost, the journal of the next
+ packet is compared to this state and the differences are sent as MIDI commands
+ (note off for notes which have been released, new controller values, etc...).
+ Note on from lost packets are not played, as they would be played late.
+ Only channel chapters P, C, W and N are generated. Other chapters and system
+ journal are skipped on reception.
+ Everything is stored in fixed size tables : no memory is allocated.
+ */
+
+#include "RTP_MIDI_Journal.h"
+#include <string.h>
+
+#define BIT_TEST(Array, N)		((Array[(N)>>5]&(1u<<((N)&31)))!=0)
+#define BIT_SET(Array, N)		Array[(N)>>5]|=(1u<<((N)&31))
+#define BIT_CLEAR(Array, N)		Array[(N)>>5]&=~(1u<<((N)&31))
+
+//! Returns true if packet Sequence is before packet Reference (sequence numbers wrap around)
+static bool SequenceBefore (unsigned short Sequence, unsigned short Reference)
+{
+	return ((short)(Sequence-Reference)<0);
+}  // SequenceBefore
+//---------------------------------------------------------------------------
+
+CRTPMIDIJournal::CRTPMIDIJournal(void)
+{
+	Reset(0);
+}  // CRTPMIDIJournal::CRTPMIDIJournal
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::Reset (unsigned short FirstSequence)
+{
+	memset(&SendChannel[0], 0, sizeof(SendChannel));
+	memset(&ReceiveChannel[0], 0, sizeof(ReceiveChannel));
+	Checkpoint.store(FirstSequence);
+}  // CRTPMIDIJournal::Reset
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::Acknowledge (unsigned short Sequence)
+{
+	Checkpoint.store((unsigned short)(Sequence+1), std::memory_order_relaxed);
+}  // CRTPMIDIJournal::Acknowledge
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::DropHistory (unsigned short Sequence)
+{
+	unsigned int Channel;
+
+	for (Channel=0; Channel<16; Channel++)
+		SendChannel[Channel].Active=false;
+	Checkpoint.store(Sequence, std::memory_order_relaxed);
+}  // CRTPMIDIJournal::DropHistory
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::RecordSentCommand (unsigned char Status, unsigned char Data1, unsigned char Data2, unsigned short Sequence)
+{
+	TJournalSendChannel* Chan=&SendChannel[Status&0x0F];
+
+	if (Chan->Active==false)
+	{  // Items recorded before the channel became inactive are older than checkpoint
+		Chan->ProgramValid=false;
+		Chan->PitchValid=false;
+		memset(&Chan->ControllerValid[0], 0, sizeof(Chan->ControllerValid));
+		memset(&Chan->NoteValid[0], 0, sizeof(Chan->NoteValid));
+		Chan->Active=true;
+	}
+	Chan->ChannelSeq=Sequence;
+
+	switch (Status&0xF0)
+	{
+		case 0x80 :
+		case 0x90 :
+			if ((Status&0xF0)==0x80) Data2=0;		// Note off is recorded as velocity 0
+			Chan->NoteVelocity[Data1]=Data2;
+			Chan->NoteSeq[Data1]=Sequence;
+			BIT_SET(Chan->NoteValid, Data1);
+			break;
+		case 0xB0 :
+			Chan->ControllerValue[Data1]=Data2;
+			Chan->ControllerSeq[Data1]=Sequence;
+			BIT_SET(Chan->ControllerValid, Data1);
+			break;
+		case 0xC0 :
+			Chan->Program=Data1;
+			Chan->ProgramSeq=Sequence;
+			Chan->ProgramValid=true;
+			break;
+		case 0xE0 :
+			Chan->PitchLSB=Data1;
+			Chan->PitchMSB=Data2;
+			Chan->PitchSeq=Sequence;
+			Chan->PitchValid=true;
+			break;
+	}
+}  // CRTPMIDIJournal::RecordSentCommand
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::RecordSentList (unsigned char* MIDIList, unsigned int ListSize, unsigned short Sequence)
+{
+	unsigned int Pos=0;
+	unsigned int DeltaBytes;
+	unsigned int DataBytes;
+	unsigned char Status;
+	unsigned char RunningStatus=0;
+
+	while (Pos<ListSize)
+	{
+		// Skip delta time (1 to 4 bytes)
+		DeltaBytes=0;
+		while ((Pos<ListSize)&&((MIDIList[Pos]&0x80)!=0)&&(DeltaBytes<3))
+		{
+			Pos++;
+			DeltaBytes++;
+		}
+		Pos++;
+		if (Pos>=ListSize) return;
+
+		Status=MIDIList[Pos];
+		if (Status>=0xF8)
+		{  // Realtime message
+			Pos++;
+			continue;
+		}
+		if ((Status==0xF0)||(Status==0xF7))
+		{  // SYSEX (or SYSEX segment) : skip up to end of segment
+			Pos++;
+			while ((Pos<ListSize)&&(MIDIList[Pos]!=0xF7)&&(MIDIList[Pos]!=0xF0)&&(MIDIList[Pos]!=0xF4)) Pos++;
+			Pos++;
+			RunningStatus=0;
+			continue;
+		}
+
+		if (Status&0x80)
+		{
+			Pos++;
+			if (Status<0xF0) RunningStatus=Status;
+			else RunningStatus=0;
+		}
+		else
+		{
+			Status=RunningStatus;
+			if (Status==0)
+			{  // Data byte without running status : ignore it
+				Pos++;
+				continue;
+			}
+		}
+
+		if ((Status==0xF2)||(Status<0xC0)||((Status>=0xE0)&&(Status<0xF0))) DataBytes=2;
+		else if ((Status==0xF1)||(Status==0xF3)||(Status<0xE0)) DataBytes=1;
+		else DataBytes=0;
+
+		if (Pos+DataBytes>ListSize) return;
+		if (Status<0xF0)
+		{
+			RecordSentCommand(Status, MIDIList[Pos]&0x7F, (DataBytes==2)?(MIDIList[Pos+1]&0x7F):0, Sequence);
+		}
+		Pos+=DataBytes;
+	}
+}  // CRTPMIDIJournal::RecordSentList
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIJournal::BuildJournal (unsigned char* Dest, unsigned int MaxSize, unsigned short CurrentSequence)
+{
+	unsigned int Pos;
+	unsigned int ChannelStart;
+	unsigned int ChannelCount=0;
+	unsigned int Channel;
+	unsigned int Number;
+	unsigned int LogCount;
+	unsigned int ChapterStart;
+	unsigned int OffBitsLow;
+	unsigned int OffBitsHigh;
+	unsigned int Length;
+	unsigned char OffBits[16];
+	unsigned char Chapters;
+	unsigned short CheckpointSeq;
+	TJournalSendChannel* Chan;
+
+	CheckpointSeq=(unsigned short)Checkpoint.load(std::memory_order_relaxed);
+	if (MaxSize<3) return 0;
+	Pos=3;		// Room for journal header
+
+	for (Channel=0; Channel<16; Channel++)
+	{
+		Chan=&SendChannel[Channel];
+		if (Chan->Active==false) continue;
+		if (SequenceBefore(Chan->ChannelSeq, CheckpointSeq))
+		{  // Whole channel has been acknowledged
+			Chan->Active=false;
+			continue;
+		}
+
+		ChannelStart=Pos;
+		Pos+=3;		// Room for channel journal header
+		Chapters=0;
+
+		// Chapter P : program change
+		if ((Chan->ProgramValid)&&(SequenceBefore(Chan->ProgramSeq, CheckpointSeq))) Chan->ProgramValid=false;
+		if (Chan->ProgramValid)
+		{
+			if (Pos+3>MaxSize) goto Overflow;
+			Dest[Pos]=Chan->Program;
+			Dest[Pos+1]=0;			// B=0 : bank is carried by controllers 0 and 32 in chapter C
+			Dest[Pos+2]=0;
+			Pos+=3;
+			Chapters|=CHAPTER_P_BIT;
+		}
+
+		// Chapter C : controllers
+		ChapterStart=Pos;
+		Pos++;
+		LogCount=0;
+		for (Number=0; Number<128; Number++)
+		{
+			if (!BIT_TEST(Chan->ControllerValid, Number)) continue;
+			if (SequenceBefore(Chan->ControllerSeq[Number], CheckpointSeq))
+			{
+				BIT_CLEAR(Chan->ControllerValid, Number);
+				continue;
+			}
+			if (Pos+2>MaxSize) goto Overflow;
+			Dest[Pos]=(unsigned char)Number;
+			Dest[Pos+1]=Chan->ControllerValue[Number];		// A=0 : value tool
+			Pos+=2;
+			LogCount++;
+		}
+		if (LogCount>0)
+		{
+			Dest[ChapterStart]=(unsigned char)(LogCount-1);
+			Chapters|=CHAPTER_C_BIT;
+		}
+		else Pos=ChapterStart;
+
+		// Chapter W : pitch wheel
+		if ((Chan->PitchValid)&&(SequenceBefore(Chan->PitchSeq, CheckpointSeq))) Chan->PitchValid=false;
+		if (Chan->PitchValid)
+		{
+			if (Pos+2>MaxSize) goto Overflow;
+			Dest[Pos]=Chan->PitchLSB;
+			Dest[Pos+1]=Chan->PitchMSB;
+			Pos+=2;
+			Chapters|=CHAPTER_W_BIT;
+		}
+
+		// Chapter N : notes (logs for notes on, bitfield for notes off)
+		ChapterStart=Pos;
+		Pos+=2;
+		LogCount=0;
+		memset(&OffBits[0], 0, sizeof(OffBits));
+		OffBitsLow=16;
+		OffBitsHigh=0;
+		for (Number=0; Number<128; Number++)
+		{
+			if (!BIT_TEST(Chan->NoteValid, Number)) continue;
+			if (SequenceBefore(Chan->NoteSeq[Number], CheckpointSeq))
+			{
+				BIT_CLEAR(Chan->NoteValid, Number);
+				continue;
+			}
+			if (Chan->NoteVelocity[Number]!=0)
+			{
+				if ((Pos+2>MaxSize)||(LogCount>=127)) goto Overflow;
+				Dest[Pos]=(unsigned char)Number;
+				Dest[Pos+1]=Chan->NoteVelocity[Number];		// Y=0 : note should not be played late
+				Pos+=2;
+				LogCount++;
+			}
+			else
+			{
+				OffBits[Number>>3]|=(0x80>>(Number&7));
+				if ((Number>>3)<OffBitsLow) OffBitsLow=Number>>3;
+				OffBitsHigh=Number>>3;
+			}
+		}
+		if ((LogCount>0)||(OffBitsLow<=OffBitsHigh))
+		{
+			if (OffBitsLow>OffBitsHigh)
+			{  // No bitfield : LOW > HIGH
+				OffBitsLow=1;
+				OffBitsHigh=0;
+			}
+			else
+			{
+				if (Pos+OffBitsHigh-OffBitsLow+1>MaxSize) goto Overflow;
+				memcpy(&Dest[Pos], &OffBits[OffBitsLow], OffBitsHigh-OffBitsLow+1);
+				Pos+=OffBitsHigh-OffBitsLow+1;
+			}
+			Dest[ChapterStart]=(unsigned char)LogCount;		// B=0
+			Dest[ChapterStart+1]=(unsigned char)((OffBitsLow<<4)|OffBitsHigh);
+			Chapters|=CHAPTER_N_BIT;
+		}
+		else Pos=ChapterStart;
+
+		if (Chapters==0)
+		{  // Everything in this channel has been acknowledged
+			Chan->Active=false;
+			Pos=ChannelStart;
+			continue;
+		}
+
+		// Channel journal header : S=0, CHAN, H=0, LENGTH (10 bits), chapters flags
+		Length=Pos-ChannelStart;
+		Dest[ChannelStart]=(unsigned char)((Channel<<3)|((Length>>8)&0x03));
+		Dest[ChannelStart+1]=(unsigned char)(Length&0xFF);
+		Dest[ChannelStart+2]=Chapters;
+		ChannelCount++;
+	}
+
+	if (ChannelCount==0) return 0;
+
+	// Recovery journal header : S=0, Y=0, A=1, H=0, TOTCHAN, checkpoint
+	Dest[0]=(unsigned char)(JOURNAL_A_BIT|(ChannelCount-1));
+	Dest[1]=(unsigned char)(CheckpointSeq>>8);
+	Dest[2]=(unsigned char)(CheckpointSeq&0xFF);
+	return Pos;
+
+Overflow:
+	// History does not fit in the packet : drop it, next journal only covers packets from the current one
+	DropHistory(CurrentSequence);
+	return 0;
+}  // CRTPMIDIJournal::BuildJournal
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::RecordReceivedCommand (unsigned char* MIDIMsg, unsigned int NumBytes)
+{
+	TJournalReceiveChannel* Chan;
+	unsigned char Status=MIDIMsg[0];
+
+	if ((Status<0x80)||(Status>=0xF0)) return;
+	Chan=&ReceiveChannel[Status&0x0F];
+
+	switch (Status&0xF0)
+	{
+		case 0x80 :
+			if (NumBytes>=2) BIT_CLEAR(Chan->NoteOn, MIDIMsg[1]&0x7F);
+			break;
+		case 0x90 :
+			if (NumBytes<3) break;
+			if (MIDIMsg[2]==0) BIT_CLEAR(Chan->NoteOn, MIDIMsg[1]&0x7F);
+			else BIT_SET(Chan->NoteOn, MIDIMsg[1]&0x7F);
+			break;
+		case 0xB0 :
+			if (NumBytes<3) break;
+			Chan->ControllerValue[MIDIMsg[1]&0x7F]=MIDIMsg[2];
+			BIT_SET(Chan->ControllerKnown, MIDIMsg[1]&0x7F);
+			break;
+		case 0xC0 :
+			if (NumBytes<2) break;
+			Chan->Program=MIDIMsg[1];
+			Chan->ProgramKnown=true;
+			break;
+		case 0xE0 :
+			if (NumBytes<3) break;
+			Chan->PitchLSB=MIDIMsg[1];
+			Chan->PitchMSB=MIDIMsg[2];
+			Chan->PitchKnown=true;
+			break;
+	}
+}  // CRTPMIDIJournal::RecordReceivedCommand
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::Repair (unsigned int NumBytes, unsigned char Status, unsigned char Data1, unsigned char Data2, TJournalRepairCallback Callback, void* Instance)
+{
+	unsigned char MIDIMsg[3];
+
+	MIDIMsg[0]=Status;
+	MIDIMsg[1]=Data1;
+	MIDIMsg[2]=Data2;
+	RecordReceivedCommand(&MIDIMsg[0], NumBytes);
+	if (Callback!=0) Callback(Instance, NumBytes, &MIDIMsg[0]);
+}  // CRTPMIDIJournal::Repair
+//---------------------------------------------------------------------------
+
+void CRTPMIDIJournal::Recover (unsigned char* Journal, unsigned int JournalSize, TJournalRepairCallback Callback, void* Instance)
+{
+	unsigned int Pos;
+	unsigned int End;
+	unsigned int Length;
+	unsigned int ChannelCount;
+	unsigned int Channel;
+	unsigned int LogCount;
+	unsigned int Log;
+	unsigned int Number;
+	unsigned int OffBitsLow;
+	unsigned int OffBitsHigh;
+	unsigned int Bit;
+	unsigned char Chapters;
+	unsigned char Value;
+	TJournalReceiveChannel* Chan;
+
+	if (JournalSize<3) return;
+	ChannelCount=(Journal[0]&0x0F)+1;
+	Pos=3;
+
+	// System journal is not used : skip it
+	if (Journal[0]&JOURNAL_Y_BIT)
+	{
+		if (Pos+2>JournalSize) return;
+		Length=((Journal[Pos]&0x03)<<8)|Journal[Pos+1];
+		if (Length<2) return;
+		Pos+=Length;
+	}
+	if ((Journal[0]&JOURNAL_A_BIT)==0) return;
+
+	while ((ChannelCount>0)&&(Pos+3<=JournalSize))
+	{
+		ChannelCount--;
+		Channel=(Journal[Pos]>>3)&0x0F;
+		Length=((Journal[Pos]&0x03)<<8)|Journal[Pos+1];
+		Chapters=Journal[Pos+2];
+		End=Pos+Length;
+		if ((Length<3)||(End>JournalSize)) return;		// Malformed journal
+		Chan=&ReceiveChannel[Channel];
+		Pos+=3;
+
+		// Chapter P
+		if (Chapters&CHAPTER_P_BIT)
+		{
+			if (Pos+3>End) return;
+			Value=Journal[Pos]&0x7F;
+			if ((Chan->ProgramKnown==false)||(Chan->Program!=Value))
+				Repair(2, (unsigned char)(0xC0|Channel), Value, 0, Callback, Instance);
+			Pos+=3;
+		}
+
+		// Chapter C
+		if (Chapters&CHAPTER_C_BIT)
+		{
+			if (Pos+1>End) return;
+			LogCount=(Journal[Pos]&0x7F)+1;
+			Pos++;
+			if (Pos+2*LogCount>End) return;
+			for (Log=0; Log<LogCount; Log++)
+			{
+				Number=Journal[Pos]&0x7F;
+				Value=Journal[Pos+1];
+				if ((Value&0x80)==0)
+				{  // A=0 : value tool (toggle and count tools are not restored)
+					if ((!BIT_TEST(Chan->ControllerKnown, Number))||(Chan->ControllerValue[Number]!=Value))
+						Repair(3, (unsigned char)(0xB0|Channel), (unsigned char)Number, Value, Callback, Instance);
+				}
+				Pos+=2;
+			}
+		}
+
+		// Chapter M : skip it (length in its header)
+		if (Chapters&CHAPTER_M_BIT)
+		{
+			if (Pos+2>End) return;
+			Length=((Journal[Pos]&0x03)<<8)|Journal[Pos+1];
+			if (Length<2) return;
+			Pos+=Length;
+		}
+
+		// Chapter W
+		if (Chapters&CHAPTER_W_BIT)
+		{
+			if (Pos+2>End) return;
+			if ((Chan->PitchKnown==false)||(Chan->PitchLSB!=(Journal[Pos]&0x7F))||(Chan->PitchMSB!=(Journal[Pos+1]&0x7F)))
+				Repair(3, (unsigned char)(0xE0|Channel), Journal[Pos]&0x7F, Journal[Pos+1]&0x7F, Callback, Instance);
+			Pos+=2;
+		}
+
+		// Chapter N : release the notes marked as off in the bitfield
+		if (Chapters&CHAPTER_N_BIT)
+		{
+			if (Pos+2>End) return;
+			LogCount=Journal[Pos]&0x7F;
+			OffBitsLow=Journal[Pos+1]>>4;
+			OffBitsHigh=Journal[Pos+1]&0x0F;
+			if ((LogCount==127)&&(OffBitsLow==15)&&(OffBitsHigh==0)) LogCount=128;
+			Pos+=2+2*LogCount;		// Note on from lost packets are not played
+			if (OffBitsLow<=OffBitsHigh)
+			{
+				if (Pos+OffBitsHigh-OffBitsLow+1>End) return;
+				for (Number=OffBitsLow*8; Number<(OffBitsHigh+1)*8; Number++)
+				{
+					Bit=Journal[Pos+(Number>>3)-OffBitsLow]&(0x80>>(Number&7));
+					if ((Bit!=0)&&(BIT_TEST(Chan->NoteOn, Number)))
+						Repair(3, (unsigned char)(0x80|Channel), (unsigned char)Number, 0, Callback, Instance);
+				}
+			}
+		}
+
+		// Other chapters (E, T, A) are not used
+		Pos=End;
+	}
+}  // CRTPMIDIJournal::Recover
+//---------------------------------------------------------------------------
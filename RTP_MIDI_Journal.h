@@ -0,0 +1,137 @@
+/*
+ *  RTP_MIDI_Journal.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Recovery journal (RFC 6295) for channel voice messages
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_JOURNAL_H__
+#define __RTP_MIDI_JOURNAL_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+
+// Max size of the recovery journal appended to an outgoing packet
+// If the history since last checkpoint needs more room, history is dropped (checkpoint moved to current packet)
+#ifndef RTP_JOURNAL_MAX_SIZE
+#define RTP_JOURNAL_MAX_SIZE	512
+#endif
+
+// Time (in 1/10 ms) after the last packet before a guard packet (empty MIDI list + journal) is sent
+#define RTP_JOURNAL_GUARD_TIME	200
+
+// Recovery journal header flags
+#define JOURNAL_S_BIT			0x80
+#define JOURNAL_Y_BIT			0x40
+#define JOURNAL_A_BIT			0x20
+#define JOURNAL_H_BIT			0x10
+
+// Channel journal chapter flags
+#define CHAPTER_P_BIT			0x80
+#define CHAPTER_C_BIT			0x40
+#define CHAPTER_M_BIT			0x20
+#define CHAPTER_W_BIT			0x10
+#define CHAPTER_N_BIT			0x08
+
+// Repair command generated from a received journal (NumBytes = 2 or 3)
+typedef void (*TJournalRepairCallback) (void* Instance, unsigned int NumBytes, unsigned char* MIDIMsg);
+
+// History of one MIDI channel on sender side (all items are tagged with sequence number of the packet which changed them)
+typedef struct {
+	bool Active;						// Channel has been changed since checkpoint
+	unsigned short ChannelSeq;			// Last packet which changed the channel
+	// Chapter P
+	bool ProgramValid;
+	unsigned short ProgramSeq;
+	unsigned char Program;
+	// Chapter C
+	unsigned int ControllerValid[4];	// One bit per controller
+	unsigned short ControllerSeq[128];
+	unsigned char ControllerValue[128];
+	// Chapter W
+	bool PitchValid;
+	unsigned short PitchSeq;
+	unsigned char PitchLSB;
+	unsigned char PitchMSB;
+	// Chapter N
+	unsigned int NoteValid[4];			// One bit per note
+	unsigned short NoteSeq[128];
+	unsigned char NoteVelocity[128];	// 0 : last command was note off
+} TJournalSendChannel;
+
+// State of one MIDI channel on receiver side, as seen by the application
+typedef struct {
+	unsigned int NoteOn[4];				// One bit per note currently playing
+	unsigned int ControllerKnown[4];
+	unsigned char ControllerValue[128];
+	bool PitchKnown;
+	unsigned char PitchLSB;
+	unsigned char PitchMSB;
+	bool ProgramKnown;
+	unsigned char Program;
+} TJournalReceiveChannel;
+
+class CRTPMIDIJournal
+{
+public:
+	CRTPMIDIJournal(void);
+
+	//! Clears sender history and receiver state (new session)
+	void Reset (unsigned short FirstSequence);
+
+	//! Remote partner has received all packets up to Sequence (RS packet) : history before it is not needed anymore
+	void Acknowledge (unsigned short Sequence);
+
+	//! Writes the recovery journal for packet CurrentSequence (history of packets from checkpoint up to CurrentSequence-1)
+	//! \return size of journal, 0 if there is nothing to journal (or history has been dropped because it does not fit in MaxSize)
+	unsigned int BuildJournal (unsigned char* Dest, unsigned int MaxSize, unsigned short CurrentSequence);
+
+	//! Records the commands of an outgoing MIDI list (with delta times) in the sender history
+	void RecordSentList (unsigned char* MIDIList, unsigned int ListSize, unsigned short Sequence);
+
+	//! Records a command delivered to the application (receiver state)
+	void RecordReceivedCommand (unsigned char* MIDIMsg, unsigned int NumBytes);
+
+	//! Parses a received recovery journal after packet loss and generates the commands needed to repair receiver state
+	//! (note off for stuck notes, controllers, pitch wheel and program which differ from the journal)
+	void Recover (unsigned char* Journal, unsigned int JournalSize, TJournalRepairCallback Callback, void* Instance);
+
+private:
+	TJournalSendChannel SendChannel[16];
+	TJournalReceiveChannel ReceiveChannel[16];
+	std::atomic<unsigned int> Checkpoint;		// First packet covered by the journal (written by RS processing)
+
+	//! Records one channel command in the sender history
+	void RecordSentCommand (unsigned char Status, unsigned char Data1, unsigned char Data2, unsigned short Sequence);
+
+	//! Drops all sender history (journal becomes empty, checkpoint moves to Sequence)
+	void DropHistory (unsigned short Sequence);
+
+	//! Sends a repair command to the application and records it in receiver state
+	void Repair (unsigned int NumBytes, unsigned char Status, unsigned char Data1, unsigned char Data2, TJournalRepairCallback Callback, void* Instance);
+};
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ *  RTP_MIDI_LocalTransport.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Shared memory transport between two endpoints running on the same host
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Each endpoint reads the rings of its own side and writes the rings of the
+ other side. Rings are indexed by free running counters : the sender writes
+ the datagram then moves WritePtr (release), the receiver copies it then
+ moves ReadPtr (release). WriteLock is only contended when two threads of the
+ same endpoint send at the same time. System calls are only made to wake up
+ an endpoint blocked in Wait (futex on Linux, named events on Windows).
+ */
+
+#include "RTP_MIDI_LocalTransport.h"
+#include <string.h>
+#include <stdio.h>
+#if defined (__TARGET_LINUX__) || defined (__TARGET_MAC__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined (__TARGET_LINUX__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#define RTP_LOCAL_MAGIC		0x524C5431		// 'RLT1'
+
+CRTPMIDILocalTransport::CRTPMIDILocalTransport(void)
+{
+	Segment=0;
+	Side=0;
+	Opened.store(false);
+	Path[0]=0;
+#if defined (__TARGET_WIN__)
+	Mapping=0;
+	WakeEvent[0]=0;
+	WakeEvent[1]=0;
+#endif
+}  // CRTPMIDILocalTransport::CRTPMIDILocalTransport
+//---------------------------------------------------------------------------
+
+CRTPMIDILocalTransport::~CRTPMIDILocalTransport(void)
+{
+	Close();
+	Release();
+}  // CRTPMIDILocalTransport::~CRTPMIDILocalTransport
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::Map (const char* Name, bool Creator)
+{
+	void* Memory;
+
+	Close();
+	Release();
+	if ((Name==0)||(strlen(Name)==0)||(strlen(Name)>RTP_LOCAL_MAX_NAME)) return false;
+
+#if defined (__TARGET_LINUX__) || defined (__TARGET_MAC__)
+	int Handle;
+	struct stat Status;
+
+	snprintf(Path, sizeof(Path), "/rtpmidi.%s", Name);
+	if (Creator)
+	{
+		Handle=shm_open(Path, O_CREAT|O_RDWR, 0600);
+		if (Handle<0) return false;
+		if (ftruncate(Handle, sizeof(TRTPLocalSegment))!=0)
+		{
+			close(Handle);
+			shm_unlink(Path);
+			return false;
+		}
+	}
+	else
+	{
+		Handle=shm_open(Path, O_RDWR, 0);
+		if (Handle<0) return false;
+		if ((fstat(Handle, &Status)!=0)||(Status.st_size<(off_t)sizeof(TRTPLocalSegment)))
+		{
+			close(Handle);
+			return false;
+		}
+	}
+	Memory=mmap(0, sizeof(TRTPLocalSegment), PROT_READ|PROT_WRITE, MAP_SHARED, Handle, 0);
+	close(Handle);			// Mapping remains valid
+	if (Memory==MAP_FAILED)
+	{
+		if (Creator) shm_unlink(Path);
+		return false;
+	}
+#endif
+
+#if defined (__TARGET_WIN__)
+	char EventPath[RTP_LOCAL_MAX_NAME+32];
+	int Index;
+
+	_snprintf(Path, sizeof(Path), "Local\\rtpmidi.%s", Name);
+	if (Creator)
+		Mapping=CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, sizeof(TRTPLocalSegment), Path);
+	else
+		Mapping=OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, Path);
+	if (Mapping==0) return false;
+	Memory=MapViewOfFile(Mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TRTPLocalSegment));
+	if (Memory==0)
+	{
+		CloseHandle(Mapping);
+		Mapping=0;
+		return false;
+	}
+	for (Index=0; Index<2; Index++)
+	{  // Auto-reset events, created by the first endpoint which opens them
+		_snprintf(EventPath, sizeof(EventPath), "%s.%d", Path, Index);
+		WakeEvent[Index]=CreateEventA(0, FALSE, FALSE, EventPath);
+	}
+#endif
+
+	Segment=(TRTPLocalSegment*)Memory;
+	if (Creator)
+	{
+		Side=0;
+		memset(Memory, 0, sizeof(TRTPLocalSegment));
+		Segment->Rings[0][0].WriteLock.clear();
+		Segment->Rings[0][1].WriteLock.clear();
+		Segment->Rings[1][0].WriteLock.clear();
+		Segment->Rings[1][1].WriteLock.clear();
+		Segment->Magic.store(RTP_LOCAL_MAGIC, std::memory_order_release);
+	}
+	else
+	{
+		Side=1;
+		if (Segment->Magic.load(std::memory_order_acquire)!=RTP_LOCAL_MAGIC)
+		{  // Segment is being created or has not been created by this library
+			Release();
+			return false;
+		}
+	}
+	Opened.store(true);
+	return true;
+}  // CRTPMIDILocalTransport::Map
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::Create (const char* Name)
+{
+	return Map(Name, true);
+}  // CRTPMIDILocalTransport::Create
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::Open (const char* Name)
+{
+	return Map(Name, false);
+}  // CRTPMIDILocalTransport::Open
+//---------------------------------------------------------------------------
+
+void CRTPMIDILocalTransport::Close (void)
+{
+	if (Opened.load()==false) return;
+	Opened.store(false);
+
+#if defined (__TARGET_LINUX__) || defined (__TARGET_MAC__)
+	// Name is removed at once, so a new endpoint can create a segment with the same name
+	if (Side==0) shm_unlink(Path);
+#endif
+	Signal(Side);			// Thread blocked in Wait must see that the transport is closed
+}  // CRTPMIDILocalTransport::Close
+//---------------------------------------------------------------------------
+
+void CRTPMIDILocalTransport::Release (void)
+{
+	if (Segment==0) return;
+
+#if defined (__TARGET_LINUX__) || defined (__TARGET_MAC__)
+	munmap(Segment, sizeof(TRTPLocalSegment));
+#endif
+#if defined (__TARGET_WIN__)
+	UnmapViewOfFile(Segment);
+	CloseHandle(Mapping);
+	Mapping=0;
+	if (WakeEvent[0]!=0) CloseHandle(WakeEvent[0]);
+	if (WakeEvent[1]!=0) CloseHandle(WakeEvent[1]);
+	WakeEvent[0]=0;
+	WakeEvent[1]=0;
+#endif
+	Segment=0;
+}  // CRTPMIDILocalTransport::Release
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::IsOpen (void)
+{
+	return Opened.load(std::memory_order_relaxed);
+}  // CRTPMIDILocalTransport::IsOpen
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::Send (int Channel, const void* Data, unsigned int Size)
+{
+	TRTPLocalRing* Ring;
+	unsigned int Write;
+	bool Sent=false;
+
+	if (!Opened.load(std::memory_order_relaxed)) return false;
+	if ((Size==0)||(Size>RTP_LOCAL_DATAGRAM_SIZE)) return false;
+	Ring=&Segment->Rings[1-Side][Channel];
+
+	while (Ring->WriteLock.test_and_set(std::memory_order_acquire)) {}
+	Write=Ring->WritePtr.load(std::memory_order_relaxed);
+	if (Write-Ring->ReadPtr.load(std::memory_order_acquire)<RTP_LOCAL_RING_SLOTS)
+	{
+		memcpy(&Ring->Data[Write&(RTP_LOCAL_RING_SLOTS-1)][0], Data, Size);
+		Ring->Size[Write&(RTP_LOCAL_RING_SLOTS-1)]=(unsigned short)Size;
+		Ring->WritePtr.store(Write+1, std::memory_order_release);
+		Sent=true;
+	}
+	Ring->WriteLock.clear(std::memory_order_release);
+
+	if (Sent) Signal(1-Side);
+	return Sent;
+}  // CRTPMIDILocalTransport::Send
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDILocalTransport::Receive (int Channel, unsigned char* Data, unsigned int MaxSize)
+{
+	TRTPLocalRing* Ring;
+	unsigned int Read;
+	unsigned int Size;
+
+	if (!Opened.load(std::memory_order_relaxed)) return 0;
+	Ring=&Segment->Rings[Side][Channel];
+
+	Read=Ring->ReadPtr.load(std::memory_order_relaxed);
+	if (Read==Ring->WritePtr.load(std::memory_order_acquire)) return 0;
+
+	Size=Ring->Size[Read&(RTP_LOCAL_RING_SLOTS-1)];
+	if (Size>MaxSize) Size=MaxSize;
+	memcpy(Data, &Ring->Data[Read&(RTP_LOCAL_RING_SLOTS-1)][0], Size);
+	Ring->ReadPtr.store(Read+1, std::memory_order_release);
+	return Size;
+}  // CRTPMIDILocalTransport::Receive
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::DataPending (void)
+{
+	TRTPLocalRing* Rings;
+
+	if (!Opened.load(std::memory_order_relaxed)) return false;
+	Rings=&Segment->Rings[Side][0];
+	if (Rings[RTP_LOCAL_CONTROL].ReadPtr.load(std::memory_order_relaxed)!=Rings[RTP_LOCAL_CONTROL].WritePtr.load(std::memory_order_acquire)) return true;
+	return (Rings[RTP_LOCAL_DATA].ReadPtr.load(std::memory_order_relaxed)!=Rings[RTP_LOCAL_DATA].WritePtr.load(std::memory_order_acquire));
+}  // CRTPMIDILocalTransport::DataPending
+//---------------------------------------------------------------------------
+
+void CRTPMIDILocalTransport::Signal (int Endpoint)
+{
+	Segment->Wake[Endpoint].fetch_add(1, std::memory_order_seq_cst);
+	// No system call when the endpoint is not waiting (it polls the rings at each tick)
+	if (Segment->Waiting[Endpoint].load(std::memory_order_seq_cst)==0) return;
+
+#if defined (__TARGET_LINUX__)
+	syscall(SYS_futex, (unsigned int*)&Segment->Wake[Endpoint], FUTEX_WAKE, 1, 0, 0, 0);
+#endif
+#if defined (__TARGET_WIN__)
+	if (WakeEvent[Endpoint]!=0) SetEvent(WakeEvent[Endpoint]);
+#endif
+}  // CRTPMIDILocalTransport::Signal
+//---------------------------------------------------------------------------
+
+void CRTPMIDILocalTransport::WakeSelf (void)
+{
+	if (!Opened.load(std::memory_order_relaxed)) return;
+	Signal(Side);
+}  // CRTPMIDILocalTransport::WakeSelf
+//---------------------------------------------------------------------------
+
+bool CRTPMIDILocalTransport::Wait (unsigned int Timeout)
+{
+	unsigned int WakeCount;
+
+	if (!Opened.load(std::memory_order_relaxed)) return false;
+
+	WakeCount=Segment->Wake[Side].load(std::memory_order_seq_cst);
+	Segment->Waiting[Side].fetch_add(1, std::memory_order_seq_cst);
+	// Datagrams sent before Waiting was set did not signal us
+	if ((!DataPending())&&(Segment->Wake[Side].load(std::memory_order_seq_cst)==WakeCount))
+	{
+#if defined (__TARGET_LINUX__)
+		timespec Time;
+
+		Time.tv_sec=Timeout/1000;
+		Time.tv_nsec=(Timeout%1000)*1000000;
+		// Returns at once if Wake has changed since it was read
+		syscall(SYS_futex, (unsigned int*)&Segment->Wake[Side], FUTEX_WAIT, WakeCount, &Time, 0, 0);
+#endif
+#if defined (__TARGET_WIN__)
+		if (WakeEvent[Side]!=0) WaitForSingleObject(WakeEvent[Side], Timeout);
+		else Sleep(Timeout);
+#endif
+#if defined (__TARGET_MAC__)
+		// No futex available : poll every 100us
+		unsigned int Elapsed;
+
+		for (Elapsed=0; Elapsed<Timeout*10; Elapsed++)
+		{
+			if (Segment->Wake[Side].load(std::memory_order_acquire)!=WakeCount) break;
+			usleep(100);
+		}
+#endif
+	}
+	Segment->Waiting[Side].fetch_sub(1, std::memory_order_seq_cst);
+	return DataPending();
+}  // CRTPMIDILocalTransport::Wait
+//---------------------------------------------------------------------------
+
@@ -0,0 +1,119 @@
+/*
+ *  RTP_MIDI_LocalTransport.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Shared memory transport between two endpoints running on the same host
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_LOCALTRANSPORT_H__
+#define __RTP_MIDI_LOCALTRANSPORT_H__
+//---------------------------------------------------------------------------
+
+#include <atomic>
+#if defined (__TARGET_WIN__)
+#include <windows.h>
+#endif
+
+#define RTP_LOCAL_RING_SLOTS		64		// Datagrams in each ring (power of two)
+#define RTP_LOCAL_DATAGRAM_SIZE		1500
+#define RTP_LOCAL_MAX_NAME			22		// Maximum length of segment names (MacOS limits shared memory names to 31 characters, including the "/rtpmidi." prefix)
+
+// Channels of the transport (replace the control and data sockets)
+#define RTP_LOCAL_CONTROL			0
+#define RTP_LOCAL_DATA				1
+
+typedef struct {
+	std::atomic<unsigned int> WritePtr;		// Free running datagram counters
+	std::atomic<unsigned int> ReadPtr;
+	std::atomic_flag WriteLock;				// Several threads of the sending endpoint may send (BY sent by CloseSession)
+	unsigned short Size[RTP_LOCAL_RING_SLOTS];
+	unsigned char Data[RTP_LOCAL_RING_SLOTS][RTP_LOCAL_DATAGRAM_SIZE];
+} TRTPLocalRing;
+
+// Layout of the shared memory segment (no pointer, it is mapped at a different address in each process)
+typedef struct {
+	std::atomic<unsigned int> Magic;		// Written last by the creator
+	std::atomic<unsigned int> Wake[2];		// Incremented for each datagram sent to an endpoint (futex word on Linux)
+	std::atomic<unsigned int> Waiting[2];	// Endpoint is blocked in Wait : sender must wake it
+	TRTPLocalRing Rings[2][2];				// [receiving endpoint][channel]
+} TRTPLocalSegment;
+
+class CRTPMIDILocalTransport
+{
+public:
+	CRTPMIDILocalTransport(void);
+	~CRTPMIDILocalTransport(void);
+
+	//! Creates the shared segment (session listener side). An existing segment with the same name is reset
+	//! \return false if the segment can not be created
+	bool Create (const char* Name);
+
+	//! Maps a segment created by another endpoint (session initiator side)
+	//! \return false if there is no segment with this name
+	bool Open (const char* Name);
+
+	//! Stops the transport. Memory stays mapped until next Create/Open or destruction, as other threads may still wake the endpoint
+	void Close (void);
+
+	bool IsOpen (void);
+
+	//! Sends a datagram on a channel to the other endpoint. Can be called from several threads
+	//! \return false if the ring is full or the datagram too large (datagram is dropped, as with UDP)
+	bool Send (int Channel, const void* Data, unsigned int Size);
+
+	//! Reads the oldest datagram received on a channel (truncated to MaxSize). Only called by the thread running the session
+	//! \return size of the datagram, 0 if there is none
+	unsigned int Receive (int Channel, unsigned char* Data, unsigned int MaxSize);
+
+	//! Returns true if a datagram is waiting on one of the channels
+	bool DataPending (void);
+
+	//! Blocks until a datagram is received, WakeSelf is called or Timeout (ms) elapses
+	//! \return true if a datagram is waiting
+	bool Wait (unsigned int Timeout);
+
+	//! Wakes up the thread blocked in Wait (used when MIDI data is queued for transmission)
+	void WakeSelf (void);
+
+private:
+	TRTPLocalSegment* Segment;
+	int Side;								// 0 : creator, 1 : other endpoint. Datagrams for endpoint n are in Rings[n]
+	std::atomic<bool> Opened;
+	char Path[RTP_LOCAL_MAX_NAME+16];
+#if defined (__TARGET_WIN__)
+	HANDLE Mapping;
+	HANDLE WakeEvent[2];
+#endif
+
+	//! Maps the segment and the wake up objects
+	bool Map (const char* Name, bool Creator);
+	//! Unmaps the segment of a previous session
+	void Release (void);
+	//! Signals an endpoint if it is blocked in Wait
+	void Signal (int Endpoint);
+};
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ *  RTP_MIDI_Scheduler.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Transmission of MIDI events at a future time of the session clock
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Producers push events (time, size, message) in a lock-free block queue. The
+ consumer (thread building the packets, under TransmitLock) moves them in a
+ min-heap ordered on time, then takes the events which are due. Times are
+ compared with a signed difference, so the session clock can wrap around.
+ */
+
+#include "RTP_MIDI_Scheduler.h"
+#include <string.h>
+
+// Size of an event in the intake queue : time (4 bytes), size (1 byte), message
+#define INTAKE_HEADER_SIZE		5
+// Size of the chunks used to drain the intake queue (must hold at least one event)
+#define INTAKE_DRAIN_CHUNK		64
+
+static_assert(INTAKE_DRAIN_CHUNK>=INTAKE_HEADER_SIZE+RTP_SCHEDULED_MAX_MSG, "INTAKE_DRAIN_CHUNK must hold the largest scheduled event");
+static_assert(RTP_SCHEDULE_SIZE>0, "RTP_SCHEDULE_SIZE must not be null");
+
+CRTPMIDIScheduler::CRTPMIDIScheduler(void)
+{
+	DroppedCount.store(0);
+	Reset();
+}  // CRTPMIDIScheduler::CRTPMIDIScheduler
+//---------------------------------------------------------------------------
+
+void CRTPMIDIScheduler::Reset (void)
+{
+	HeapCount=0;
+	DrainIntake();			// Events already pushed are discarded
+	HeapCount=0;
+	ArrivalCounter=0;
+}  // CRTPMIDIScheduler::Reset
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIScheduler::Push (unsigned int Time, unsigned int Size, const unsigned char* Data)
+{
+	unsigned char Block[INTAKE_HEADER_SIZE+RTP_SCHEDULED_MAX_MSG];
+
+	if ((Size==0)||(Size>RTP_SCHEDULED_MAX_MSG)) return false;
+
+	memcpy(&Block[0], &Time, sizeof(unsigned int));
+	Block[4]=(unsigned char)Size;
+	memcpy(&Block[INTAKE_HEADER_SIZE], Data, Size);
+	return Intake.Push(INTAKE_HEADER_SIZE+Size, &Block[0]);
+}  // CRTPMIDIScheduler::Push
+//---------------------------------------------------------------------------
+
+void CRTPMIDIScheduler::DrainIntake (void)
+{
+	unsigned char Blocks[INTAKE_DRAIN_CHUNK];
+	unsigned int Size;
+	unsigned int Pos;
+	TScheduledEvent Event;
+
+	// Queue is drained in small chunks to keep the stack use of the transmit path low
+	while ((Size=Intake.Pop(&Blocks[0], INTAKE_DRAIN_CHUNK))!=0)
+	{
+		Pos=0;
+		while (Pos+INTAKE_HEADER_SIZE<=Size)
+		{
+			memcpy(&Event.Time, &Blocks[Pos], sizeof(unsigned int));
+			Event.Size=Blocks[Pos+4];
+			memcpy(&Event.Data[0], &Blocks[Pos+INTAKE_HEADER_SIZE], Event.Size);
+			Pos+=INTAKE_HEADER_SIZE+Event.Size;
+
+			if (HeapCount>=RTP_SCHEDULE_SIZE)
+			{
+				DroppedCount.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			Event.Sequence=ArrivalCounter++;
+			HeapInsert(&Event);
+		}
+	}
+}  // CRTPMIDIScheduler::DrainIntake
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIScheduler::Before (TScheduledEvent* A, TScheduledEvent* B)
+{
+	if (A->Time!=B->Time) return ((int)(A->Time-B->Time)<0);
+	return ((int)(A->Sequence-B->Sequence)<0);
+}  // CRTPMIDIScheduler::Before
+//---------------------------------------------------------------------------
+
+void CRTPMIDIScheduler::HeapInsert (TScheduledEvent* Event)
+{
+	unsigned int Pos=HeapCount;
+	unsigned int Parent;
+
+	HeapCount++;
+	while (Pos>0)
+	{
+		Parent=(Pos-1)/2;
+		if (!Before(Event, &Heap[Parent])) break;
+		Heap[Pos]=Heap[Parent];
+		Pos=Parent;
+	}
+	Heap[Pos]=*Event;
+}  // CRTPMIDIScheduler::HeapInsert
+//---------------------------------------------------------------------------
+
+void CRTPMIDIScheduler::HeapRemoveTop (void)
+{
+	unsigned int Pos=0;
+	unsigned int Child;
+	TScheduledEvent* Last;
+
+	HeapCount--;
+	if (HeapCount==0) return;
+	Last=&Heap[HeapCount];
+
+	while (true)
+	{
+		Child=2*Pos+1;
+		if (Child>=HeapCount) break;
+		if ((Child+1<HeapCount)&&(Before(&Heap[Child+1], &Heap[Child]))) Child++;
+		if (!Before(&Heap[Child], Last)) break;
+		Heap[Pos]=Heap[Child];
+		Pos=Child;
+	}
+	Heap[Pos]=*Last;
+}  // CRTPMIDIScheduler::HeapRemoveTop
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIScheduler::IsDue (unsigned int Limit)
+{
+	DrainIntake();
+	if (HeapCount==0) return false;
+	return ((int)(Heap[0].Time-Limit)<=0);
+}  // CRTPMIDIScheduler::IsDue
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIScheduler::Generate (unsigned char* MIDIList, unsigned int MaxSize, unsigned int TimeStamp, unsigned int Limit)
+{
+	unsigned int Pos=0;
+	unsigned int Previous=TimeStamp;
+	unsigned int Delta;
+	unsigned int DeltaSize;
+	TScheduledEvent* Event;
+
+	DrainIntake();
+	while (HeapCount>0)
+	{
+		Event=&Heap[0];
+		if ((int)(Event->Time-Limit)>0) break;		// Not due yet
+
+		// Late events are sent immediately
+		if ((int)(Event->Time-Previous)>0) Delta=Event->Time-Previous;
+		else Delta=0;
+
+		if (Delta<0x80) DeltaSize=1;
+		else if (Delta<0x4000) DeltaSize=2;
+		else if (Delta<0x200000) DeltaSize=3;
+		else DeltaSize=4;
+		if (Pos+DeltaSize+Event->Size>MaxSize) break;
+
+		// Delta time (variable length, MSB first)
+		if (DeltaSize>=4) MIDIList[Pos++]=0x80|((Delta>>21)&0x7F);
+		if (DeltaSize>=3) MIDIList[Pos++]=0x80|((Delta>>14)&0x7F);
+		if (DeltaSize>=2) MIDIList[Pos++]=0x80|((Delta>>7)&0x7F);
+		MIDIList[Pos++]=Delta&0x7F;
+
+		memcpy(&MIDIList[Pos], &Event->Data[0], Event->Size);
+		Pos+=Event->Size;
+		Previous+=Delta;
+		HeapRemoveTop();
+	}
+	return Pos;
+}  // CRTPMIDIScheduler::Generate
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIScheduler::GetNextTime (unsigned int* Time)
+{
+	DrainIntake();
+	if (HeapCount==0) return false;
+	*Time=Heap[0].Time;
+	return true;
+}  // CRTPMIDIScheduler::GetNextTime
+//---------------------------------------------------------------------------
+
+bool CRTPMIDIScheduler::IntakePending (void)
+{
+	return (Intake.IsEmpty()==false);
+}  // CRTPMIDIScheduler::IntakePending
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDIScheduler::GetDroppedCount (void)
+{
+	return DroppedCount.load(std::memory_order_relaxed);
+}  // CRTPMIDIScheduler::GetDroppedCount
+//---------------------------------------------------------------------------
+
+void CRTPMIDIScheduler::ResetDroppedCount (void)
+{
+	DroppedCount.store(0, std::memory_order_relaxed);
+}  // CRTPMIDIScheduler::ResetDroppedCount
+//---------------------------------------------------------------------------
+
@@ -0,0 +1,101 @@
+/*
+ *  RTP_MIDI_Scheduler.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Transmission of MIDI events at a future time of the session clock
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_SCHEDULER_H__
+#define __RTP_MIDI_SCHEDULER_H__
+//---------------------------------------------------------------------------
+
+#include "RTP_MIDI_BlockQueue.h"
+
+// Maximum number of scheduled events waiting for their time (can be defined on the compiler command line)
+#ifndef RTP_SCHEDULE_SIZE
+#define RTP_SCHEDULE_SIZE		256
+#endif
+
+// Maximum size of one scheduled MIDI message (SYSEX must be sent with SendSysEx)
+#define RTP_SCHEDULED_MAX_MSG	12
+
+typedef struct {
+	unsigned int Time;			// Session clock (1/10 ms) at which the event must be played
+	unsigned int Sequence;		// Order of arrival (events with same time are sent in arrival order)
+	unsigned char Size;
+	unsigned char Data[RTP_SCHEDULED_MAX_MSG];
+} TScheduledEvent;
+
+class CRTPMIDIScheduler
+{
+public:
+	CRTPMIDIScheduler(void);
+
+	//! Consumer : forgets all scheduled events
+	void Reset (void);
+
+	//! Queues a MIDI message (without delta time) to be played at Time. Can be called from any number of threads
+	//! \return false if the message is too large or the intake queue is full
+	bool Push (unsigned int Time, unsigned int Size, const unsigned char* Data);
+
+	//! Consumer : writes the events due before Limit in MIDIList (with delta times relative to TimeStamp), in time order
+	//! \return number of bytes written. Events which do not fit in MaxSize stay for next packet
+	unsigned int Generate (unsigned char* MIDIList, unsigned int MaxSize, unsigned int TimeStamp, unsigned int Limit);
+
+	//! Consumer : returns true if an event is due before Limit
+	bool IsDue (unsigned int Limit);
+
+	//! Consumer : gets the time of the next event
+	//! \return false if no event is scheduled
+	bool GetNextTime (unsigned int* Time);
+
+	//! Returns true if events have been pushed and not yet taken by the consumer
+	bool IntakePending (void);
+
+	//! Returns the number of events dropped because too many events were scheduled
+	unsigned int GetDroppedCount (void);
+
+	//! Clears the number of dropped events (can be called from any thread)
+	void ResetDroppedCount (void);
+
+private:
+	CRTPMIDIBlockQueue Intake;			// Events pushed by producers, moved in the heap by the consumer
+	TScheduledEvent Heap[RTP_SCHEDULE_SIZE];	// Min-heap on Time (consumer only)
+	unsigned int HeapCount;
+	unsigned int ArrivalCounter;
+	std::atomic<unsigned int> DroppedCount;
+
+	//! Moves the events from intake queue to the heap
+	void DrainIntake (void);
+
+	//! Returns true if event A must be sent before event B
+	static bool Before (TScheduledEvent* A, TScheduledEvent* B);
+
+	void HeapInsert (TScheduledEvent* Event);
+	void HeapRemoveTop (void);
+};
+
+#endif
@@ -0,0 +1,756 @@
+/*
+ *  RTP_MIDI_SessionManager.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Multiple sessions on a single pair of control/data sockets
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ All sessions share the same control and data sockets. Incoming packets are
+ demultiplexed with two hash tables (one per socket) keyed on the partner IP
+ address and port. Packets which are not found in the tables are only accepted
+ when they are invitations : on control port, a new slot is allocated for the
+ partner (listener mode), on data port the session is found from the initiator
+ token sent in the control port invitation.
+ Tables are rebuilt each time the address of a session changes (invitation,
+ BY, new session). This only happens on session management events.
+ */
+
+#include "RTP_MIDI_SessionManager.h"
+#include "RTP_MIDI_EventLoop.h"
+#include <string.h>
+
+static unsigned int HashAddress (unsigned int IP, unsigned short Port)
+{
+	return (IP*2654435761u)^((unsigned int)Port*40503u);
+}  // HashAddress
+//---------------------------------------------------------------------------
+
+CRTP_MIDISessionManager::CRTP_MIDISessionManager(unsigned int MaxSessions, unsigned int SYXInSize, TRTPMIDIDataCallback CallbackFunc, void* UserInstance)
+{
+	unsigned int Index;
+
+	if (MaxSessions==0) MaxSessions=1;
+	if (MaxSessions>0xFFFE) MaxSessions=0xFFFE;
+	this->MaxSessions=MaxSessions;
+	this->AcceptInvitations=false;
+	this->Capture=0;
+	this->ControlSocket=INVALID_SOCKET;
+	this->DataSocket=INVALID_SOCKET;
+	this->Family=AF_INET;
+
+	// Everything is allocated here, so RunSession never allocates memory
+	Sessions=new TManagedSession[MaxSessions];
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		Sessions[Index].Session=new CRTP_MIDI(SYXInSize, CallbackFunc, UserInstance);
+		Sessions[Index].SlotState.store(MANAGED_SLOT_FREE);
+		Sessions[Index].Listener=false;
+		Sessions[Index].KeyIP=0;
+		Sessions[Index].KeyCtrlPort=0;
+		Sessions[Index].KeyDataPort=0;
+#ifdef RTP_MIDI_TRACE
+		Sessions[Index].Session->Trace=&Trace;
+#endif
+	}
+
+	HashSize=16;
+	while (HashSize<4*MaxSessions) HashSize*=2;
+	ControlTable=new TSessionHashEntry[HashSize];
+	DataTable=new TSessionHashEntry[HashSize];
+	RebuildTables();
+
+	GroupHeaders=new TRTPGroupHeader[MaxSessions];
+	GroupSessions=new unsigned int[MaxSessions];
+#if defined (__TARGET_LINUX__)
+	GroupMessages=new mmsghdr[MaxSessions];
+	GroupVectors=new iovec[3*MaxSessions];
+#endif
+}  // CRTP_MIDISessionManager::CRTP_MIDISessionManager
+//---------------------------------------------------------------------------
+
+CRTP_MIDISessionManager::~CRTP_MIDISessionManager(void)
+{
+	unsigned int Index;
+
+	Close();
+
+	for (Index=0; Index<MaxSessions; Index++)
+		delete Sessions[Index].Session;
+	delete [] Sessions;
+	delete [] ControlTable;
+	delete [] DataTable;
+	delete [] GroupHeaders;
+	delete [] GroupSessions;
+#if defined (__TARGET_LINUX__)
+	delete [] GroupMessages;
+	delete [] GroupVectors;
+#endif
+}  // CRTP_MIDISessionManager::~CRTP_MIDISessionManager
+//---------------------------------------------------------------------------
+
+int CRTP_MIDISessionManager::Open (unsigned short LocalCtrlPort, unsigned short LocalDataPort, bool DualStack)
+{
+	bool SocketOK;
+
+	Close();
+
+	if (DualStack)
+	{
+		Family=AF_INET6;
+		SocketOK=CRTP_MIDI::CreateDualStackSocket(&ControlSocket, LocalCtrlPort);
+	}
+	else
+	{
+		Family=AF_INET;
+		SocketOK=CreateUDPSocket(&ControlSocket, LocalCtrlPort, false);
+	}
+	if (SocketOK==false)
+		return -1;
+
+	if (DualStack) SocketOK=CRTP_MIDI::CreateDualStackSocket(&DataSocket, LocalDataPort);
+	else SocketOK=CreateUDPSocket(&DataSocket, LocalDataPort, false);
+	if (SocketOK==false)
+	{
+		CloseSocket(&ControlSocket);
+		ControlSocket=INVALID_SOCKET;
+		return -2;
+	}
+	return 0;
+}  // CRTP_MIDISessionManager::Open
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::Close (void)
+{
+	unsigned int Index;
+	CRTP_MIDI* Session;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		if (Sessions[Index].SlotState.load()!=MANAGED_SLOT_FREE)
+		{
+			Session=Sessions[Index].Session;
+			Session->SocketLocked=true;
+			if ((Session->SessionState!=SESSION_CLOSED)&&(Session->SessionState!=SESSION_WAIT_INVITE_CTRL)&&(Session->SessionState!=SESSION_CLOSING))
+				Session->SendBYCommand();
+			Session->SessionState=SESSION_CLOSED;
+			Session->CloseRequest.store(-1);
+			Session->CloseSockets();
+			Sessions[Index].SlotState.store(MANAGED_SLOT_FREE);
+		}
+	}
+	RebuildTables();
+
+	if (ControlSocket!=INVALID_SOCKET)
+		CloseSocket(&ControlSocket);
+	if (DataSocket!=INVALID_SOCKET)
+		CloseSocket(&DataSocket);
+	ControlSocket=INVALID_SOCKET;
+	DataSocket=INVALID_SOCKET;
+}  // CRTP_MIDISessionManager::Close
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::SetAcceptInvitations (bool Accept)
+{
+	this->AcceptInvitations=Accept;
+}  // CRTP_MIDISessionManager::SetAcceptInvitations
+//---------------------------------------------------------------------------
+
+int CRTP_MIDISessionManager::AddSession (unsigned int DestIP, unsigned short DestCtrlPort, unsigned short DestDataPort)
+{
+	TRTPMIDIAddress DestAddress;
+
+	CRTP_MIDI::MakeIPv4Address(DestIP, Family, &DestAddress);
+	return AttachNewSession(&DestAddress, DestCtrlPort, DestDataPort);
+}  // CRTP_MIDISessionManager::AddSession
+//---------------------------------------------------------------------------
+
+int CRTP_MIDISessionManager::AddSessionAddress (const char* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort)
+{
+	TRTPMIDIAddress Destination;
+
+	if (CRTP_MIDI::ParseAddress(DestAddress, Family, &Destination)==false) return -1;
+	return AttachNewSession(&Destination, DestCtrlPort, DestDataPort);
+}  // CRTP_MIDISessionManager::AddSessionAddress
+//---------------------------------------------------------------------------
+
+int CRTP_MIDISessionManager::AttachNewSession (const TRTPMIDIAddress* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort)
+{
+	unsigned int Index;
+	int ExpectedState;
+
+	if ((ControlSocket==INVALID_SOCKET)||(DataSocket==INVALID_SOCKET)) return -1;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		ExpectedState=MANAGED_SLOT_FREE;
+		if (Sessions[Index].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_RESERVED))
+		{
+			// Realtime thread does not touch a reserved slot : we can configure the session safely
+			Sessions[Index].Listener=false;
+			Sessions[Index].Session->AttachSession(ControlSocket, DataSocket, Family, DestAddress, DestCtrlPort, DestDataPort, true);
+			Sessions[Index].SlotState.store(MANAGED_SLOT_ADD_PENDING, std::memory_order_release);
+			return (int)Index;
+		}
+	}
+	return -1;
+}  // CRTP_MIDISessionManager::AttachNewSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::RemoveSession (int Index)
+{
+	int ExpectedState;
+
+	if ((Index<0)||((unsigned int)Index>=MaxSessions)) return;
+
+	ExpectedState=MANAGED_SLOT_ACTIVE;
+	if (Sessions[Index].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_REMOVE_PENDING)) return;
+	ExpectedState=MANAGED_SLOT_ADD_PENDING;
+	Sessions[Index].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_REMOVE_PENDING);
+}  // CRTP_MIDISessionManager::RemoveSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::CloseAll (unsigned int Deadline)
+{
+	unsigned int Index;
+	int ExpectedState;
+	CRTP_MIDI* Session;
+	CRTP_MIDIEventLoop* WakeLoop;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		Session=Sessions[Index].Session;
+
+		// Sessions not started yet are just removed
+		ExpectedState=MANAGED_SLOT_ADD_PENDING;
+		if (Sessions[Index].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_REMOVE_PENDING)) continue;
+
+		// The close request is set before the slot changes, so RunSession never frees a slot which has not sent its BY
+		if (Sessions[Index].SlotState.load(std::memory_order_acquire)!=MANAGED_SLOT_ACTIVE) continue;
+		Session->CloseRequest.store((int)(Deadline/RTP_BY_REPEAT_INTERVAL), std::memory_order_release);
+		ExpectedState=MANAGED_SLOT_ACTIVE;
+		Sessions[Index].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_CLOSING);
+	}
+
+	WakeLoop=Sessions[0].Session->WakeLoop;
+	if (WakeLoop!=0) WakeLoop->Wake();
+}  // CRTP_MIDISessionManager::CloseAll
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDISessionManager::IsClosePending (void)
+{
+	unsigned int Index;
+	int SlotState;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		SlotState=Sessions[Index].SlotState.load(std::memory_order_acquire);
+		if ((SlotState==MANAGED_SLOT_REMOVE_PENDING)||(SlotState==MANAGED_SLOT_CLOSING)) return true;
+	}
+	return false;
+}  // CRTP_MIDISessionManager::IsClosePending
+//---------------------------------------------------------------------------
+
+CRTP_MIDI* CRTP_MIDISessionManager::GetSession (int Index)
+{
+	if ((Index<0)||((unsigned int)Index>=MaxSessions)) return 0;
+	return Sessions[Index].Session;
+}  // CRTP_MIDISessionManager::GetSession
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDISessionManager::IsSessionActive (int Index)
+{
+	if ((Index<0)||((unsigned int)Index>=MaxSessions)) return false;
+	return (Sessions[Index].SlotState.load(std::memory_order_acquire)==MANAGED_SLOT_ACTIVE);
+}  // CRTP_MIDISessionManager::IsSessionActive
+//---------------------------------------------------------------------------
+
+unsigned int CRTP_MIDISessionManager::GetMaxSessions (void)
+{
+	return MaxSessions;
+}  // CRTP_MIDISessionManager::GetMaxSessions
+//---------------------------------------------------------------------------
+
+int CRTP_MIDISessionManager::Lookup (TSessionHashEntry* Table, unsigned int IP, unsigned short Port)
+{
+	unsigned int Entry;
+
+	Entry=HashAddress(IP, Port)&(HashSize-1);
+	while (Table[Entry].SessionIndex!=0xFFFF)
+	{
+		if ((Table[Entry].IP==IP)&&(Table[Entry].Port==Port))
+			return Table[Entry].SessionIndex;
+		Entry=(Entry+1)&(HashSize-1);
+	}
+	return -1;
+}  // CRTP_MIDISessionManager::Lookup
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::Insert (TSessionHashEntry* Table, unsigned int IP, unsigned short Port, unsigned short Index)
+{
+	unsigned int Entry;
+
+	Entry=HashAddress(IP, Port)&(HashSize-1);
+	while (Table[Entry].SessionIndex!=0xFFFF)
+	{
+		if ((Table[Entry].IP==IP)&&(Table[Entry].Port==Port)) return;		// First session recorded keeps the address
+		Entry=(Entry+1)&(HashSize-1);
+	}
+	Table[Entry].IP=IP;
+	Table[Entry].Port=Port;
+	Table[Entry].SessionIndex=Index;
+}  // CRTP_MIDISessionManager::Insert
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::RebuildTables (void)
+{
+	unsigned int Index;
+	CRTP_MIDI* Session;
+
+	for (Index=0; Index<HashSize; Index++)
+	{
+		ControlTable[Index].SessionIndex=0xFFFF;
+		DataTable[Index].SessionIndex=0xFFFF;
+	}
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		Sessions[Index].KeyIP=0;
+		Sessions[Index].KeyCtrlPort=0;
+		Sessions[Index].KeyDataPort=0;
+		if (Sessions[Index].SlotState.load(std::memory_order_relaxed)!=MANAGED_SLOT_ACTIVE) continue;
+
+		// Session initiators are known by the address they invite, listeners by the address of the partner which invited them
+		Session=Sessions[Index].Session;
+		if (Session->IsInitiatorNode) Sessions[Index].KeyIP=Session->RemoteIPToInvite;
+		else Sessions[Index].KeyIP=Session->SessionPartnerIP;
+		Sessions[Index].KeyCtrlPort=Session->PartnerControlPort;
+		Sessions[Index].KeyDataPort=Session->PartnerDataPort;
+
+		if (Sessions[Index].KeyIP==0) continue;
+		if (Sessions[Index].KeyCtrlPort!=0)
+			Insert(ControlTable, Sessions[Index].KeyIP, Sessions[Index].KeyCtrlPort, (unsigned short)Index);
+		if (Sessions[Index].KeyDataPort!=0)
+			Insert(DataTable, Sessions[Index].KeyIP, Sessions[Index].KeyDataPort, (unsigned short)Index);
+	}
+}  // CRTP_MIDISessionManager::RebuildTables
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::UpdateSessionKey (int Index)
+{
+	CRTP_MIDI* Session=Sessions[Index].Session;
+	unsigned int IP;
+
+	if (Session->IsInitiatorNode) IP=Session->RemoteIPToInvite;
+	else IP=Session->SessionPartnerIP;
+
+	if ((IP!=Sessions[Index].KeyIP)||
+		(Session->PartnerControlPort!=Sessions[Index].KeyCtrlPort)||
+		(Session->PartnerDataPort!=Sessions[Index].KeyDataPort))
+	{
+		RebuildTables();
+	}
+}  // CRTP_MIDISessionManager::UpdateSessionKey
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::SendRejection (TRTPReceiveSlot* Slot)
+{
+	TSessionPacketNoName Reply;
+	TSessionPacketNoName* Invitation;
+
+	Invitation=(TSessionPacketNoName*)&Slot->Data[0];
+
+	Reply.Reserved1=0xFF;
+	Reply.Reserved2=0xFF;
+	Reply.CommandH='N';
+	Reply.CommandL='O';
+	Reply.ProtocolVersion=htonl(2);
+	Reply.InitiatorToken=Invitation->InitiatorToken;		// Already in network order
+	Reply.SSRC=0;
+
+	if (Capture!=0) Capture->Record(CRTP_MIDI::GetSystemTime(), RTP_CAPTURE_SENT|RTP_CAPTURE_OTHER, &Reply, sizeof(TSessionPacketNoName));
+	sendto(ControlSocket, (const char*)&Reply, sizeof(TSessionPacketNoName), 0, &Slot->SenderAddress.Generic, CRTP_MIDI::GetAddressLength(&Slot->SenderAddress));
+}  // CRTP_MIDISessionManager::SendRejection
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::CaptureUnmatched (TRTPReceiveSlot* Slot, unsigned int Flags)
+{
+	if (Capture==0) return;
+	if (Slot->Size<=0) return;
+	Capture->Record(CRTP_MIDI::GetSystemTime(), Flags|RTP_CAPTURE_OTHER, &Slot->Data[0], Slot->Size);
+}  // CRTP_MIDISessionManager::CaptureUnmatched
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::DispatchControlPacket (TRTPReceiveSlot* Slot)
+{
+	int Index;
+	unsigned int FreeIndex;
+	int ExpectedState;
+	CRTP_MIDI* Session;
+
+	if ((Slot->Size<(int)sizeof(TSessionPacketNoName))||		// Only session messages are expected on control port
+		(Slot->Data[0]!=0xFF)||(Slot->Data[1]!=0xFF))
+	{
+		CaptureUnmatched(Slot, 0);
+		return;
+	}
+
+	Index=Lookup(ControlTable, Slot->SenderIP, Slot->SenderPort);
+	if (Index<0)
+	{  // Unknown partner : only an invitation is accepted
+		if ((Slot->Data[2]!='I')||(Slot->Data[3]!='N'))
+		{
+			CaptureUnmatched(Slot, 0);
+			return;
+		}
+
+		if (AcceptInvitations)
+		{
+			for (FreeIndex=0; FreeIndex<MaxSessions; FreeIndex++)
+			{
+				ExpectedState=MANAGED_SLOT_FREE;
+				if (Sessions[FreeIndex].SlotState.compare_exchange_strong(ExpectedState, MANAGED_SLOT_ACTIVE))
+				{
+					Index=(int)FreeIndex;
+					break;
+				}
+			}
+		}
+		if (Index<0)
+		{
+			CaptureUnmatched(Slot, 0);
+			SendRejection(Slot);
+			return;
+		}
+
+		// Start a listener session on the new slot, it will accept the invitation
+		Sessions[Index].Listener=true;
+		Sessions[Index].Session->AttachSession(ControlSocket, DataSocket, Family, 0, 0, 0, false);
+	}
+
+	Session=Sessions[Index].Session;
+	Session->ProcessControlPacket(Slot, &Session->InvitationAcceptedOnCtrl, &Session->InvitationRejectedOnCtrl);
+	UpdateSessionKey(Index);
+}  // CRTP_MIDISessionManager::DispatchControlPacket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::DispatchDataPacket (TRTPReceiveSlot* Slot)
+{
+	int Index;
+	unsigned int SearchIndex;
+	unsigned int Token;
+	CRTP_MIDI* Session;
+
+	if (Slot->Size<=0) return;
+
+	Index=Lookup(DataTable, Slot->SenderIP, Slot->SenderPort);
+	if (Index<0)
+	{  // Data port of partner is not known yet : search the listener which accepted the invitation on control port
+		if ((Slot->Size<(int)sizeof(TSessionPacketNoName))||
+			(Slot->Data[0]!=0xFF)||(Slot->Data[1]!=0xFF)||(Slot->Data[2]!='I')||(Slot->Data[3]!='N'))
+		{
+			CaptureUnmatched(Slot, RTP_CAPTURE_DATA);
+			return;
+		}
+
+		Token=htonl(((TSessionPacketNoName*)&Slot->Data[0])->InitiatorToken);
+		for (SearchIndex=0; SearchIndex<MaxSessions; SearchIndex++)
+		{
+			if (Sessions[SearchIndex].SlotState.load(std::memory_order_relaxed)!=MANAGED_SLOT_ACTIVE) continue;
+			Session=Sessions[SearchIndex].Session;
+			if ((Session->IsInitiatorNode==false)&&
+				(Session->SessionState==SESSION_WAIT_INVITE_DATA)&&
+				(Session->IsPartner(Slot))&&
+				(Session->InitiatorToken==Token))
+			{
+				Index=(int)SearchIndex;
+				break;
+			}
+		}
+		if (Index<0)
+		{
+			CaptureUnmatched(Slot, RTP_CAPTURE_DATA);
+			return;
+		}
+	}
+
+	Session=Sessions[Index].Session;
+	Session->ProcessDataPacket(Slot, &Session->InvitationAcceptedOnData, &Session->InvitationRejectedOnData);
+	// RTP-MIDI packets never change the session address
+	if (Slot->Data[0]==0xFF) UpdateSessionKey(Index);
+}  // CRTP_MIDISessionManager::DispatchDataPacket
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::UpdateSlots (void)
+{
+	unsigned int Index;
+	int SlotState;
+	bool TablesChanged=false;
+	CRTP_MIDI* Session;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		SlotState=Sessions[Index].SlotState.load(std::memory_order_acquire);
+		Session=Sessions[Index].Session;
+
+		if (SlotState==MANAGED_SLOT_ADD_PENDING)
+		{
+			Sessions[Index].SlotState.store(MANAGED_SLOT_ACTIVE);
+			TablesChanged=true;
+		}
+		else if (SlotState==MANAGED_SLOT_REMOVE_PENDING)
+		{
+			Session->SocketLocked=true;
+			if ((Session->SessionState!=SESSION_CLOSED)&&(Session->SessionState!=SESSION_WAIT_INVITE_CTRL)&&(Session->SessionState!=SESSION_CLOSING))
+				Session->SendBYCommand();		// Sockets stay opened, no need to wait before releasing them
+			Session->SessionState=SESSION_CLOSED;
+			Session->CloseSockets();
+			Sessions[Index].SlotState.store(MANAGED_SLOT_FREE, std::memory_order_release);
+			TablesChanged=true;
+		}
+		else if ((SlotState==MANAGED_SLOT_CLOSING)&&(Session->IsClosing()==false))
+		{  // Last BY has been sent
+			Session->SocketLocked=true;
+			Session->SessionState=SESSION_CLOSED;
+			Session->CloseSockets();
+			Sessions[Index].SlotState.store(MANAGED_SLOT_FREE, std::memory_order_release);
+			TablesChanged=true;
+		}
+		else if ((SlotState==MANAGED_SLOT_ACTIVE)&&(Sessions[Index].Listener)&&(Session->SessionState==SESSION_WAIT_INVITE_CTRL))
+		{  // Listener session has been closed by partner or has timed out : give the slot back
+			Session->SocketLocked=true;
+			Session->SessionState=SESSION_CLOSED;
+			Session->CloseSockets();
+			Sessions[Index].SlotState.store(MANAGED_SLOT_FREE, std::memory_order_release);
+			TablesChanged=true;
+		}
+	}
+
+	if (TablesChanged) RebuildTables();
+}  // CRTP_MIDISessionManager::UpdateSlots
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::RunSession (void)
+{
+	unsigned int Index;
+	int SlotCount;
+	int ControlSlotCount;
+	int Slot;
+	int SlotState;
+
+	if ((ControlSocket==INVALID_SOCKET)||(DataSocket==INVALID_SOCKET)) return;
+	RTP_TRACE_TICK_START(&Trace);
+
+	UpdateSlots();
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		SlotState=Sessions[Index].SlotState.load(std::memory_order_relaxed);
+		if ((SlotState==MANAGED_SLOT_ACTIVE)||(SlotState==MANAGED_SLOT_CLOSING))
+			Sessions[Index].Session->BeginTick();
+	}
+
+	// Flush both sockets, dispatching each packet to its session
+	do
+	{
+		RTP_TRACE_STAMP(ControlStart);
+		ControlSlotCount=CRTP_MIDI::ReceiveBatch(ControlSocket, &ReceiveSlots[0]);
+		RTP_TRACE_ADD(&Trace, RTP_TRACE_RECEIVE, ControlStart);
+		RTP_TRACE_PACKETS_ADD(&Trace, ControlSlotCount);
+		RTP_TRACE_DECODE_START(ControlDecodeStart, ControlCallbackMark, &Trace);
+		for (Slot=0; Slot<ControlSlotCount; Slot++)
+			DispatchControlPacket(&ReceiveSlots[Slot]);
+		RTP_TRACE_DECODE_END(&Trace, ControlDecodeStart, ControlCallbackMark);
+
+		RTP_TRACE_STAMP(DataStart);
+		SlotCount=CRTP_MIDI::ReceiveBatch(DataSocket, &ReceiveSlots[0]);
+		RTP_TRACE_ADD(&Trace, RTP_TRACE_RECEIVE, DataStart);
+		RTP_TRACE_PACKETS_ADD(&Trace, SlotCount);
+		RTP_TRACE_DECODE_START(DataDecodeStart, DataCallbackMark, &Trace);
+		for (Slot=0; Slot<SlotCount; Slot++)
+			DispatchDataPacket(&ReceiveSlots[Slot]);
+		RTP_TRACE_DECODE_END(&Trace, DataDecodeStart, DataCallbackMark);
+	} while ((ControlSlotCount==RTP_RECEIVE_SLOTS)||(SlotCount==RTP_RECEIVE_SLOTS));
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		SlotState=Sessions[Index].SlotState.load(std::memory_order_relaxed);
+		if (SlotState==MANAGED_SLOT_ACTIVE)
+		{
+			Sessions[Index].Session->EndTick();
+			UpdateSessionKey((int)Index);
+		}
+		else if (SlotState==MANAGED_SLOT_CLOSING)
+			Sessions[Index].Session->EndTick();
+	}
+
+	RTP_TRACE_STAMP(GroupStart);
+	SendGroupPacket();
+	RTP_TRACE_ADD(&Trace, RTP_TRACE_SEND, GroupStart);
+	RTP_TRACE_TICK_END(&Trace);
+}  // CRTP_MIDISessionManager::RunSession
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::SetClockSource (int Source)
+{
+	unsigned int Index;
+
+	for (Index=0; Index<MaxSessions; Index++)
+		Sessions[Index].Session->SetClockSource(Source);
+}  // CRTP_MIDISessionManager::SetClockSource
+//---------------------------------------------------------------------------
+
+unsigned int CRTP_MIDISessionManager::GetTimeToNextEvent (void)
+{
+	unsigned int Index;
+	unsigned int NextEvent=0xFFFFFFFF;
+	unsigned int SessionEvent;
+	int SlotState;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		SlotState=Sessions[Index].SlotState.load(std::memory_order_acquire);
+		// Slot changes requested by the application are applied by RunSession
+		if ((SlotState==MANAGED_SLOT_ADD_PENDING)||(SlotState==MANAGED_SLOT_REMOVE_PENDING)) return 0;
+		if (GroupQueue.IsEmpty()==false) return 0;
+		if ((SlotState!=MANAGED_SLOT_ACTIVE)&&(SlotState!=MANAGED_SLOT_CLOSING)) continue;
+
+		SessionEvent=Sessions[Index].Session->GetTimeToNextEvent();
+		if (SessionEvent<NextEvent) NextEvent=SessionEvent;
+	}
+	return NextEvent;
+}  // CRTP_MIDISessionManager::GetTimeToNextEvent
+//---------------------------------------------------------------------------
+
+bool CRTP_MIDISessionManager::SendGroupBlock (unsigned int Size, unsigned char* Data)
+{
+	CRTP_MIDIEventLoop* WakeLoop;
+
+	if (Size==0) return true;
+	if (Size>MAX_RTP_LOAD) return false;
+	if (GroupQueue.Push(Size, Data)==false) return false;
+
+	// The event loop serving the manager is declared in all sessions
+	WakeLoop=Sessions[0].Session->WakeLoop;
+	if (WakeLoop!=0) WakeLoop->Wake();
+	return true;
+}  // CRTP_MIDISessionManager::SendGroupBlock
+//---------------------------------------------------------------------------
+
+CRTPMIDITrace* CRTP_MIDISessionManager::GetTrace (void)
+{
+#ifdef RTP_MIDI_TRACE
+	return &Trace;
+#else
+	return 0;
+#endif
+}  // CRTP_MIDISessionManager::GetTrace
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::SetCapture (CRTPMIDICapture* NewCapture)
+{
+	this->Capture=NewCapture;
+}  // CRTP_MIDISessionManager::SetCapture
+//---------------------------------------------------------------------------
+
+void CRTP_MIDISessionManager::SendGroupPacket (void)
+{
+	unsigned int Index;
+	unsigned int MaxSize=MAX_RTP_LOAD;
+	unsigned int ListSize;
+	unsigned int JournalSize;
+	unsigned int PeerCount=0;
+	unsigned int Peer;
+	CRTP_MIDI* Session;
+#if defined (__TARGET_LINUX__)
+	int Sent;
+#endif
+
+	if (GroupQueue.IsEmpty()) return;
+
+	// The shared MIDI list must fit in the payload of every session
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		if (Sessions[Index].SlotState.load(std::memory_order_relaxed)!=MANAGED_SLOT_ACTIVE) continue;
+		Session=Sessions[Index].Session;
+		if ((Session->SessionState==SESSION_OPENED)&&(Session->MaxPayloadSize<MaxSize)) MaxSize=Session->MaxPayloadSize;
+	}
+	ListSize=GroupQueue.Pop(&GroupList[0], MaxSize);
+	if (ListSize==0) return;
+
+	for (Index=0; Index<MaxSessions; Index++)
+	{
+		if (Sessions[Index].SlotState.load(std::memory_order_relaxed)!=MANAGED_SLOT_ACTIVE) continue;
+		Session=Sessions[Index].Session;
+		if (Session->BeginGroupPacket(&GroupHeaders[PeerCount], &GroupList[0], ListSize, &JournalSize)==false) continue;
+		GroupSessions[PeerCount]=Index;
+
+#if defined (__TARGET_LINUX__)
+		GroupVectors[3*PeerCount].iov_base=&GroupHeaders[PeerCount];
+		GroupVectors[3*PeerCount].iov_len=sizeof(TRTPGroupHeader);
+		GroupVectors[3*PeerCount+1].iov_base=&GroupList[0];
+		GroupVectors[3*PeerCount+1].iov_len=ListSize;
+		GroupVectors[3*PeerCount+2].iov_base=&Session->JournalBuffer[0];
+		GroupVectors[3*PeerCount+2].iov_len=JournalSize;
+		memset(&GroupMessages[PeerCount].msg_hdr, 0, sizeof(msghdr));
+		GroupMessages[PeerCount].msg_hdr.msg_name=&Session->PartnerDataAddress;
+		GroupMessages[PeerCount].msg_hdr.msg_namelen=Session->PartnerAddressLength;
+		GroupMessages[PeerCount].msg_hdr.msg_iov=&GroupVectors[3*PeerCount];
+		GroupMessages[PeerCount].msg_hdr.msg_iovlen=(JournalSize>0)?3:2;
+		if (Session->Capture!=0)
+		{
+			memcpy(&GroupPacket, &GroupHeaders[PeerCount], sizeof(TRTPGroupHeader));
+			memcpy(&GroupPacket.Payload.MIDIList[0], &GroupList[0], ListSize);
+			if (JournalSize>0) memcpy(&GroupPacket.Payload.MIDIList[ListSize], &Session->JournalBuffer[0], JournalSize);
+			Session->CaptureSent(RTP_CAPTURE_DATA, &GroupPacket, sizeof(TRTPGroupHeader)+ListSize+JournalSize);
+		}
+#else
+		// No batched transmission on this platform : one datagram per session
+		memcpy(&GroupPacket, &GroupHeaders[PeerCount], sizeof(TRTPGroupHeader));
+		memcpy(&GroupPacket.Payload.MIDIList[0], &GroupList[0], ListSize);
+		if (JournalSize>0) memcpy(&GroupPacket.Payload.MIDIList[ListSize], &Session->JournalBuffer[0], JournalSize);
+		Session->CaptureSent(RTP_CAPTURE_DATA, &GroupPacket, sizeof(TRTPGroupHeader)+ListSize+JournalSize);
+		sendto(DataSocket, (const char*)&GroupPacket, sizeof(TRTPGroupHeader)+ListSize+JournalSize, 0, &Session->PartnerDataAddress.Generic, Session->PartnerAddressLength);
+#endif
+		PeerCount++;
+	}
+
+#if defined (__TARGET_LINUX__)
+	// All datagrams leave with one system call (sendmmsg may send only a part of them if socket buffer is full)
+	// sendmmsg stops at the first datagram which fails (unreachable peer, EMSGSIZE) : it is skipped so the other peers still get the packet
+	Peer=0;
+	while (Peer<PeerCount)
+	{
+		Sent=sendmmsg(DataSocket, &GroupMessages[Peer], PeerCount-Peer, 0);
+		if (Sent<=0) Peer++;
+		else Peer+=(unsigned int)Sent;
+	}
+#endif
+
+	// Journal buffers have been sent : sessions can build their next packets
+	for (Peer=0; Peer<PeerCount; Peer++)
+		Sessions[GroupSessions[Peer]].Session->EndGroupPacket();
+}  // CRTP_MIDISessionManager::SendGroupPacket
+//---------------------------------------------------------------------------
@@ -0,0 +1,198 @@
+/*
+ *  RTP_MIDI_SessionManager.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Multiple sessions on a single pair of control/data sockets
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_SESSIONMANAGER_H__
+#define __RTP_MIDI_SESSIONMANAGER_H__
+//---------------------------------------------------------------------------
+
+#include "RTP_MIDI.h"
+#include <atomic>
+
+// State of a session slot in the manager
+#define MANAGED_SLOT_FREE			0	// Slot not used (can be allocated by AddSession or by an incoming invitation)
+#define MANAGED_SLOT_RESERVED		1	// Slot being configured by AddSession
+#define MANAGED_SLOT_ADD_PENDING	2	// Slot configured, will be activated on next RunSession call
+#define MANAGED_SLOT_ACTIVE			3	// Session is run by the manager
+#define MANAGED_SLOT_REMOVE_PENDING	4	// Session will be closed on next RunSession call
+#define MANAGED_SLOT_CLOSING		5	// Session is sending its BY messages (CloseAll), slot is freed when session is closed
+
+typedef struct {
+	unsigned int IP;
+	unsigned short Port;
+	unsigned short SessionIndex;	// 0xFFFF : empty entry
+} TSessionHashEntry;
+
+typedef struct {
+	CRTP_MIDI* Session;
+	std::atomic<int> SlotState;
+	bool Listener;					// Slot has been allocated by an incoming invitation
+	// Address under which the session is recorded in the hash tables
+	unsigned int KeyIP;
+	unsigned short KeyCtrlPort;
+	unsigned short KeyDataPort;
+} TManagedSession;
+
+class CRTP_MIDISessionManager
+{
+	friend class CRTP_MIDIEventLoop;
+
+public:
+	//! \param MaxSessions maximum number of sessions served by the manager (all session objects are created by the constructor)
+	//! \param SYXInSize size of incoming SYSEX buffer of each session
+	//! \param CallbackFunc callback declared for all sessions (can be changed per session with GetSession(n)->SetCallback)
+	//! \param UserInstance value which will be passed in the callback function
+	CRTP_MIDISessionManager(unsigned int MaxSessions,
+							unsigned int SYXInSize,
+							TRTPMIDIDataCallback CallbackFunc,
+							void* UserInstance);
+	~CRTP_MIDISessionManager(void);
+
+	//! Opens the control and data sockets shared by all sessions
+	//! \param DualStack true : IPv6 sockets also accepting IPv4 devices
+	// \return 0=sockets opened -1=can not create control socket -2=can not create data socket
+	int Open (unsigned short LocalCtrlPort, unsigned short LocalDataPort, bool DualStack=false);
+
+	//! Closes all sessions then the sockets. Shall not be called while RunSession is running
+	void Close (void);
+
+	//! Allows remote devices to open sessions with the manager (a free slot is used for each new partner)
+	void SetAcceptInvitations (bool Accept);
+
+	//! Adds a session initiated by the manager. The session is started on next RunSession call
+	//! \return index of the session (use GetSession to access it), -1 if no slot is available or sockets are not opened
+	int AddSession (unsigned int DestIP, unsigned short DestCtrlPort, unsigned short DestDataPort);
+
+	//! Same as above with a numeric IPv4 or IPv6 address (IPv6 partners need dual-stack sockets, see Open)
+	//! \return -1 also if address is invalid
+	int AddSessionAddress (const char* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort);
+
+	//! Closes a session (a BY is sent to the partner on next RunSession call) and frees its slot
+	void RemoveSession (int Index);
+
+	//! Closes all sessions without blocking : BY messages are sent by RunSession to all partners at the same time and
+	//! repeated every RTP_BY_REPEAT_INTERVAL, so all slots are free after Deadline ms. Can be called from any thread
+	void CloseAll (unsigned int Deadline);
+
+	//! Returns true while sessions closed by CloseAll or RemoveSession are still using their slot
+	bool IsClosePending (void);
+
+	//! Returns the session object in a given slot (valid for the whole life of the manager, even if slot is free)
+	CRTP_MIDI* GetSession (int Index);
+
+	//! Returns true if the slot is running a session
+	bool IsSessionActive (int Index);
+
+	unsigned int GetMaxSessions (void);
+
+	//! Main processing function to call from high priority thread every millisecond (replaces CRTP_MIDI::RunSession for all sessions)
+	void RunSession (void);
+
+	//! Selects the clock source of all sessions (see CRTP_MIDI::SetClockSource)
+	void SetClockSource (int Source);
+
+	//! Returns the time (in ms) before RunSession has something to do for one of the sessions (0xFFFFFFFF : nothing scheduled)
+	unsigned int GetTimeToNextEvent (void);
+
+	//! Queues a MIDI block (starting with a delta time) for all opened sessions. Can be called from any thread
+	//! The MIDI list is built once per tick and only the header (and journal) are specific to each session
+	//! A block larger than the maximum payload of one of the sessions is discarded
+	//! \return false if there is no room in the group queue
+	bool SendGroupBlock (unsigned int Size, unsigned char* Data);
+
+	//! Returns the histograms and trace events of RunSession (shared by all sessions), 0 if compiled without RTP_MIDI_TRACE
+	CRTPMIDITrace* GetTrace (void);
+
+	//! Records the datagrams which are not dispatched to a session (unknown devices, invitations rejected because no slot is free)
+	//! and the rejections sent, with the system clock (see CRTP_MIDI::GetSystemTime). 0 : no capture
+	//! Datagrams dispatched to a session are recorded by the capture of the session (GetSession(n)->SetCapture)
+	void SetCapture (CRTPMIDICapture* Capture);
+
+private:
+	unsigned int MaxSessions;
+	TManagedSession* Sessions;
+	bool AcceptInvitations;
+	CRTPMIDICapture* Capture;			// Buffer recording the datagrams not dispatched to a session (0 : no capture)
+
+	TSOCKTYPE ControlSocket;
+	TSOCKTYPE DataSocket;
+	int Family;						// Address family of the sockets (AF_INET6 for dual-stack sockets)
+
+	// Demultiplexing tables (open addressing, linear probing), one for each socket
+	unsigned int HashSize;				// Power of two, at least 4 times MaxSessions
+	TSessionHashEntry* ControlTable;
+	TSessionHashEntry* DataTable;
+
+	TRTPReceiveSlot ReceiveSlots[RTP_RECEIVE_SLOTS];
+
+	// Fan-out : MIDI blocks sent to all opened sessions
+	CRTPMIDIBlockQueue GroupQueue;
+	unsigned char GroupList[MAX_RTP_LOAD];
+	TRTPGroupHeader* GroupHeaders;		// One header per session
+	TLongMIDIRTPMsg GroupPacket;		// Datagram assembled in one buffer (capture, or no batched transmission)
+	unsigned int* GroupSessions;		// Index of the session of each group packet being sent
+#if defined (__TARGET_LINUX__)
+	mmsghdr* GroupMessages;
+	iovec* GroupVectors;				// Header, shared MIDI list and journal of each packet
+#endif
+
+#ifdef RTP_MIDI_TRACE
+	CRTPMIDITrace Trace;
+#endif
+
+	//! Returns the index of the session associated with IP/port, -1 if not found
+	int Lookup (TSessionHashEntry* Table, unsigned int IP, unsigned short Port);
+
+	//! Adds a session initiated by the manager, the address being in the family of the sockets
+	int AttachNewSession (const TRTPMIDIAddress* DestAddress, unsigned short DestCtrlPort, unsigned short DestDataPort);
+	void Insert (TSessionHashEntry* Table, unsigned int IP, unsigned short Port, unsigned short Index);
+
+	//! Rebuilds both tables from the addresses recorded for active sessions
+	void RebuildTables (void);
+
+	//! Checks if session address has changed since it has been recorded, and rebuilds the tables if needed
+	void UpdateSessionKey (int Index);
+
+	void DispatchControlPacket (TRTPReceiveSlot* Slot);
+	void DispatchDataPacket (TRTPReceiveSlot* Slot);
+
+	//! Sends an invitation rejection to a remote device when no slot is available
+	void SendRejection (TRTPReceiveSlot* Slot);
+
+	//! Records a datagram which is not dispatched to a session (Flags : RTP_CAPTURE_DATA for data socket)
+	void CaptureUnmatched (TRTPReceiveSlot* Slot, unsigned int Flags);
+
+	//! Applies slot changes requested by AddSession / RemoveSession and frees the listener slots which are not used anymore
+	void UpdateSlots (void);
+
+	//! Sends the blocks of the group queue to all opened sessions
+	void SendGroupPacket (void);
+};
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ *  RTP_MIDI_Trace.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Optional instrumentation of the realtime thread (histograms and trace events)
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ The realtime thread accumulates the time of each phase during a tick, then
+ adds the totals to log2 histograms at the end of the tick. Buckets are
+ atomic counters updated with relaxed ordering : a snapshot taken by another
+ thread may be one tick late, but never blocks the realtime thread.
+ */
+
+#include "RTP_MIDI_Trace.h"
+#include <string.h>
+#if defined (__TARGET_LINUX__)
+#include <time.h>
+#if defined (RTP_MIDI_USDT)
+#include <sys/sdt.h>
+#endif
+#endif
+#if defined (__TARGET_MAC__)
+#include <mach/mach_time.h>
+#endif
+#if defined (__TARGET_WIN__)
+#include <windows.h>
+#endif
+
+CRTPMIDITrace::CRTPMIDITrace(void)
+{
+	EventsEnabled.store(false);
+	Events=0;
+	EventWrite.store(0);
+	EventRead.store(0);
+	TickStart=0;
+	LastTickStart=0;
+	memset (&PhaseTime[0], 0, sizeof(PhaseTime));
+	TickPackets=0;
+	Reset();
+}  // CRTPMIDITrace::CRTPMIDITrace
+//---------------------------------------------------------------------------
+
+CRTPMIDITrace::~CRTPMIDITrace(void)
+{
+	if (Events!=0) delete[] Events;
+}  // CRTPMIDITrace::~CRTPMIDITrace
+//---------------------------------------------------------------------------
+
+unsigned long long CRTPMIDITrace::Now (void)
+{
+#if defined (__TARGET_LINUX__)
+	timespec Time;
+
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (unsigned long long)Time.tv_sec*1000000000ULL+(unsigned long long)Time.tv_nsec;
+#endif
+#if defined (__TARGET_MAC__)
+	static mach_timebase_info_data_t TimeBase = {0, 0};
+
+	if (TimeBase.denom == 0) mach_timebase_info(&TimeBase);
+	return mach_absolute_time()*TimeBase.numer/TimeBase.denom;
+#endif
+#if defined (__TARGET_WIN__)
+	static LARGE_INTEGER Frequency = {0};
+	LARGE_INTEGER Time;
+
+	if (Frequency.QuadPart == 0) QueryPerformanceFrequency(&Frequency);
+	QueryPerformanceCounter(&Time);
+	return (unsigned long long)(Time.QuadPart/Frequency.QuadPart)*1000000000ULL+
+		(unsigned long long)((Time.QuadPart%Frequency.QuadPart)*1000000000LL/Frequency.QuadPart);
+#endif
+}  // CRTPMIDITrace::Now
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::Reset (void)
+{
+	int Histogram;
+	int Bucket;
+
+	for (Histogram=0; Histogram<RTP_TRACE_HISTOGRAMS; Histogram++)
+	{
+		for (Bucket=0; Bucket<RTP_TRACE_BUCKETS; Bucket++)
+			Buckets[Histogram][Bucket].store(0, std::memory_order_relaxed);
+		Max[Histogram].store(0, std::memory_order_relaxed);
+	}
+}  // CRTPMIDITrace::Reset
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::Record (int Histogram, unsigned long long Value)
+{
+	int Bucket=0;
+	unsigned int Value32;
+
+	if (Value>0xFFFFFFFFULL) Value32=0xFFFFFFFF;
+	else Value32=(unsigned int)Value;
+
+	// Bucket is the number of significant bits
+	while ((Bucket<RTP_TRACE_BUCKETS-1)&&((Value32>>Bucket)!=0)) Bucket++;
+	Buckets[Histogram][Bucket].fetch_add(1, std::memory_order_relaxed);
+	// Only the realtime thread writes the maximum, Reset excepted
+	if (Value32>Max[Histogram].load(std::memory_order_relaxed)) Max[Histogram].store(Value32, std::memory_order_relaxed);
+}  // CRTPMIDITrace::Record
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::GetSnapshot (int Histogram, TRTPMIDIHistogramSnapshot* Snapshot)
+{
+	int Bucket;
+
+	memset (Snapshot, 0, sizeof(TRTPMIDIHistogramSnapshot));
+	if ((Histogram<0)||(Histogram>=RTP_TRACE_HISTOGRAMS)) return;
+
+	for (Bucket=0; Bucket<RTP_TRACE_BUCKETS; Bucket++)
+	{
+		Snapshot->Buckets[Bucket]=Buckets[Histogram][Bucket].load(std::memory_order_relaxed);
+		Snapshot->Count+=Snapshot->Buckets[Bucket];
+	}
+	Snapshot->Max=Max[Histogram].load(std::memory_order_relaxed);
+}  // CRTPMIDITrace::GetSnapshot
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDITrace::GetPercentile (TRTPMIDIHistogramSnapshot* Snapshot, unsigned int Percent)
+{
+	unsigned long long Target;
+	unsigned long long Total=0;
+	int Bucket;
+
+	if (Snapshot->Count==0) return 0;
+	if (Percent>100) Percent=100;
+	Target=((unsigned long long)Snapshot->Count*Percent+99)/100;
+	if (Target==0) Target=1;
+
+	for (Bucket=0; Bucket<RTP_TRACE_BUCKETS; Bucket++)
+	{
+		Total+=Snapshot->Buckets[Bucket];
+		if (Total>=Target)
+		{
+			if (Bucket==0) return 0;
+			if ((Bucket>=32)||((1U<<Bucket)-1>Snapshot->Max)) return Snapshot->Max;
+			return (1U<<Bucket)-1;
+		}
+	}
+	return Snapshot->Max;
+}  // CRTPMIDITrace::GetPercentile
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::EnableEvents (bool Enable)
+{
+	if ((Enable)&&(Events==0))
+	{
+		Events=new TRTPMIDITraceEvent[RTP_TRACE_EVENTS];
+		EventRead.store(EventWrite.load());
+	}
+	EventsEnabled.store(Enable, std::memory_order_release);
+}  // CRTPMIDITrace::EnableEvents
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::StartTick (void)
+{
+	TickStart=Now();
+	if (LastTickStart!=0) Record(RTP_TRACE_INTERVAL, TickStart-LastTickStart);
+	LastTickStart=TickStart;
+	memset (&PhaseTime[0], 0, sizeof(PhaseTime));
+	TickPackets=0;
+}  // CRTPMIDITrace::StartTick
+//---------------------------------------------------------------------------
+
+void CRTPMIDITrace::EndTick (void)
+{
+	int Phase;
+	unsigned int Write;
+	TRTPMIDITraceEvent* Event;
+
+	PhaseTime[RTP_TRACE_TICK]=Now()-TickStart;
+	for (Phase=0; Phase<RTP_TRACE_INTERVAL; Phase++)
+		Record(Phase, PhaseTime[Phase]);
+	Record(RTP_TRACE_PACKETS, TickPackets);
+
+#if defined (__TARGET_LINUX__) && defined (RTP_MIDI_USDT)
+	DTRACE_PROBE6(rtpmidi, tick, PhaseTime[RTP_TRACE_TICK], PhaseTime[RTP_TRACE_RECEIVE], PhaseTime[RTP_TRACE_DECODE],
+				  PhaseTime[RTP_TRACE_CALLBACK], PhaseTime[RTP_TRACE_SEND], TickPackets);
+#endif
+
+	// Ticks without any packet are not exported, so the trace is not flooded by idle ticks
+	if (EventsEnabled.load(std::memory_order_acquire)==false) return;
+	if ((TickPackets==0)&&(PhaseTime[RTP_TRACE_SEND]==0)) return;
+	Write=EventWrite.load(std::memory_order_relaxed);
+	if (Write-EventRead.load(std::memory_order_acquire)>=RTP_TRACE_EVENTS) return;		// Ring is full : tick is lost
+
+	Event=&Events[Write&(RTP_TRACE_EVENTS-1)];
+	Event->Start=TickStart;
+	for (Phase=0; Phase<RTP_TRACE_INTERVAL; Phase++)
+	{
+		if (PhaseTime[Phase]>0xFFFFFFFFULL) Event->Phases[Phase]=0xFFFFFFFF;
+		else Event->Phases[Phase]=(unsigned int)PhaseTime[Phase];
+	}
+	Event->Packets=TickPackets;
+	EventWrite.store(Write+1, std::memory_order_release);
+}  // CRTPMIDITrace::EndTick
+//---------------------------------------------------------------------------
+
+unsigned int CRTPMIDITrace::ExportChromeTrace (FILE* File, unsigned int ThreadID)
+{
+	unsigned int Read;
+	unsigned int Write;
+	unsigned int Count=0;
+	TRTPMIDITraceEvent* Event;
+
+	if ((Events==0)||(File==0)) return 0;
+
+	Read=EventRead.load(std::memory_order_relaxed);
+	Write=EventWrite.load(std::memory_order_acquire);
+	while (Read!=Write)
+	{
+		Event=&Events[Read&(RTP_TRACE_EVENTS-1)];
+		// Chrome trace times are in microseconds
+		fprintf (File, "{\"name\":\"RunSession\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+				 "\"args\":{\"receive\":%.3f,\"decode\":%.3f,\"callback\":%.3f,\"send\":%.3f,\"packets\":%u}},\n",
+				 ThreadID, (double)Event->Start/1000.0, (double)Event->Phases[RTP_TRACE_TICK]/1000.0,
+				 (double)Event->Phases[RTP_TRACE_RECEIVE]/1000.0, (double)Event->Phases[RTP_TRACE_DECODE]/1000.0,
+				 (double)Event->Phases[RTP_TRACE_CALLBACK]/1000.0, (double)Event->Phases[RTP_TRACE_SEND]/1000.0,
+				 Event->Packets);
+		Read++;
+		Count++;
+	}
+	EventRead.store(Read, std::memory_order_release);
+	return Count;
+}  // CRTPMIDITrace::ExportChromeTrace
+//---------------------------------------------------------------------------
+
@@ -0,0 +1,153 @@
+/*
+ *  RTP_MIDI_Trace.h
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Optional instrumentation of the realtime thread (histograms and trace events)
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+//---------------------------------------------------------------------------
+#ifndef __RTP_MIDI_TRACE_H__
+#define __RTP_MIDI_TRACE_H__
+//---------------------------------------------------------------------------
+
+// Instrumentation is only compiled when RTP_MIDI_TRACE is defined (add -DRTP_MIDI_TRACE to compiler options)
+// Define also RTP_MIDI_USDT on Linux to get a "rtpmidi:tick" USDT probe on each tick (requires sys/sdt.h)
+
+#include <atomic>
+#include <stdio.h>
+
+// Histograms (all times in nanoseconds)
+#define RTP_TRACE_TICK			0	// Duration of RunSession
+#define RTP_TRACE_RECEIVE		1	// Time spent reading the sockets during a tick
+#define RTP_TRACE_DECODE		2	// Time spent processing incoming packets, callbacks excepted
+#define RTP_TRACE_CALLBACK		3	// Time spent in application callbacks
+#define RTP_TRACE_SEND			4	// Time spent sending RTP-MIDI packets
+#define RTP_TRACE_INTERVAL		5	// Time between the start of two ticks
+#define RTP_TRACE_PACKETS		6	// Packets received during a tick (count, not time)
+#define RTP_TRACE_HISTOGRAMS	7
+
+// Bucket n counts values from 2^(n-1) to 2^n-1 (bucket 0 counts zero values)
+#define RTP_TRACE_BUCKETS		33
+
+// Number of ticks kept for trace export (power of 2)
+#define RTP_TRACE_EVENTS		4096
+
+typedef struct {
+	unsigned int Buckets[RTP_TRACE_BUCKETS];
+	unsigned int Count;
+	unsigned int Max;
+} TRTPMIDIHistogramSnapshot;
+
+// One tick recorded for trace export
+typedef struct {
+	unsigned long long Start;		// ns, monotonic clock
+	unsigned int Phases[RTP_TRACE_INTERVAL];	// Tick duration and phases (see RTP_TRACE_xxx)
+	unsigned int Packets;
+} TRTPMIDITraceEvent;
+
+class CRTPMIDITrace
+{
+public:
+	CRTPMIDITrace(void);
+	~CRTPMIDITrace(void);
+
+	//! Monotonic clock in nanoseconds
+	static unsigned long long Now (void);
+
+	//! Clears all histograms. Can be called from any thread, while ticks are recorded
+	void Reset (void);
+
+	//! Copies a histogram (RTP_TRACE_xxx). Can be called from any thread
+	void GetSnapshot (int Histogram, TRTPMIDIHistogramSnapshot* Snapshot);
+
+	//! Returns the upper limit of the bucket holding the given percentile (0 to 100) of a snapshot (never more than Max)
+	static unsigned int GetPercentile (TRTPMIDIHistogramSnapshot* Snapshot, unsigned int Percent);
+
+	//! Ticks are also recorded for ExportChromeTrace when enabled (disabled by default). Allocates the event ring on first call
+	void EnableEvents (bool Enable);
+
+	//! Writes the ticks recorded since last call as Chrome trace events ("X" events, one per line followed by a comma)
+	//! The file must start with '[' : closing bracket is optional in this format. Call from a non realtime thread
+	//! \param ThreadID value written in the "tid" field, to show several endpoints in the same trace
+	//! \return number of events written
+	unsigned int ExportChromeTrace (FILE* File, unsigned int ThreadID);
+
+	// Methods called by the realtime thread
+	void StartTick (void);
+	void EndTick (void);
+
+	//! Adds the time elapsed since Start to a phase of the current tick
+	void AddTime (int Phase, unsigned long long Start)
+	{
+		PhaseTime[Phase]+=Now()-Start;
+	}
+
+	//! Adds the time elapsed since Start to the decode phase, minus the time spent meanwhile in callbacks
+	void AddDecodeTime (unsigned long long Start, unsigned long long CallbackMark)
+	{
+		PhaseTime[RTP_TRACE_DECODE]+=(Now()-Start)-(PhaseTime[RTP_TRACE_CALLBACK]-CallbackMark);
+	}
+
+	unsigned long long GetCallbackTime (void) { return PhaseTime[RTP_TRACE_CALLBACK]; }
+
+	void AddPackets (unsigned int Count) { TickPackets+=Count; }
+
+private:
+	std::atomic<unsigned int> Buckets[RTP_TRACE_HISTOGRAMS][RTP_TRACE_BUCKETS];
+	std::atomic<unsigned int> Max[RTP_TRACE_HISTOGRAMS];
+
+	unsigned long long TickStart;
+	unsigned long long LastTickStart;
+	unsigned long long PhaseTime[RTP_TRACE_INTERVAL];
+	unsigned int TickPackets;
+
+	// Single producer / single consumer ring of recorded ticks
+	std::atomic<bool> EventsEnabled;
+	TRTPMIDITraceEvent* Events;
+	std::atomic<unsigned int> EventWrite;
+	std::atomic<unsigned int> EventRead;
+
+	void Record (int Histogram, unsigned long long Value);
+};
+
+#ifdef RTP_MIDI_TRACE
+#define RTP_TRACE_STAMP(Var)						unsigned long long Var=CRTPMIDITrace::Now()
+#define RTP_TRACE_ADD(Trace, Phase, Var)			(Trace)->AddTime(Phase, Var)
+#define RTP_TRACE_DECODE_START(Var, Mark, Trace)	unsigned long long Var=CRTPMIDITrace::Now(); unsigned long long Mark=(Trace)->GetCallbackTime()
+#define RTP_TRACE_DECODE_END(Trace, Var, Mark)		(Trace)->AddDecodeTime(Var, Mark)
+#define RTP_TRACE_PACKETS_ADD(Trace, Count)			(Trace)->AddPackets(Count)
+#define RTP_TRACE_TICK_START(Trace)					(Trace)->StartTick()
+#define RTP_TRACE_TICK_END(Trace)					(Trace)->EndTick()
+#else
+#define RTP_TRACE_STAMP(Var)
+#define RTP_TRACE_ADD(Trace, Phase, Var)
+#define RTP_TRACE_DECODE_START(Var, Mark, Trace)
+#define RTP_TRACE_DECODE_END(Trace, Var, Mark)
+#define RTP_TRACE_PACKETS_ADD(Trace, Count)
+#define RTP_TRACE_TICK_START(Trace)
+#define RTP_TRACE_TICK_END(Trace)
+#endif
+
+#endif
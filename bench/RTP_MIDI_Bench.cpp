@@ -0,0 +1,361 @@
+/*
+ *  RTP_MIDI_Bench.cpp
+ *  Cross-platform RTP-MIDI session initiator/listener endpoint class
+ *  Benchmark of the decoder, the encoder and of loopback round trips
+ *
+ *  Copyright (c) 2012/2024 Benoit BOUCHEZ (BEB)
+ *
+ * License : MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ Standalone program, not part of the library. Synthetic RTP-MIDI packets are
+ decoded with InjectRTPPacket (no socket involved), then two endpoints are
+ connected on the loopback interface to measure the send path (SendRTPMIDIBlock
+ to the datagram leaving RunSession) and full round trips (note sent by A,
+ echoed by the callback of B, received by A).
+
+ Results are given per event (one callback call) and as percentiles of the time
+ needed to process one packet (or one round trip).
+ See README.md (Benchmark) for build instructions.
+ */
+
+#include "RTP_MIDI.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_PACKETS			20000		// Packets decoded for each decoder scenario
+#define BENCH_ENCODER_TICKS		20000		// Ticks measured for the encoder
+#define BENCH_ENCODER_BLOCKS	64			// Blocks queued before each tick
+#define BENCH_ROUND_TRIPS		2000
+#define BENCH_SYSEX_SIZE		4000		// Size of the segmented SYSEX message
+#define BENCH_SYSEX_SEGMENT		900			// Size of a SYSEX segment in one packet
+#define BENCH_BASE_PORT			5104		// Local ports used by the loopback endpoints (4 consecutive ports)
+
+typedef std::chrono::steady_clock TBenchClock;
+
+typedef struct {
+	unsigned long Events;			// Callback calls
+	CRTP_MIDI* Echo;				// Session which sends back the received notes (0 : no echo)
+	bool EchoReceived;
+} TBenchCounters;
+
+typedef struct {
+	unsigned char Data[1500];
+	int Size;
+} TBenchPacket;
+
+static void BenchCallback (void* UserInstance, unsigned int DataSize, unsigned char* DataBlock, unsigned int)
+{
+	TBenchCounters* Counters=(TBenchCounters*)UserInstance;
+	unsigned char Block[4];
+
+	Counters->Events++;
+	if ((DataSize==3)&&((DataBlock[0]&0xF0)==0x90))
+	{
+		if (Counters->Echo!=0)
+		{
+			Block[0]=0;
+			memcpy(&Block[1], DataBlock, 3);
+			Counters->Echo->SendRTPMIDIBlock(4, &Block[0]);
+		}
+		else Counters->EchoReceived=true;
+	}
+}  // BenchCallback
+//---------------------------------------------------------------------------
+
+static double ElapsedNanos (TBenchClock::time_point Start, TBenchClock::time_point End)
+{
+	return std::chrono::duration<double, std::nano>(End-Start).count();
+}  // ElapsedNanos
+//---------------------------------------------------------------------------
+
+//! Writes the RTP header and the MIDI command section header (long form, Z=1) in front of a MIDI list of ListSize bytes
+static void BuildPacket (TBenchPacket* Packet, unsigned int ListSize)
+{
+	memset(&Packet->Data[0], 0, 12);
+	Packet->Data[0]=0x80;
+	Packet->Data[1]=0x61;
+	Packet->Data[8]=0x12;		// SSRC
+	Packet->Data[12]=0x80|0x20|((ListSize>>8)&0x0F);
+	Packet->Data[13]=ListSize&0xFF;
+	Packet->Size=14+ListSize;
+}  // BuildPacket
+//---------------------------------------------------------------------------
+
+static void BuildRunningStatus (std::vector<TBenchPacket>* Packets)
+{
+	TBenchPacket Packet;
+	unsigned int Pos=14;
+	unsigned int Note=0;
+
+	// 300 note on with running status, after a first complete message
+	Packet.Data[Pos++]=0;
+	Packet.Data[Pos++]=0x90;
+	Packet.Data[Pos++]=0x3C;
+	Packet.Data[Pos++]=0x64;
+	while (Note<299)
+	{
+		Packet.Data[Pos++]=0;
+		Packet.Data[Pos++]=Note&0x7F;
+		Packet.Data[Pos++]=(Note*3)&0x7F;
+		Note++;
+	}
+	BuildPacket(&Packet, Pos-14);
+	Packets->push_back(Packet);
+}  // BuildRunningStatus
+//---------------------------------------------------------------------------
+
+static void BuildControlBurst (std::vector<TBenchPacket>* Packets)
+{
+	TBenchPacket Packet;
+	unsigned int Pos=14;
+	unsigned int Event;
+
+	// 200 control changes on 16 channels, each one with its status byte
+	for (Event=0; Event<200; Event++)
+	{
+		Packet.Data[Pos++]=0;
+		Packet.Data[Pos++]=0xB0|(Event&0x0F);
+		Packet.Data[Pos++]=(Event/16)&0x7F;
+		Packet.Data[Pos++]=(Event*5)&0x7F;
+	}
+	BuildPacket(&Packet, Pos-14);
+	Packets->push_back(Packet);
+}  // BuildControlBurst
+//---------------------------------------------------------------------------
+
+static void BuildSegmentedSysEx (std::vector<TBenchPacket>* Packets)
+{
+	TBenchPacket Packet;
+	unsigned int Sent=0;
+	unsigned int Segment;
+	unsigned int Pos;
+
+	// RFC 6295 segments : F0 ... F0, then F7 ... F0, then F7 ... F7
+	while (Sent<BENCH_SYSEX_SIZE)
+	{
+		Segment=BENCH_SYSEX_SIZE-Sent;
+		if (Segment>BENCH_SYSEX_SEGMENT) Segment=BENCH_SYSEX_SEGMENT;
+		Pos=14;
+		Packet.Data[Pos++]=0;
+		Packet.Data[Pos++]=(Sent==0)?0xF0:0xF7;
+		memset(&Packet.Data[Pos], 0x55, Segment);
+		Pos+=Segment;
+		Sent+=Segment;
+		Packet.Data[Pos++]=(Sent>=BENCH_SYSEX_SIZE)?0xF7:0xF0;
+		BuildPacket(&Packet, Pos-14);
+		Packets->push_back(Packet);
+	}
+}  // BuildSegmentedSysEx
+//---------------------------------------------------------------------------
+
+static void BuildRealtimeInSysEx (std::vector<TBenchPacket>* Packets)
+{
+	TBenchPacket Packet;
+	unsigned int Pos=14;
+	unsigned int Byte;
+
+	// MIDI clock every 8 bytes of a SYSEX message
+	Packet.Data[Pos++]=0;
+	Packet.Data[Pos++]=0xF0;
+	for (Byte=0; Byte<800; Byte++)
+	{
+		if ((Byte&7)==7) Packet.Data[Pos++]=0xF8;
+		else Packet.Data[Pos++]=Byte&0x7F;
+	}
+	Packet.Data[Pos++]=0xF7;
+	BuildPacket(&Packet, Pos-14);
+	Packets->push_back(Packet);
+}  // BuildRealtimeInSysEx
+//---------------------------------------------------------------------------
+
+static void PrintResult (const char* Name, unsigned long Events, double TotalNanos, std::vector<double>* Latencies, const char* Unit)
+{
+	std::sort(Latencies->begin(), Latencies->end());
+	printf("%-22s %10lu events %8.1f ns/event %8.2f Mevents/s   per %s : p50 %7.0f ns  p99 %7.0f ns  max %8.0f ns\n",
+		   Name, Events, (Events>0)?TotalNanos/Events:0.0, (TotalNanos>0)?Events*1000.0/TotalNanos:0.0, Unit,
+		   (*Latencies)[Latencies->size()/2], (*Latencies)[Latencies->size()*99/100], Latencies->back());
+}  // PrintResult
+//---------------------------------------------------------------------------
+
+static void RunDecoderScenario (const char* Name, void (*Build)(std::vector<TBenchPacket>*))
+{
+	TBenchCounters Counters;
+	std::vector<TBenchPacket> Packets;
+	std::vector<double> Latencies;
+	TBenchPacket Work;
+	TBenchClock::time_point PacketStart;
+	TBenchClock::time_point End;
+	unsigned int Count;
+	unsigned int Index;
+	double TotalNanos=0;
+
+	memset(&Counters, 0, sizeof(TBenchCounters));
+	CRTP_MIDI Session(BENCH_SYSEX_SIZE+16, BenchCallback, &Counters);
+
+	Build(&Packets);
+	Latencies.reserve(BENCH_PACKETS);
+	for (Count=0; Count<BENCH_PACKETS; Count++)
+	{
+		Index=Count%Packets.size();
+		memcpy(&Work, &Packets[Index], sizeof(TBenchPacket));
+		Work.Data[2]=(Count>>8)&0xFF;		// Sequence number
+		Work.Data[3]=Count&0xFF;
+
+		PacketStart=TBenchClock::now();
+		Session.InjectRTPPacket(&Work.Data[0], Work.Size);
+		End=TBenchClock::now();
+		Latencies.push_back(ElapsedNanos(PacketStart, End));
+		TotalNanos+=ElapsedNanos(PacketStart, End);
+	}
+	PrintResult(Name, Counters.Events, TotalNanos, &Latencies, "packet");
+}  // RunDecoderScenario
+//---------------------------------------------------------------------------
+
+//! Runs both sessions until they are opened (or Timeout ms elapsed)
+static bool OpenLoopback (CRTP_MIDI* A, CRTP_MIDI* B, unsigned int Timeout)
+{
+	unsigned int Elapsed;
+
+	B->SetClockSource(RTP_CLOCK_SYSTEM);
+	A->SetClockSource(RTP_CLOCK_SYSTEM);
+	if (B->InitiateSession(0, 0, 0, BENCH_BASE_PORT, BENCH_BASE_PORT+1, false)!=0) return false;
+	if (A->InitiateSession(0x7F000001, BENCH_BASE_PORT, BENCH_BASE_PORT+1, BENCH_BASE_PORT+2, BENCH_BASE_PORT+3, true)!=0) return false;
+
+	for (Elapsed=0; Elapsed<Timeout; Elapsed++)
+	{
+		A->RunSession();
+		B->RunSession();
+		if ((A->getSessionStatus()==3)&&(B->getSessionStatus()==3)) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}  // OpenLoopback
+//---------------------------------------------------------------------------
+
+static void RunEncoder (CRTP_MIDI* A, CRTP_MIDI* B, TBenchCounters* CountersB)
+{
+	std::vector<double> Latencies;
+	TBenchClock::time_point Start;
+	TBenchClock::time_point End;
+	unsigned char Block[4];
+	unsigned int Tick;
+	unsigned int Event;
+	unsigned long Events=0;
+	double TotalNanos=0;
+
+	Latencies.reserve(BENCH_ENCODER_TICKS);
+	for (Tick=0; Tick<BENCH_ENCODER_TICKS; Tick++)
+	{
+		Start=TBenchClock::now();
+		for (Event=0; Event<BENCH_ENCODER_BLOCKS; Event++)
+		{
+			Block[0]=0;
+			Block[1]=0xB0|(Event&0x0F);
+			Block[2]=Event&0x7F;
+			Block[3]=Tick&0x7F;
+			if (A->SendRTPMIDIBlock(4, &Block[0])) Events++;
+		}
+		A->RunSession();			// Packet is built by PrepareMessage and sent
+		End=TBenchClock::now();
+		Latencies.push_back(ElapsedNanos(Start, End));
+		TotalNanos+=ElapsedNanos(Start, End);
+
+		B->RunSession();			// Receiver socket must not overflow
+	}
+	PrintResult("encoder (64 CC/tick)", Events, TotalNanos, &Latencies, "tick");
+	printf("%-22s %10lu events received by partner\n", "", CountersB->Events);
+}  // RunEncoder
+//---------------------------------------------------------------------------
+
+static void RunRoundTrips (CRTP_MIDI* A, CRTP_MIDI* B, TBenchCounters* CountersA)
+{
+	std::vector<double> Latencies;
+	TBenchClock::time_point Start;
+	TBenchClock::time_point End;
+	unsigned char Block[4];
+	unsigned int Trip;
+	unsigned int Lost=0;
+	double TotalNanos=0;
+
+	Latencies.reserve(BENCH_ROUND_TRIPS);
+	for (Trip=0; Trip<BENCH_ROUND_TRIPS; Trip++)
+	{
+		CountersA->EchoReceived=false;
+		Block[0]=0;
+		Block[1]=0x90;
+		Block[2]=Trip&0x7F;
+		Block[3]=0x40;
+
+		Start=TBenchClock::now();
+		A->SendRTPMIDIBlock(4, &Block[0]);
+		do
+		{
+			A->RunSession();
+			B->RunSession();
+			End=TBenchClock::now();
+		} while ((CountersA->EchoReceived==false)&&(ElapsedNanos(Start, End)<100e6));
+
+		if (CountersA->EchoReceived==false) Lost++;
+		Latencies.push_back(ElapsedNanos(Start, End));
+		TotalNanos+=ElapsedNanos(Start, End);
+	}
+	PrintResult("loopback round trip", BENCH_ROUND_TRIPS-Lost, TotalNanos, &Latencies, "trip");
+	if (Lost>0) printf("%-22s %10u round trips not completed in 100ms\n", "", Lost);
+}  // RunRoundTrips
+//---------------------------------------------------------------------------
+
+int main (void)
+{
+	TBenchCounters CountersA;
+	TBenchCounters CountersB;
+
+	RunDecoderScenario("decode running status", BuildRunningStatus);
+	RunDecoderScenario("decode CC burst", BuildControlBurst);
+	RunDecoderScenario("decode segmented SYSEX", BuildSegmentedSysEx);
+	RunDecoderScenario("decode realtime+SYSEX", BuildRealtimeInSysEx);
+
+	memset(&CountersA, 0, sizeof(TBenchCounters));
+	memset(&CountersB, 0, sizeof(TBenchCounters));
+	CRTP_MIDI A(1024, BenchCallback, &CountersA);
+	CRTP_MIDI B(1024, BenchCallback, &CountersB);
+	if (OpenLoopback(&A, &B, 5000)==false)
+	{
+		printf("Loopback session can not be opened (ports %d to %d in use ?)\n", BENCH_BASE_PORT, BENCH_BASE_PORT+3);
+		return 1;
+	}
+
+	RunEncoder(&A, &B, &CountersB);
+
+	CountersB.Echo=&B;				// B sends back every note it receives
+	RunRoundTrips(&A, &B, &CountersA);
+
+	A.CloseSession();
+	B.CloseSession();
+	return 0;
+}  // main
+//---------------------------------------------------------------------------